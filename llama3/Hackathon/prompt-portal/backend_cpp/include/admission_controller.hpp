@@ -0,0 +1,130 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <exception>
+#include <stdexcept>
+#include <asio.hpp>
+#include <nlohmann/json.hpp>
+#include "config.hpp"
+#include "metrics.hpp"
+
+namespace prompt_portal {
+
+/**
+ * Thrown (as an exception_ptr) when a request is shed instead of queued.
+ * Handlers turn it into 429 with a Retry-After header.
+ */
+class AdmissionRejected : public std::runtime_error {
+public:
+    AdmissionRejected(const std::string& reason, int retry_after_sec)
+        : std::runtime_error(reason), retry_after_sec_(retry_after_sec) {}
+
+    int retry_after() const { return retry_after_sec_; }
+
+private:
+    int retry_after_sec_;
+};
+
+/**
+ * Bounded-concurrency gate in front of LLMClient.
+ * At most max_concurrent_per_upstream x upstream count generations run at once.
+ * Everyone else waits in a start-time fair queue keyed by user, so one user's
+ * burst is interleaved with other users' requests instead of running ahead
+ * of them. Requests are shed with 429 when a queue is full, when the
+ * estimated wait exceeds max_queue_wait_ms, or when that deadline passes
+ * while still queued.
+ */
+class AdmissionController {
+public:
+    /**
+     * One running request's share of capacity. release() (or destruction)
+     * hands it to the next queued request.
+     */
+    class Ticket {
+    public:
+        explicit Ticket(AdmissionController& owner);
+        ~Ticket();
+        Ticket(const Ticket&) = delete;
+        Ticket& operator=(const Ticket&) = delete;
+
+        void release();
+
+    private:
+        AdmissionController& owner_;
+        std::chrono::steady_clock::time_point granted_;
+        std::atomic<bool> released_{false};
+    };
+
+    using TicketPtr = std::shared_ptr<Ticket>;
+    using AdmitCallback = std::function<void(std::exception_ptr error, TicketPtr ticket)>;
+
+    static AdmissionController& instance();
+
+    void configure(const LlmConfig& config, size_t upstream_count);
+
+    /**
+     * Run on_admitted with a ticket once capacity is available, or with an
+     * AdmissionRejected error. Runs inline when admitted immediately; queued
+     * requests are resumed on an upstream I/O thread.
+     */
+    void admit(const std::string& user_key, double weight, AdmitCallback on_admitted);
+
+    nlohmann::json stats() const;
+
+private:
+    AdmissionController() = default;
+    AdmissionController(const AdmissionController&) = delete;
+    AdmissionController& operator=(const AdmissionController&) = delete;
+
+    struct Waiter {
+        std::string user;
+        AdmitCallback on_admitted;
+        std::chrono::steady_clock::time_point enqueued;
+        std::shared_ptr<asio::steady_timer> deadline;
+    };
+
+    struct UserState {
+        double last_tag = 0.0;  // virtual finish tag of the user's newest request
+        size_t queued = 0;
+    };
+
+    // Ordered by (virtual tag, arrival sequence)
+    using QueueKey = std::pair<double, uint64_t>;
+
+    mutable std::mutex mutex_;
+    int capacity_ = 8;
+    int active_ = 0;
+    size_t max_queue_ = 256;
+    size_t max_queue_per_user_ = 8;
+    std::chrono::milliseconds max_wait_{30000};
+
+    std::map<QueueKey, Waiter> queue_;
+    std::unordered_map<std::string, UserState> users_;
+    double virtual_time_ = 0.0;
+    uint64_t sequence_ = 0;
+    double avg_service_sec_ = 0.0;  // EWMA of ticket hold time
+
+    std::atomic<uint64_t> admitted_{0};
+    std::atomic<uint64_t> queued_total_{0};
+    std::atomic<uint64_t> rejected_queue_full_{0};
+    std::atomic<uint64_t> rejected_user_limit_{0};
+    std::atomic<uint64_t> rejected_predicted_{0};
+    std::atomic<uint64_t> rejected_deadline_{0};
+    LatencyHistogram queue_wait_;
+
+    void release(std::chrono::steady_clock::duration held);
+    void expire(QueueKey key);
+    // Caller holds mutex_
+    double estimate_wait_locked(size_t position) const;
+    int retry_after_locked() const;
+    void forget_user_locked(const std::string& user);
+};
+
+} // namespace prompt_portal
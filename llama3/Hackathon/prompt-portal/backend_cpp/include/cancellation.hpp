@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <stdexcept>
+
+namespace prompt_portal {
+
+/**
+ * Error delivered to completion callbacks when a request was cancelled.
+ * It says nothing about the upstream's health.
+ */
+class RequestCancelled : public std::runtime_error {
+public:
+    RequestCancelled() : std::runtime_error("Request cancelled") {}
+};
+
+/**
+ * One-shot cancellation signal shared between a request's owner (e.g. the
+ * handler watching the client connection) and the code doing the work.
+ */
+class CancellationToken {
+public:
+    // Idempotent; runs the registered callbacks on the calling thread
+    void cancel();
+
+    bool cancelled() const { return cancelled_.load(std::memory_order_acquire); }
+
+    // Runs fn right away if the token is already cancelled
+    void on_cancel(std::function<void()> fn);
+
+private:
+    std::mutex mutex_;
+    std::atomic<bool> cancelled_{false};
+    std::vector<std::function<void()>> callbacks_;
+};
+
+} // namespace prompt_portal
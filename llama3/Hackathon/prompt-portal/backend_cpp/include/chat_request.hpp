@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace prompt_portal {
+
+struct ChatMessage {
+    std::string role;     // "system", "user", or "assistant"
+    std::string content;
+};
+
+// Immutable once created, so dialog snapshots can share it across threads
+using MessagePtr = std::shared_ptr<const ChatMessage>;
+
+/**
+ * The messages of one request, borrowed from either a plain vector or a
+ * vector of shared messages (a session's dialog snapshot). Must not outlive
+ * the vector it was made from.
+ */
+class ChatMessages {
+public:
+    ChatMessages() = default;
+    ChatMessages(const std::vector<ChatMessage>& messages)
+        : plain_(messages.data()), size_(messages.size()) {}
+    ChatMessages(const std::vector<MessagePtr>& messages)
+        : shared_(messages.data()), size_(messages.size()) {}
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const ChatMessage& operator[](size_t i) const { return shared_ ? *shared_[i] : plain_[i]; }
+
+private:
+    const ChatMessage* plain_ = nullptr;
+    const MessagePtr* shared_ = nullptr;
+    size_t size_ = 0;
+};
+
+/**
+ * Everything that goes into an OpenAI-compatible /v1/chat/completions body.
+ * Holds the messages by pointer, so building one copies no conversation text.
+ */
+struct ChatRequest {
+    ChatMessages messages;
+    std::string_view model = "default";
+    double temperature = 0.6;
+    double top_p = 0.9;
+    int max_tokens = 4096;
+    int seed = -1;              // Omitted when negative
+    int id_slot = -1;           // llama.cpp slot; omitted when negative
+    bool stream = false;
+    bool cache_prompt = true;
+    bool skip_thinking = true;  // Sends extra_body.enable_thinking = false
+};
+
+/**
+ * Serialize request as JSON straight from the ChatMessage strings, without
+ * building a nlohmann::json document. The result lives in a thread-local
+ * buffer that is reused (and keeps its capacity) across calls, so it is only
+ * valid until the next call on the same thread.
+ */
+std::string_view write_chat_request(const ChatRequest& request);
+
+/**
+ * Append value to out as a quoted JSON string. Runs of plain ASCII are copied
+ * eight bytes at a time; invalid UTF-8 is replaced with U+FFFD.
+ */
+void append_json_string(std::string& out, std::string_view value);
+
+} // namespace prompt_portal
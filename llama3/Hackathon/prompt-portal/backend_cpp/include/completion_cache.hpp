@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+
+namespace prompt_portal {
+
+/**
+ * Exact-match cache of completions for deterministic requests.
+ * Keys are the serialized upstream request body (model, messages and sampling
+ * parameters), hashed with FNV-1a to pick one of kShards independently locked
+ * LRU lists. The full key is kept and compared, so a hash collision is a miss,
+ * never a wrong answer. Entries count key + value bytes against max_bytes;
+ * ttl_sec = 0 keeps entries until they are evicted.
+ */
+class CompletionCache {
+public:
+    CompletionCache(size_t max_bytes, int ttl_sec);
+
+    std::optional<std::string> get(const std::string& key);
+    void put(const std::string& key, const std::string& value);
+
+    nlohmann::json stats() const;
+
+private:
+    static constexpr size_t kShards = 16;
+    static constexpr size_t kEntryOverhead = 96;  // list node, map slot, bookkeeping
+
+    struct Entry {
+        uint64_t hash;
+        std::string key;
+        std::shared_ptr<const std::string> value;
+        std::chrono::steady_clock::time_point expires;
+        size_t bytes;
+    };
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::list<Entry> lru;  // most recently used first
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+        size_t bytes = 0;
+    };
+
+    size_t shard_budget_;
+    std::chrono::seconds ttl_;
+    Shard shards_[kShards];
+
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> evictions_{0};
+    std::atomic<uint64_t> expired_{0};
+
+    static uint64_t hash(const std::string& key);
+    Shard& shard_for(uint64_t hash) { return shards_[hash % kShards]; }
+    // Caller holds shard.mutex
+    void erase_locked(Shard& shard, std::list<Entry>::iterator it);
+};
+
+} // namespace prompt_portal
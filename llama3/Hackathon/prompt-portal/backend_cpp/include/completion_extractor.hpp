@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace prompt_portal {
+
+/**
+ * The parts of an OpenAI-compatible chat completion (or one SSE stream chunk)
+ * that the backend uses. Counters are -1 when the response did not carry them.
+ */
+struct CompletionFields {
+    bool has_choice = false;
+    std::string content;        // choices[0].message.content, or .delta.content for a stream chunk
+    std::string finish_reason;  // Empty while a stream is still generating
+
+    struct Usage {
+        int prompt_tokens = -1;
+        int completion_tokens = -1;
+        int total_tokens = -1;
+    } usage;
+
+    // llama.cpp's "timings" object
+    struct Timings {
+        bool present = false;
+        int prompt_n = 0;
+        int cache_n = 0;
+        int predicted_n = 0;
+        double prompt_ms = 0.0;
+        double predicted_ms = 0.0;
+        double prompt_per_second = 0.0;
+        double predicted_per_second = 0.0;
+    } timings;
+
+    int id_slot = -1;
+
+    bool has_error = false;
+    std::string error;          // "error" itself when a string, else error.message
+
+    // Clears every field but keeps the strings' capacity for the next chunk
+    void reset();
+};
+
+/**
+ * Pull CompletionFields out of body with nlohmann's SAX parser, so no JSON
+ * document is built. The content string is swapped out of the parser's token
+ * buffer rather than copied, so the parser's own buffer is its only
+ * allocation. Returns false (fields partially filled) if body is not valid JSON.
+ */
+bool extract_completion(std::string_view body, CompletionFields& fields);
+
+} // namespace prompt_portal
@@ -10,6 +10,7 @@ namespace prompt_portal {
 struct ServerConfig {
     std::string host = "0.0.0.0";
     int port = 8000;
+    int stream_port = 8001;  // SSE and NDJSON endpoints, written incrementally; 0 disables
     int threads = 4;
 };
 
@@ -21,6 +22,7 @@ struct AuthConfig {
     std::string secret_key = "change_me_in_production";
     std::string algorithm = "HS256";
     int token_expire_minutes = 60;
+    std::vector<std::string> admin_emails;  // May read /api/llm/usage, which lists every user
 };
 
 struct CorsConfig {
@@ -30,12 +32,55 @@ struct CorsConfig {
     std::vector<std::string> allowed_headers;
 };
 
+struct UpstreamConfig {
+    std::string url;
+    int weight = 1;
+};
+
 struct LlmConfig {
     std::string server_url = "http://localhost:8080";
-    int timeout = 300;
+    std::vector<UpstreamConfig> upstreams;  // Overrides server_url when non-empty
+    std::string balance_policy = "least_outstanding";  // or "power_of_two"
+    int eject_after_failures = 3;   // Consecutive failures before an upstream is ejected
+    int eject_duration = 10;        // Seconds an ejected upstream sits out
+    std::string health_check_path = "/health";  // GET on each upstream; 200 means healthy
+    int health_check_interval_ms = 5000;  // 0 disables background probing
+    int health_check_timeout_ms = 2000;
+    bool hedge_requests = false;    // Race a slow request against a copy on another upstream
+    double hedge_percentile = 0.95; // Of recent first-token times; a request slower than this is hedged
+    int hedge_min_delay_ms = 50;    // Never hedge sooner than this
+    int hedge_budget_percent = 10;  // Hedges allowed per 100 requests
+    int slots_per_upstream = 0;     // llama-server --parallel; > 0 pins each session to an id_slot
+    int max_concurrent_per_upstream = 8;  // Generations admitted at once, per upstream
+    int max_queue = 256;            // Requests waiting for admission before 429
+    int max_queue_per_user = 8;     // Queued requests per user before 429
+    int max_queue_wait_ms = 30000;  // Longest a request may wait for admission
+    int batch_max_items = 256;      // Prompts accepted by one /api/llm/chat/batch request
+    int batch_max_parallel = 8;     // Items of one batch in flight at once; also kept below max_queue_per_user
+    int max_history_messages = 20;  // User + assistant pairs kept per session
+    int history_token_budget = 4096;  // Estimated prompt tokens per session turn; 0 = no limit
+    int session_ttl = 3600;         // Seconds a session may sit idle before it is evicted; 0 keeps it
+    int session_memory_mb = 256;    // Dialog bytes held across all sessions; 0 = no limit
+    int session_reap_interval = 5;  // Seconds between eviction passes
+    std::string session_store_path = "./sessions.db";  // SQLite file sessions persist to; "" keeps them in memory only
+    int session_store_flush_ms = 50;  // Longest a change waits before it is written
+    int timeout = 300;              // Seconds; total deadline for one request, queue wait included
+    int connect_timeout_ms = 5000;  // Acquiring an upstream connection (DNS + TCP)
+    int first_token_timeout_ms = 120000;  // Request sent -> first response byte / streamed token
+    int inter_token_timeout_ms = 30000;   // Longest silence allowed mid-response
     double temperature = 0.6;
     double top_p = 0.9;
     int max_tokens = 4096;
+    int seed = -1;                  // Fixed sampling seed; -1 lets the server pick one per request
+    int pool_max_connections = 16;  // Per upstream host:port
+    int pool_idle_timeout = 4;      // Seconds; keep below llama-server's 5 s keep-alive
+    int io_threads = 2;             // Threads multiplexing all upstream requests
+    int dns_ttl = 30;               // Seconds a resolved upstream address is reused
+    int dns_negative_ttl = 5;       // Seconds a failed lookup is remembered
+    int connect_attempt_delay_ms = 250;  // Happy-eyeballs stagger between address attempts
+    bool coalesce_requests = false; // Share one generation between identical deterministic requests
+    int completion_cache_mb = 64;   // Cache for deterministic completions; 0 disables it
+    int completion_cache_ttl = 600; // Seconds; 0 keeps entries until evicted
 };
 
 struct Config {
@@ -70,6 +115,7 @@ struct Config {
             auto& s = j["server"];
             if (s.contains("host")) config.server.host = s["host"];
             if (s.contains("port")) config.server.port = s["port"];
+            if (s.contains("stream_port")) config.server.stream_port = s["stream_port"];
             if (s.contains("threads")) config.server.threads = s["threads"];
         }
 
@@ -85,6 +131,9 @@ struct Config {
             if (a.contains("secret_key")) config.auth.secret_key = a["secret_key"];
             if (a.contains("algorithm")) config.auth.algorithm = a["algorithm"];
             if (a.contains("token_expire_minutes")) config.auth.token_expire_minutes = a["token_expire_minutes"];
+            if (a.contains("admin_emails")) {
+                config.auth.admin_emails = a["admin_emails"].get<std::vector<std::string>>();
+            }
         }
 
         // Parse CORS config
@@ -106,10 +155,56 @@ struct Config {
         if (j.contains("llm")) {
             auto& l = j["llm"];
             if (l.contains("server_url")) config.llm.server_url = l["server_url"];
+            if (l.contains("upstreams")) {
+                for (const auto& u : l["upstreams"]) {
+                    if (u.is_string()) {
+                        config.llm.upstreams.push_back({u.get<std::string>(), 1});
+                    } else {
+                        config.llm.upstreams.push_back({u["url"].get<std::string>(), u.value("weight", 1)});
+                    }
+                }
+            }
+            if (l.contains("balance_policy")) config.llm.balance_policy = l["balance_policy"];
+            if (l.contains("eject_after_failures")) config.llm.eject_after_failures = l["eject_after_failures"];
+            if (l.contains("eject_duration")) config.llm.eject_duration = l["eject_duration"];
+            if (l.contains("health_check_path")) config.llm.health_check_path = l["health_check_path"];
+            if (l.contains("health_check_interval_ms")) config.llm.health_check_interval_ms = l["health_check_interval_ms"];
+            if (l.contains("health_check_timeout_ms")) config.llm.health_check_timeout_ms = l["health_check_timeout_ms"];
+            if (l.contains("hedge_requests")) config.llm.hedge_requests = l["hedge_requests"];
+            if (l.contains("hedge_percentile")) config.llm.hedge_percentile = l["hedge_percentile"];
+            if (l.contains("hedge_min_delay_ms")) config.llm.hedge_min_delay_ms = l["hedge_min_delay_ms"];
+            if (l.contains("hedge_budget_percent")) config.llm.hedge_budget_percent = l["hedge_budget_percent"];
+            if (l.contains("slots_per_upstream")) config.llm.slots_per_upstream = l["slots_per_upstream"];
+            if (l.contains("max_concurrent_per_upstream")) config.llm.max_concurrent_per_upstream = l["max_concurrent_per_upstream"];
+            if (l.contains("max_queue")) config.llm.max_queue = l["max_queue"];
+            if (l.contains("max_queue_per_user")) config.llm.max_queue_per_user = l["max_queue_per_user"];
+            if (l.contains("max_queue_wait_ms")) config.llm.max_queue_wait_ms = l["max_queue_wait_ms"];
+            if (l.contains("batch_max_items")) config.llm.batch_max_items = l["batch_max_items"];
+            if (l.contains("batch_max_parallel")) config.llm.batch_max_parallel = l["batch_max_parallel"];
+            if (l.contains("max_history_messages")) config.llm.max_history_messages = l["max_history_messages"];
+            if (l.contains("history_token_budget")) config.llm.history_token_budget = l["history_token_budget"];
+            if (l.contains("session_ttl")) config.llm.session_ttl = l["session_ttl"];
+            if (l.contains("session_memory_mb")) config.llm.session_memory_mb = l["session_memory_mb"];
+            if (l.contains("session_reap_interval")) config.llm.session_reap_interval = l["session_reap_interval"];
+            if (l.contains("session_store_path")) config.llm.session_store_path = l["session_store_path"];
+            if (l.contains("session_store_flush_ms")) config.llm.session_store_flush_ms = l["session_store_flush_ms"];
             if (l.contains("timeout")) config.llm.timeout = l["timeout"];
+            if (l.contains("connect_timeout_ms")) config.llm.connect_timeout_ms = l["connect_timeout_ms"];
+            if (l.contains("first_token_timeout_ms")) config.llm.first_token_timeout_ms = l["first_token_timeout_ms"];
+            if (l.contains("inter_token_timeout_ms")) config.llm.inter_token_timeout_ms = l["inter_token_timeout_ms"];
             if (l.contains("temperature")) config.llm.temperature = l["temperature"];
             if (l.contains("top_p")) config.llm.top_p = l["top_p"];
             if (l.contains("max_tokens")) config.llm.max_tokens = l["max_tokens"];
+            if (l.contains("seed")) config.llm.seed = l["seed"];
+            if (l.contains("pool_max_connections")) config.llm.pool_max_connections = l["pool_max_connections"];
+            if (l.contains("pool_idle_timeout")) config.llm.pool_idle_timeout = l["pool_idle_timeout"];
+            if (l.contains("io_threads")) config.llm.io_threads = l["io_threads"];
+            if (l.contains("dns_ttl")) config.llm.dns_ttl = l["dns_ttl"];
+            if (l.contains("dns_negative_ttl")) config.llm.dns_negative_ttl = l["dns_negative_ttl"];
+            if (l.contains("connect_attempt_delay_ms")) config.llm.connect_attempt_delay_ms = l["connect_attempt_delay_ms"];
+            if (l.contains("coalesce_requests")) config.llm.coalesce_requests = l["coalesce_requests"];
+            if (l.contains("completion_cache_mb")) config.llm.completion_cache_mb = l["completion_cache_mb"];
+            if (l.contains("completion_cache_ttl")) config.llm.completion_cache_ttl = l["completion_cache_ttl"];
         }
 
         return config;
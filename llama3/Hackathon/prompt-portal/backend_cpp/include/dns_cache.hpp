@@ -0,0 +1,72 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <exception>
+#include <asio.hpp>
+#include <nlohmann/json.hpp>
+#include "metrics.hpp"
+
+namespace prompt_portal {
+
+/**
+ * Shared resolver cache for upstream hosts.
+ * getaddrinfo exposes no record TTL, so successful lookups live for ttl_sec and
+ * failures for negative_ttl_sec. Concurrent lookups of the same host:port share
+ * one resolution. Endpoints come back ordered for happy eyeballs (RFC 8305):
+ * IPv6 first, then alternating address families.
+ */
+class DnsCache {
+public:
+    using Endpoints = std::vector<asio::ip::tcp::endpoint>;
+    using ResolveCallback = std::function<void(std::exception_ptr error, std::shared_ptr<const Endpoints> endpoints)>;
+
+    DnsCache(asio::io_context& io, int ttl_sec, int negative_ttl_sec);
+
+    void configure(int ttl_sec, int negative_ttl_sec);
+
+    /**
+     * Resolve host:port, answering from the cache when possible.
+     * The callback always runs on the io_context, never inline.
+     */
+    void resolve(const std::string& host, int port, ResolveCallback on_resolved);
+
+    // Drop a cached answer, e.g. after every address in it refused connections
+    void invalidate(const std::string& host, int port);
+
+    nlohmann::json stats() const;
+
+private:
+    struct Entry {
+        std::shared_ptr<const Endpoints> endpoints;
+        std::exception_ptr error;
+        std::chrono::steady_clock::time_point expires;
+        bool resolving = false;
+        std::vector<ResolveCallback> waiters;
+    };
+
+    asio::io_context& io_;
+    std::chrono::seconds ttl_;
+    std::chrono::seconds negative_ttl_;
+
+    mutable std::mutex mutex_;
+    std::map<std::string, Entry> entries_;
+
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> negative_hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> coalesced_{0};
+    std::atomic<uint64_t> failures_{0};
+    LatencyHistogram resolve_latency_;
+
+    void start_resolution(const std::string& key, const std::string& host, int port);
+    void complete(const std::string& key, std::exception_ptr error, std::shared_ptr<const Endpoints> endpoints);
+};
+
+} // namespace prompt_portal
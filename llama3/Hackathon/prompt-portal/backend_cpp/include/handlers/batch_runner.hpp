@@ -0,0 +1,70 @@
+#pragma once
+
+#include "llm_client.hpp"
+#include "response_stream.hpp"
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <optional>
+#include <nlohmann/json.hpp>
+
+namespace prompt_portal {
+namespace handlers {
+
+/**
+ * Runs the items of one POST /api/llm/chat/batch request with at most
+ * `parallelism` of them in flight. Each item is admitted through the
+ * AdmissionController on its own, so a batch competes fairly with interactive
+ * chats, and gets its own deadline from the moment it is launched.
+ *
+ * Results are indexed by input position. As JSON they are returned together
+ * once the last item finishes; as NDJSON each result is written as a line when
+ * it completes, followed by a summary line (on a StreamServer connection each
+ * line is sent as it is written). If the client goes away, items in flight are
+ * cancelled and no more are started. The next item is launched from a posted
+ * handler, never from inside the completion of the previous one, so items that
+ * finish inline (rejections, cache hits) don't nest on the stack.
+ */
+class BatchRunner : public std::enable_shared_from_this<BatchRunner> {
+public:
+    struct Item {
+        std::vector<ChatMessage> messages;
+        std::optional<double> temperature;
+        std::optional<double> top_p;
+        std::optional<int> max_tokens;
+        std::string model = "default";
+    };
+
+    // Completes out asynchronously
+    static void start(std::shared_ptr<ResponseStream> out, int user_id, std::vector<Item> items, size_t parallelism, bool ndjson);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    BatchRunner(std::shared_ptr<ResponseStream> out, int user_id, std::vector<Item> items, bool ndjson);
+
+    std::shared_ptr<ResponseStream> out_;
+    std::string user_key_;
+    std::vector<Item> items_;
+    bool ndjson_;
+    Clock::time_point started_;
+    std::shared_ptr<CancellationToken> cancel_ = std::make_shared<CancellationToken>();
+
+    std::mutex mutex_;
+    std::vector<nlohmann::json> results_;
+    size_t next_ = 0;
+    size_t completed_ = 0;
+    size_t succeeded_ = 0;
+
+    void launch_next();
+    void run(size_t index);
+    void complete(size_t index, std::exception_ptr error, std::string content,
+                  Clock::time_point launched, Clock::time_point admitted);
+    void finish();
+    nlohmann::json summary() const;
+};
+
+} // namespace handlers
+} // namespace prompt_portal
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "crow.h"
+#include "response_stream.hpp"
+#include "cancellation.hpp"
+
+namespace prompt_portal {
+namespace handlers {
+
+/**
+ * ResponseStream over an asynchronous Crow response. Crow 1.2 cannot flush
+ * part of a dynamic body, so everything written reaches the client only when
+ * end() completes the response; incremental delivery needs the StreamServer.
+ * Crow does not report a closed connection either, so a disconnect is only
+ * noticed by the next write().
+ */
+class BufferedResponse : public ResponseStream {
+public:
+    explicit BufferedResponse(crow::response& res) : res_(res) {}
+
+    void begin(int status, const ResponseHeaders& headers) override;
+    bool write(std::string data) override;
+    void end() override;
+    bool client_connected() override;
+    void on_disconnect(std::function<void()> callback) override;
+
+private:
+    crow::response& res_;
+    bool ended_ = false;
+    CancellationToken disconnected_;
+};
+
+} // namespace handlers
+} // namespace prompt_portal
@@ -1,6 +1,12 @@
 #pragma once
 
 #include "crow.h"
+#include "admission_controller.hpp"
+#include "llm_client.hpp"
+#include "response_stream.hpp"
+#include <exception>
+#include <functional>
+#include <memory>
 #include <nlohmann/json.hpp>
 
 namespace prompt_portal {
@@ -8,17 +14,25 @@ namespace handlers {
 
 class LLMHandler {
 public:
-    // POST /api/llm/chat - Single-shot chat completion
-    static crow::response chat(const crow::request& req);
+    // POST /api/llm/chat - Single-shot chat completion, completes res asynchronously
+    static void chat(const crow::request& req, crow::response& res);
     
-    // POST /api/llm/chat/session - Session-based chat
-    static crow::response session_chat(const crow::request& req);
+    // POST /api/llm/chat/session - Session-based chat, completes res asynchronously
+    static void session_chat(const crow::request& req, crow::response& res);
     
-    // POST /api/llm/chat/stream - Streaming chat (SSE)
-    static crow::response chat_stream(const crow::request& req);
+    // POST /api/llm/chat/stream - Chat as SSE events, completes out asynchronously.
+    // Served incrementally by the StreamServer; the Crow overload delivers the events in one body
+    static void chat_stream(const std::string& auth_header, const std::string& body, std::shared_ptr<ResponseStream> out);
+    static void chat_stream(const crow::request& req, crow::response& res);
     
-    // POST /api/llm/chat/session/stream - Session streaming chat (SSE)
-    static crow::response session_chat_stream(const crow::request& req);
+    // POST /api/llm/chat/session/stream - Session chat as SSE events, completes out asynchronously
+    static void session_chat_stream(const std::string& auth_header, const std::string& body, std::shared_ptr<ResponseStream> out);
+    static void session_chat_stream(const crow::request& req, crow::response& res);
+    
+    // POST /api/llm/chat/batch - Many independent chats with bounded fan-out, completes out asynchronously.
+    // NDJSON lines are sent as items finish on the StreamServer; the Crow overload sends them at the end
+    static void chat_batch(const std::string& auth_header, const std::string& body, std::shared_ptr<ResponseStream> out);
+    static void chat_batch(const crow::request& req, crow::response& res);
     
     // GET /api/llm/chat/session/{session_id}/history
     static crow::response get_session_history(const crow::request& req, const std::string& session_id);
@@ -31,10 +45,28 @@ public:
     
     // GET /api/llm/health - LLM service health
     static crow::response health();
+    
+    // GET /api/llm/metrics - Upstream connection pool statistics
+    static crow::response metrics(const crow::request& req);
+    
+    // GET /api/llm/usage - Token usage and throughput by user, model and upstream; admins only
+    static crow::response usage(const crow::request& req);
 
 private:
     static crow::response error_response(int status, const std::string& detail);
     static crow::response json_response(int status, const nlohmann::json& data);
+    static void end_with_json(ResponseStream& out, int status, const nlohmann::json& data, ResponseHeaders headers = {});
+    static void end_with_error(ResponseStream& out, int status, const std::string& detail);
+    static void end_with_exception(ResponseStream& out, std::exception_ptr error, const std::string& context);
+    
+    // Runs start once the user gets a generation slot; rejections and errors complete out.
+    // start receives a RequestContext whose deadline counts from now, so queue wait is included
+    static void admit_then(
+        std::shared_ptr<ResponseStream> out,
+        int user_id,
+        const std::string& context,
+        std::function<void(AdmissionController::TicketPtr, RequestContext)> start
+    );
 };
 
 } // namespace handlers
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "response_stream.hpp"
+#include <memory>
+#include <string>
+#include <nlohmann/json.hpp>
+
+namespace prompt_portal {
+namespace handlers {
+
+/**
+ * Writes Server-Sent Events to a ResponseStream as they are produced. On a
+ * StreamServer connection each frame is sent as it is written; on a Crow
+ * BufferedResponse the frames only reach the client when close() ends it.
+ * Destroying the writer does not complete the response.
+ */
+class SseWriter {
+public:
+    explicit SseWriter(std::shared_ptr<ResponseStream> out);
+
+    SseWriter(const SseWriter&) = delete;
+    SseWriter& operator=(const SseWriter&) = delete;
+
+    /**
+     * Send one "data: {json}" event. Returns false once the client has
+     * disconnected, so producers can stop generating.
+     */
+    bool send(const nlohmann::json& event);
+
+    bool client_connected();
+
+    void close();
+
+private:
+    std::shared_ptr<ResponseStream> out_;
+    bool closed_ = false;
+};
+
+} // namespace handlers
+} // namespace prompt_portal
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <chrono>
+#include <asio.hpp>
+#include "config.hpp"
+#include "upstream_set.hpp"
+
+namespace prompt_portal {
+
+/**
+ * Periodically GETs health_check_path on every upstream from the HttpClient io
+ * threads and reports the result to UpstreamSet::report_probe(), which keeps
+ * each upstream's health state and circuit breaker. Nothing blocks: the first
+ * round starts immediately and the server comes up without waiting for it.
+ * The timer and stopped_ are only touched on the timer's strand.
+ */
+class HealthProber : public std::enable_shared_from_this<HealthProber> {
+public:
+    // Starts probing right away; returns nullptr when health_check_interval_ms is 0
+    static std::shared_ptr<HealthProber> start(std::shared_ptr<UpstreamSet> upstreams, const LlmConfig& config);
+
+    // Stops scheduling new rounds; probes already in flight still report
+    void stop();
+
+private:
+    HealthProber(std::shared_ptr<UpstreamSet> upstreams, const LlmConfig& config);
+
+    std::shared_ptr<UpstreamSet> upstreams_;
+    std::string path_;
+    std::chrono::milliseconds interval_;
+    std::chrono::milliseconds timeout_;
+    asio::steady_timer timer_;
+    bool stopped_ = false;
+
+    void probe_all();
+    void probe(UpstreamSet::Upstream& upstream);
+    void schedule();
+};
+
+} // namespace prompt_portal
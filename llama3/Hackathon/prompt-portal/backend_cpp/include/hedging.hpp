@@ -0,0 +1,135 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+#include <asio.hpp>
+#include <nlohmann/json.hpp>
+#include "cancellation.hpp"
+#include "config.hpp"
+
+namespace prompt_portal {
+
+/**
+ * The most recent kCapacity durations, with a percentile of them recomputed
+ * every kRefreshEvery samples. Unlike LatencyHistogram it forgets, so the
+ * percentile follows the upstreams as their load changes.
+ */
+class LatencyWindow {
+public:
+    explicit LatencyWindow(double quantile) : quantile_(quantile) {}
+
+    void record(std::chrono::steady_clock::duration elapsed);
+
+    // Microseconds; 0 until kMinSamples have been recorded
+    int64_t percentile_us() const { return percentile_us_.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr size_t kCapacity = 512;
+    static constexpr size_t kRefreshEvery = 16;
+    static constexpr size_t kMinSamples = 32;
+
+    double quantile_;
+    std::mutex mutex_;
+    std::vector<int64_t> samples_;  // Ring buffer once full
+    size_t next_ = 0;
+    size_t since_refresh_ = 0;
+    std::atomic<int64_t> percentile_us_{0};
+};
+
+/**
+ * When to send a hedged copy of a request, and whether the budget allows it.
+ * The delay is hedge_percentile of recent first-token times (streams) or
+ * completion times, kept apart since the two differ by orders of magnitude.
+ * Every request adds hedge_budget_percent / 100 of a hedge to a bucket and
+ * every hedge takes one out, so hedges never exceed that share of traffic
+ * beyond a short burst.
+ */
+class HedgePolicy {
+public:
+    explicit HedgePolicy(const LlmConfig& config);
+
+    bool enabled() const { return enabled_; }
+
+    // Counts a request toward the budget; returns the delay to hedge after, if any yet
+    std::optional<std::chrono::microseconds> on_request(bool stream);
+
+    // The winning attempt's time to first token (streams) or completion, from the first attempt's start
+    void observe(bool stream, std::chrono::steady_clock::duration elapsed);
+
+    // Takes one hedge out of the budget
+    bool try_spend();
+
+    void record_hedge() { hedged_.fetch_add(1, std::memory_order_relaxed); }
+    void record_hedge_won() { hedges_won_.fetch_add(1, std::memory_order_relaxed); }
+
+    nlohmann::json stats() const;
+
+private:
+    static constexpr int64_t kMilli = 1000;
+    static constexpr int64_t kMaxBurst = 10 * kMilli;
+
+    bool enabled_;
+    std::chrono::microseconds min_delay_;
+    int64_t deposit_milli_;
+    std::atomic<int64_t> budget_milli_{0};
+    LatencyWindow first_token_;
+    LatencyWindow completion_;
+
+    std::atomic<uint64_t> hedged_{0};
+    std::atomic<uint64_t> hedges_won_{0};
+    std::atomic<uint64_t> over_budget_{0};
+};
+
+/**
+ * One request raced across up to two attempts. The first attempt to claim()
+ * (first token, or a finished completion) wins and the other is cancelled;
+ * only the winner's output and completion are passed on. An attempt that fails
+ * before anyone wins is dropped while the other is still running, so a hedge
+ * also covers a failed primary. Cancelling the request's own token cancels
+ * every attempt.
+ */
+class HedgedRace : public std::enable_shared_from_this<HedgedRace> {
+public:
+    static std::shared_ptr<HedgedRace> create(asio::io_context& io, std::shared_ptr<CancellationToken> parent);
+
+    // Cancellation token for a new attempt, with its index through attempt;
+    // nullptr once the race is decided or cancelled
+    std::shared_ptr<CancellationToken> add_attempt(int& attempt);
+
+    // Runs launch_hedge after delay unless an attempt has won or finished by then
+    void arm(std::chrono::microseconds delay, std::function<void()> launch_hedge);
+
+    // True if attempt is (now) the winner
+    bool claim(int attempt);
+
+    // Attempt is done; true if its completion is the one to report
+    bool settle(int attempt, bool failed);
+
+    std::chrono::steady_clock::time_point started() const { return started_; }
+
+private:
+    explicit HedgedRace(asio::io_context& io);
+
+    mutable std::mutex mutex_;
+    asio::steady_timer timer_;
+    std::chrono::steady_clock::time_point started_;
+    std::array<std::shared_ptr<CancellationToken>, 2> attempts_;
+    int launched_ = 0;
+    int pending_ = 0;
+    int winner_ = -1;
+    bool cancelled_ = false;
+    std::function<void()> launch_hedge_;  // Dropped once the race is decided
+
+    // Called with mutex_ held; returns the tokens to cancel once it is released
+    std::vector<std::shared_ptr<CancellationToken>> take_losers(int winner, std::function<void()>& launch_hedge);
+};
+
+} // namespace prompt_portal
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <string>
+#include <array>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <exception>
+#include <cstdint>
+#include <stdexcept>
+#include <asio.hpp>
+#include <nlohmann/json.hpp>
+#include "config.hpp"
+#include "dns_cache.hpp"
+#include "metrics.hpp"
+#include "cancellation.hpp"
+
+namespace prompt_portal {
+
+struct UrlParts {
+    std::string host;
+    int port;
+    std::string path;
+};
+
+UrlParts parse_url(const std::string& url);
+
+struct HttpResponse {
+    int status = 0;
+    std::string body;
+};
+
+/**
+ * Per-phase limits for one upstream request. connect covers waiting for a
+ * pooled connection, DNS and the TCP handshake; first_byte runs from sending
+ * the request to the first response byte (time to first token when
+ * streaming); idle is the longest gap between reads after that; total is an
+ * absolute deadline for the whole exchange. max() leaves a phase unbounded.
+ */
+struct HttpDeadlines {
+    enum class Phase { Connect, FirstByte, Idle, Total };
+
+    std::chrono::milliseconds connect = std::chrono::milliseconds::max();
+    std::chrono::milliseconds first_byte = std::chrono::milliseconds::max();
+    std::chrono::milliseconds idle = std::chrono::milliseconds::max();
+    std::chrono::steady_clock::time_point total = std::chrono::steady_clock::time_point::max();
+
+    static const char* phase_name(Phase phase);
+};
+
+/**
+ * Error delivered when one of the HttpDeadlines expires.
+ */
+class DeadlineExceeded : public std::runtime_error {
+public:
+    DeadlineExceeded(HttpDeadlines::Phase phase, const std::string& target);
+
+    HttpDeadlines::Phase phase() const { return phase_; }
+
+private:
+    HttpDeadlines::Phase phase_;
+};
+
+/**
+ * Keep-alive connection pool for a single upstream (host:port).
+ * Idle sockets are handed out LIFO so the most recently used one is reused first;
+ * sockets idle for longer than idle_timeout_sec are closed instead of reused.
+ * When max_connections are checked out, acquire() queues the caller instead of
+ * blocking a thread. New connections race the resolved addresses happy-eyeballs
+ * style, starting the next attempt every connect_attempt_delay_ms.
+ */
+class ConnectionPool {
+public:
+    using Socket = asio::ip::tcp::socket;
+
+    struct Connection {
+        std::unique_ptr<Socket> socket;
+        bool reused = false;
+        // Read buffer that lives as long as the socket, so keep-alive requests reuse it
+        std::vector<char> buffer;
+    };
+
+    using AcquireCallback = std::function<void(std::exception_ptr error, Connection conn)>;
+
+    ConnectionPool(
+        asio::io_context& io,
+        DnsCache& dns,
+        std::string host,
+        int port,
+        int max_connections,
+        int idle_timeout_sec,
+        int connect_attempt_delay_ms
+    );
+    ~ConnectionPool();
+
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    /**
+     * Hand an idle connection or a newly connected one to on_ready.
+     * The callback always runs on the io_context, never inline.
+     */
+    void acquire(AcquireCallback on_ready);
+
+    /**
+     * Return a connection. Only pass keep_alive = true when the response was read
+     * completely and the server did not ask to close.
+     */
+    void release(Connection conn, bool keep_alive);
+
+    nlohmann::json stats() const;
+
+private:
+    struct IdleConnection {
+        Connection conn;
+        std::chrono::steady_clock::time_point idle_since;
+    };
+
+    asio::io_context& io_;
+    DnsCache& dns_;
+    std::string host_;
+    int port_;
+    int max_connections_;
+    std::chrono::seconds idle_timeout_;
+    std::chrono::milliseconds connect_attempt_delay_;
+
+    mutable std::mutex mutex_;
+    std::vector<IdleConnection> idle_;
+    std::deque<AcquireCallback> waiters_;
+    int open_ = 0;
+
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> waits_{0};
+    std::atomic<uint64_t> expired_{0};
+    std::atomic<uint64_t> connect_failures_{0};
+    std::atomic<uint64_t> connect_fallbacks_{0};
+    LatencyHistogram connect_latency_;
+
+    // Caller holds mutex_. Returns a usable idle connection, or one without a socket.
+    Connection take_idle_locked();
+    void connect_new(AcquireCallback on_ready);
+    void connect_failed(const AcquireCallback& on_ready, const std::string& message);
+    void dispatch_waiters();
+};
+
+/**
+ * Event-driven HTTP/1.1 client for upstream LLM servers, built on asio.
+ * A few io threads multiplex every outstanding request; callers pass
+ * completion callbacks and are never blocked.
+ * Keeps one ConnectionPool per host:port and a DnsCache shared by all of them;
+ * GETs get a separate single-connection pool per host:port.
+ */
+class HttpClient {
+public:
+    using BodyCallback = std::function<void(const char* data, size_t len)>;
+    using ResponseCallback = std::function<void(std::exception_ptr error, HttpResponse response)>;
+
+    static HttpClient& instance();
+
+    // Takes the pool, resolver and io_threads settings; call before the first request
+    void configure(const LlmConfig& config);
+
+    /**
+     * Start a POST and return immediately. With on_body set, 2xx bodies are passed to
+     * it as they arrive (chunked framing removed) and only non-2xx bodies end up in
+     * the response; without it the whole body is collected. Callbacks run on an io thread.
+     * Cancelling the token closes the connection (so the server stops generating) and
+     * completes with RequestCancelled; an expired deadline completes with DeadlineExceeded.
+     */
+    void async_post(
+        const std::string& url,
+        std::string body,
+        const HttpDeadlines& deadlines,
+        BodyCallback on_body,
+        ResponseCallback on_done,
+        std::shared_ptr<CancellationToken> cancel = nullptr
+    );
+
+    /**
+     * Bodiless GET for health checks; the whole body is collected. GETs use their own
+     * one-connection pool per host:port, so a probe never waits behind chat requests
+     * for a connection and never takes one from them.
+     */
+    void async_get(const std::string& url, const HttpDeadlines& deadlines, ResponseCallback on_done);
+
+    nlohmann::json stats();
+
+    // The io_context behind every upstream request, for timers that belong with them
+    asio::io_context& io_context();
+
+private:
+    HttpClient();
+    ~HttpClient();
+    HttpClient(const HttpClient&) = delete;
+    HttpClient& operator=(const HttpClient&) = delete;
+
+    asio::io_context io_;
+    asio::executor_work_guard<asio::io_context::executor_type> work_;
+    DnsCache dns_;
+    std::vector<std::thread> threads_;
+    std::once_flag started_;
+
+    std::mutex pools_mutex_;
+    std::map<std::string, std::unique_ptr<ConnectionPool>> pools_;
+    int max_connections_per_upstream_ = 16;
+    int idle_timeout_sec_ = 4;
+    int io_threads_ = 2;
+    int connect_attempt_delay_ms_ = 250;
+
+    std::atomic<int64_t> in_flight_{0};
+    std::array<std::atomic<uint64_t>, 4> deadlines_exceeded_{};  // by HttpDeadlines::Phase
+
+    void start();
+    ConnectionPool& pool_for(const std::string& host, int port, bool probe);
+    void send(
+        const char* method,
+        const std::string& url,
+        const std::string& body,
+        const HttpDeadlines& deadlines,
+        BodyCallback on_body,
+        ResponseCallback on_done,
+        std::shared_ptr<CancellationToken> cancel
+    );
+};
+
+} // namespace prompt_portal
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <string>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace prompt_portal {
+
+/**
+ * Incremental HTTP/1.1 response parser.
+ * Bytes are pushed in as they arrive; body bytes are handed to the sink as
+ * pointers into the caller's buffer, so nothing is copied and the body may
+ * contain any bytes. Knows when the response ends from Content-Length or
+ * chunked framing, without waiting for the server to close.
+ * Malformed input throws std::runtime_error.
+ */
+class HttpResponseParser {
+public:
+    enum class Framing { None, ContentLength, Chunked, UntilClose };
+
+    // Clears per-response state; keeps allocated capacity for the next response
+    void reset();
+
+    /**
+     * Consume up to len bytes, calling sink(const char*, size_t) for body data.
+     * Returns the number of bytes consumed, which is less than len only once
+     * the response is complete (the rest belongs to whatever follows it).
+     */
+    template <typename Sink>
+    size_t feed(const char* data, size_t len, Sink&& sink);
+
+    // The connection closed. Completes an until-close body, otherwise throws.
+    void finish_eof();
+
+    bool headers_done() const { return state_ > State::Headers; }
+    bool complete() const { return state_ == State::Complete; }
+    int status() const { return status_; }
+    bool keep_alive() const { return keep_alive_; }
+    Framing framing() const { return framing_; }
+
+private:
+    enum class State { StatusLine, Headers, Body, ChunkSize, ChunkData, ChunkDataEnd, Trailers, Complete };
+
+    static constexpr size_t kMaxLine = 16384;
+    // Larger Content-Length or chunk sizes are rejected as malformed
+    static constexpr uint64_t kMaxBodyLength = uint64_t(1) << 40;
+
+    State state_ = State::StatusLine;
+    Framing framing_ = Framing::None;
+    int status_ = 0;
+    bool keep_alive_ = false;
+    bool http11_ = false;
+    uint64_t remaining_ = 0;
+    int64_t content_length_ = -1;
+    bool chunked_ = false;
+    std::string line_;
+
+    // Appends to line_ up to and including '\n'. Returns bytes consumed and sets done.
+    size_t take_line(const char* data, size_t len, bool& done);
+    void on_line();
+    void parse_status_line();
+    void parse_header_line();
+    void end_of_headers();
+    void parse_chunk_size();
+};
+
+template <typename Sink>
+size_t HttpResponseParser::feed(const char* data, size_t len, Sink&& sink) {
+    size_t pos = 0;
+    while (pos < len && state_ != State::Complete) {
+        switch (state_) {
+            case State::Body:
+            case State::ChunkData: {
+                size_t available = len - pos;
+                size_t n = framing_ == Framing::UntilClose
+                    ? available
+                    : static_cast<size_t>(std::min<uint64_t>(remaining_, available));
+                if (n > 0) sink(data + pos, n);
+                pos += n;
+                if (framing_ != Framing::UntilClose) {
+                    remaining_ -= n;
+                    if (remaining_ == 0) {
+                        state_ = state_ == State::Body ? State::Complete : State::ChunkDataEnd;
+                    }
+                }
+                break;
+            }
+            default: {
+                bool done = false;
+                pos += take_line(data + pos, len - pos, done);
+                if (done) on_line();
+                break;
+            }
+        }
+    }
+    return pos;
+}
+
+} // namespace prompt_portal
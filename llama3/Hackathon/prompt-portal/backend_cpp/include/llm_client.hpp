@@ -2,34 +2,74 @@
 
 #include <string>
 #include <vector>
-#include <map>
+#include <array>
+#include <list>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
 #include <optional>
 #include <mutex>
 #include <functional>
+#include <exception>
+#include <chrono>
 #include <nlohmann/json.hpp>
 #include "config.hpp"
+#include "upstream_set.hpp"
+#include "health_prober.hpp"
+#include "completion_cache.hpp"
+#include "cancellation.hpp"
+#include "http_client.hpp"
+#include "chat_request.hpp"
+#include "completion_extractor.hpp"
+#include "hedging.hpp"
+#include "session_store.hpp"
+#include "ring_buffer.hpp"
 
 namespace prompt_portal {
 
-struct ChatMessage {
-    std::string role;     // "system", "user", or "assistant"
-    std::string content;
+/**
+ * Where a conversation's previous turn ran, so the next one can reuse the
+ * llama.cpp KV cache. Updated by LLMClient after every request; -1 means
+ * "not pinned yet".
+ */
+struct UpstreamAffinity {
+    std::atomic<int> upstream{-1};
+    std::atomic<int> slot{-1};
+};
+
+/**
+ * Optional per-request state threaded through LLMClient.
+ */
+struct RequestContext {
+    std::shared_ptr<UpstreamAffinity> affinity;   // Session's preferred upstream and slot
+    std::shared_ptr<CancellationToken> cancel;    // Aborts the upstream request when cancelled
+    std::string user;                             // Usage accounting key, normally the user id
+    // Absolute end of the whole request, normally set when it reached the handler
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
 };
 
 /**
  * HTTP client for LLM inference using OpenAI-compatible API.
  * Supports llama.cpp server, vLLM, and other OpenAI-compatible endpoints.
+ * Requests are spread over the configured upstreams (see UpstreamSet).
  */
 class LLMClient {
 public:
+    using ChunkCallback = std::function<void(const std::string&)>;
+    using CompletionCallback = std::function<void(std::exception_ptr error, std::string content)>;
+    using StreamDoneCallback = std::function<void(std::exception_ptr error)>;
+    
     LLMClient();
     explicit LLMClient(const LlmConfig& config);
+    ~LLMClient();
     
     /**
      * Generate response using OpenAI-compatible chat completion API.
      */
     std::string generate(
-        const std::vector<ChatMessage>& messages,
+        ChatMessages messages,
         std::optional<double> temperature = std::nullopt,
         std::optional<double> top_p = std::nullopt,
         std::optional<int> max_tokens = std::nullopt,
@@ -38,9 +78,10 @@ public:
     
     /**
      * Generate streaming response (callback-based).
+     * Requests "stream": true upstream and calls on_chunk for each content delta as it arrives.
      */
     void generate_stream(
-        const std::vector<ChatMessage>& messages,
+        ChatMessages messages,
         std::function<void(const std::string&)> on_chunk,
         std::optional<double> temperature = std::nullopt,
         std::optional<double> top_p = std::nullopt,
@@ -49,39 +90,172 @@ public:
     );
     
     /**
-     * Test connection to LLM server.
+     * Non-blocking generate(). on_done runs on an upstream I/O thread with either
+     * an error or the completion text; the calling thread is never held.
+     * Deterministic requests (temperature 0 or a fixed seed) are answered from
+     * the completion cache when possible, in which case on_done runs before
+     * this returns. With coalesce_requests on, identical concurrent ones share
+     * a single upstream generation. With hedge_requests on, a request slower than
+     * the recent hedge_percentile is also sent to another upstream and the first
+     * answer is used.
+     */
+    void generate_async(
+        ChatMessages messages,
+        CompletionCallback on_done,
+        std::optional<double> temperature = std::nullopt,
+        std::optional<double> top_p = std::nullopt,
+        std::optional<int> max_tokens = std::nullopt,
+        const std::string& model = "default",
+        RequestContext context = {}
+    );
+    
+    /**
+     * Non-blocking generate_stream(). on_chunk and then on_done run on an upstream I/O thread.
+     * With an affinity, the request goes to the upstream and slot that served the
+     * previous turn while that upstream is healthy. Cancelling context.cancel drops
+     * the upstream connection at once and completes with RequestCancelled.
+     * A missed first-token, inter-token or context deadline completes with DeadlineExceeded.
+     * With hedge_requests on, a request with no first token after the recent
+     * hedge_percentile is copied to another upstream and the first to stream wins.
      */
-    bool test_connection();
+    void generate_stream_async(
+        ChatMessages messages,
+        ChunkCallback on_chunk,
+        StreamDoneCallback on_done,
+        std::optional<double> temperature = std::nullopt,
+        std::optional<double> top_p = std::nullopt,
+        std::optional<int> max_tokens = std::nullopt,
+        const std::string& model = "default",
+        RequestContext context = {}
+    );
     
     // Getters
-    std::string server_url() const { return server_url_; }
+    std::string server_url() const { return upstreams_->primary().url; }
+    nlohmann::json upstream_stats() const { return upstreams_->stats(); }
+    uint64_t coalesced_requests() const { return coalesced_.load(); }
+    uint64_t upstream_waits() const { return upstream_waits_.load(); }
+    nlohmann::json completion_cache_stats() const;
+    nlohmann::json prompt_cache_stats() const;
+    nlohmann::json cancellation_stats() const;
+    nlohmann::json hedging_stats() const { return hedging_.stats(); }
     double default_temperature() const { return default_temperature_; }
     int default_max_tokens() const { return default_max_tokens_; }
-    bool is_available() const { return available_; }
+    // Some upstream's circuit is closed; kept current by the health prober
+    bool is_available() const { return upstreams_->any_available(); }
 
 private:
-    std::string server_url_;
+    std::shared_ptr<UpstreamSet> upstreams_;
+    std::shared_ptr<HealthProber> prober_;
     int timeout_;
+    std::chrono::milliseconds connect_timeout_;
+    std::chrono::milliseconds first_token_timeout_;
+    std::chrono::milliseconds inter_token_timeout_;
     double default_temperature_;
     double default_top_p_;
     int default_max_tokens_;
+    int seed_ = -1;
+    int slots_per_upstream_ = 0;
     bool skip_thinking_;
-    bool available_ = false;
+    bool coalesce_requests_ = false;
     
-    std::string make_request(const std::string& endpoint, const nlohmann::json& body);
-    void make_streaming_request(
-        const std::string& endpoint, 
-        const nlohmann::json& body,
-        std::function<void(const std::string&)> on_chunk
-    );
+    // Request body -> callbacks waiting on the in-flight generation
+    std::mutex inflight_mutex_;
+    std::unordered_map<std::string, std::vector<CompletionCallback>> inflight_;
+    std::atomic<uint64_t> coalesced_{0};
+    
+    std::unique_ptr<CompletionCache> completion_cache_;
+    
+    // Prompt tokens evaluated vs. reused from the KV cache, from llama.cpp timings
+    std::atomic<uint64_t> timed_requests_{0};
+    std::atomic<uint64_t> prompt_tokens_evaluated_{0};
+    std::atomic<uint64_t> prompt_tokens_cached_{0};
+    std::atomic<uint64_t> prompt_eval_us_{0};
+    
+    HedgePolicy hedging_;
+    
+    // Streams aborted by their client, with tokens generated before vs. never generated
+    std::atomic<uint64_t> cancelled_streams_{0};
+    std::atomic<uint64_t> tokens_before_cancel_{0};
+    std::atomic<uint64_t> aborted_tokens_{0};
+    
+    // Requests that found every healthy upstream full and waited for room
+    std::atomic<uint64_t> upstream_waits_{0};
+    
+    // Fills in defaults; the result points at messages and model, so it must not outlive them
+    ChatRequest build_request(
+        ChatMessages messages,
+        std::optional<double> temperature,
+        std::optional<double> top_p,
+        std::optional<int> max_tokens,
+        const std::string& model
+    ) const;
+    
+    // Runs send with an upstream that has room, waiting in the UpstreamSet while all are full
+    using UpstreamCallback = std::function<void(std::exception_ptr error, UpstreamSet::Upstream* upstream,
+                                                ChatRequest& request)>;
+    void with_upstream(int preferred, ChatRequest& request, UpstreamCallback send);
+    // The upstream part of generate_async / generate_stream_async once an upstream is picked
+    void send_completion(UpstreamSet::Upstream& upstream, ChatRequest& request, std::string payload,
+                         CompletionCallback on_done, std::shared_ptr<CancellationToken> cancel,
+                         RequestContext context, const std::string& model,
+                         std::chrono::steady_clock::time_point start);
+    void send_stream(UpstreamSet::Upstream& upstream, ChatRequest& request, ChunkCallback on_chunk,
+                     StreamDoneCallback on_done, RequestContext context, const std::string& model,
+                     std::chrono::steady_clock::time_point start);
+    
+    // Per-phase limits for one upstream call; the total is the earlier of timeout_ and deadline
+    HttpDeadlines deadlines_for(std::chrono::steady_clock::time_point deadline, bool stream) const;
+    
+    // Sends a request body to one upstream as attempt number index of a race
+    using Attempt = std::function<void(UpstreamSet::Upstream& upstream, int index, std::string body,
+                                       std::shared_ptr<CancellationToken> cancel)>;
+    // nullptr unless hedging is on and there is a second upstream to hedge to
+    std::shared_ptr<HedgedRace> hedge_race(std::shared_ptr<CancellationToken> cancel);
+    // After delay, launches body on another upstream if the budget allows
+    void arm_hedge(std::shared_ptr<HedgedRace> race, const UpstreamSet::Upstream& primary,
+                   std::chrono::microseconds delay, std::string body, Attempt launch);
+    // Bookkeeping once attempt index has won; a winning hedge moves the session's affinity
+    void won_race(UpstreamSet::Upstream& upstream, int index, UpstreamAffinity* affinity);
+    
+    // Records the chosen upstream in the affinity; returns the llama.cpp slot to pin, or -1
+    int route(UpstreamSet::Upstream& upstream, UpstreamAffinity* affinity);
+    // Reads "timings" / "id_slot" from a completion or final stream chunk
+    void record_timings(const CompletionFields& fields, UpstreamAffinity* affinity);
 };
 
 /**
  * Session manager for conversation history.
+ * Each message's token count is estimated once when it is appended, and a
+ * turn's prompt is trimmed oldest-first to history_token_budget tokens and
+ * max_history_messages pairs. The system prompt and the newest message are
+ * always kept.
+ *
+ * A background reaper evicts sessions idle for session_ttl seconds, then the
+ * least recently used ones while all dialogs together hold more than
+ * session_memory_mb. It locks one shard at a time and frees the evicted
+ * dialogs outside the lock.
+ *
+ * Messages are immutable and shared. A turn takes a DialogSnapshot of the
+ * session under the lock, which costs one reference count while the dialog is
+ * unchanged and a vector of pointers after it changes, and serializes the
+ * prompt from it after unlocking; no message text is copied.
+ *
+ * With session_store_path set, every change is also queued to a SessionStore.
+ * A session that is not in memory (evicted, or from before a restart) is
+ * loaded from it on first access, outside the shard lock; a turn does the
+ * load on a loader thread. Sessions with a turn in flight are not evicted,
+ * and a load that overlaps an eviction or clear in its shard is redone.
  */
 class SessionManager {
 public:
-    explicit SessionManager(LLMClient& client, int max_history_messages = 20);
+    // System prompt first, then the kept history oldest first
+    using Dialog = std::vector<MessagePtr>;
+    using DialogSnapshot = std::shared_ptr<const Dialog>;
+    
+    SessionManager(LLMClient& client, const LlmConfig& config);
+    ~SessionManager();
+    SessionManager(const SessionManager&) = delete;
+    SessionManager& operator=(const SessionManager&) = delete;
     
     /**
      * Process a user message and generate a response.
@@ -109,30 +283,163 @@ public:
     );
     
     /**
-     * Get conversation history for a session.
+     * Non-blocking process_message(). on_done runs on an upstream I/O thread.
+     * The session supplies context.affinity.
+     */
+    void process_message_async(
+        const std::string& session_id,
+        const std::string& system_prompt,
+        const std::string& user_message,
+        LLMClient::CompletionCallback on_done,
+        std::optional<double> temperature = std::nullopt,
+        std::optional<double> top_p = std::nullopt,
+        std::optional<int> max_tokens = std::nullopt,
+        RequestContext context = {}
+    );
+    
+    /**
+     * Non-blocking process_message_stream(). on_chunk and on_done run on an upstream I/O thread.
+     * The session supplies context.affinity; cancel and deadline are passed through.
+     */
+    void process_message_stream_async(
+        const std::string& session_id,
+        const std::string& system_prompt,
+        const std::string& user_message,
+        LLMClient::ChunkCallback on_chunk,
+        LLMClient::StreamDoneCallback on_done,
+        std::optional<double> temperature = std::nullopt,
+        std::optional<double> top_p = std::nullopt,
+        std::optional<int> max_tokens = std::nullopt,
+        RequestContext context = {}
+    );
+    
+    /**
+     * Get conversation history for a session; nullptr if there is none.
      */
-    std::optional<std::vector<ChatMessage>> get_session_history(const std::string& session_id);
+    DialogSnapshot get_session_history(const std::string& session_id);
     
     /**
      * Clear a session's history.
      */
     void clear_session(const std::string& session_id);
+    
+    // {"live_sessions", "bytes", "memory_budget_bytes", "evicted_idle", "evicted_memory", "store"}
+    nlohmann::json stats() const;
 
 private:
+    struct HistoryEntry {
+        MessagePtr message;
+        int tokens;   // estimate_message_tokens(*message)
+        int64_t seq;  // Position in the session's whole dialog, as stored
+    };
+    
+    using LruList = std::list<const std::string*>;  // Keys of the shard's map, least recently used first
+    
     struct Session {
-        std::vector<ChatMessage> dialog;
+        MessagePtr system;
+        int system_tokens = 0;
+        RingBuffer<HistoryEntry> history;  // Oldest first; the system prompt is kept apart, never trimmed
+        int history_tokens = 0;            // Sum over history
+        size_t bytes = 0;                  // Approximate heap held, counted in bytes_held_
         int64_t created_at;
         int64_t last_access;
         int message_count = 0;
+        int64_t next_seq = 0;
+        int turns_in_flight = 0;           // Never evicted while > 0, so a reply never waits on a load
+        DialogSnapshot snapshot;           // Cached dialog(); reset whenever it changes
+        LruList::iterator lru_position;
+        std::shared_ptr<UpstreamAffinity> affinity = std::make_shared<UpstreamAffinity>();
+    };
+    
+    struct Turn {
+        DialogSnapshot dialog;
+        std::shared_ptr<UpstreamAffinity> affinity;
+    };
+    
+    // Sessions are spread over kShards hash maps with a lock each, so turns of
+    // different sessions rarely contend. Every public method takes one shard
+    // lock and releases it before calling LLMClient or any callback, so those
+    // may call back into the SessionManager. A few times the Crow workers plus
+    // upstream I/O threads that touch sessions; tests/session_contention_bench
+    // measures other counts.
+    static constexpr size_t kShards = 16;
+    
+    using SessionMap = std::unordered_map<std::string, Session>;
+    
+    struct Shard {
+        std::mutex mutex;
+        SessionMap sessions;
+        LruList lru;
+        uint64_t generation = 0;  // Bumped whenever a session is evicted from or cleared in the shard
     };
     
     LLMClient& client_;
     int max_history_messages_;
-    std::map<std::string, Session> sessions_;
-    std::mutex sessions_mutex_;
+    int history_token_budget_;
+    std::array<Shard, kShards> shards_;
+    
+    std::chrono::seconds session_ttl_;
+    size_t memory_budget_;
+    std::chrono::seconds reap_interval_;
+    std::atomic<int64_t> bytes_held_{0};
+    std::atomic<uint64_t> live_sessions_{0};
+    std::atomic<uint64_t> evicted_idle_{0};
+    std::atomic<uint64_t> evicted_memory_{0};
+    std::unique_ptr<SessionStore> store_;  // nullptr unless session_store_path is set
+    // Loads sessions from store_, so turns never block a request or I/O thread on SQLite; only with a store_
+    std::optional<asio::thread_pool> loader_;
+    
+    std::mutex reaper_mutex_;
+    std::condition_variable reaper_wake_;
+    bool stopping_ = false;
+    std::thread reaper_;
     
-    Session& get_or_create_session(const std::string& session_id, const std::string& system_prompt);
-    void trim_history(Session& session);
+    Shard& shard_for(const std::string& session_id);
+    
+    // Locks shard.mutex and, if the session is not in memory, sets restored to its
+    // stored record. Loads outside the lock and loads again if a session left the
+    // shard meanwhile, so restored is never older than the session was in memory.
+    // Throws if the store cannot be read. Blocks on disk
+    std::unique_lock<std::mutex> lock_restored(Shard& shard, const std::string& session_id,
+                                               std::optional<SessionStore::Record>& restored);
+    
+    // Caller must hold shard.mutex; restored is from lock_restored() under the same lock
+    Session& get_or_create_session(Shard& shard, const std::string& session_id, const std::string& system_prompt,
+                                   std::optional<SessionStore::Record>& restored);
+    // nullptr if the session is neither in memory nor restored
+    Session* find_session(Shard& shard, const std::string& session_id, std::optional<SessionStore::Record>& restored);
+    Session& insert_session(Shard& shard, const std::string& session_id, std::string system_prompt, int64_t created_at);
+    void touch(Shard& shard, Session& session);
+    void append_message(const std::string& session_id, Session& session, MessagePtr message);
+    void push_entry(Session& session, int64_t seq, MessagePtr message);
+    // Drops the oldest messages until the session fits; O(messages dropped). True if any were
+    bool trim_history(Session& session);
+    static DialogSnapshot dialog(Session& session);
+    void add_bytes(Session& session, int64_t bytes);
+    
+    void run_reaper();
+    void reap();
+    // Evicts the shard's least recently used sessions while should_evict holds; returns the count
+    size_t evict_lru(Shard& shard, const std::function<bool(const Session&)>& should_evict);
+    void evict_to_budget();
+    
+    // Begins the turn and runs then with it: inline when the session is in memory
+    // (or there is no store), otherwise on loader_ once it is loaded. A failed
+    // load is passed to then as the error
+    using TurnCallback = std::function<void(std::exception_ptr error, Turn turn)>;
+    void with_turn(const std::string& session_id, const std::string& system_prompt,
+                   const std::string& user_message, TurnCallback then);
+    // Appends the user turn and returns the trimmed dialog to send upstream.
+    // Caller holds shard.mutex; restored is as for get_or_create_session()
+    Turn begin_turn(
+        Shard& shard,
+        const std::string& session_id,
+        const std::string& system_prompt,
+        const std::string& user_message,
+        std::optional<SessionStore::Record>& restored
+    );
+    // Ends a begin_turn(), appending the reply unless the generation failed
+    void end_turn(const std::string& session_id, std::optional<std::string> reply);
 };
 
 // Global instances
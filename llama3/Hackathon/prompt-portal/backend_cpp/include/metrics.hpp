@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+
+namespace prompt_portal {
+
+/**
+ * Lock-free histogram of unsigned values with power-of-two buckets.
+ * Percentiles are reported as the upper bound of the matching bucket.
+ */
+class Log2Histogram {
+public:
+    void record(uint64_t value);
+
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+    uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+    double mean() const;
+    uint64_t percentile(double q) const;
+
+    // {"count", "mean", "p50", "p95", "p99", "max"}
+    nlohmann::json to_json() const;
+
+private:
+    static constexpr size_t kBuckets = 40;
+
+    std::array<std::atomic<uint64_t>, kBuckets> buckets_{};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+/**
+ * Log2Histogram of durations in microseconds, reported in milliseconds.
+ */
+class LatencyHistogram {
+public:
+    void record(std::chrono::steady_clock::duration elapsed);
+    void record_us(uint64_t us) { values_.record(us); }
+
+    uint64_t count() const { return values_.count(); }
+    uint64_t percentile_us(double q) const { return values_.percentile(q); }
+
+    // {"count", "mean_ms", "p50_ms", "p95_ms", "p99_ms", "max_ms"}
+    nlohmann::json to_json() const;
+
+private:
+    Log2Histogram values_;
+};
+
+} // namespace prompt_portal
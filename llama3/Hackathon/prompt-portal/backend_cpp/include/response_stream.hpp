@@ -0,0 +1,37 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace prompt_portal {
+
+using ResponseHeaders = std::vector<std::pair<std::string, std::string>>;
+
+/**
+ * A response produced in pieces. begin() sets the status and headers, every
+ * write() is passed on to the client, and end() completes the response.
+ * Calls may come from any thread but must not overlap.
+ */
+class ResponseStream {
+public:
+    virtual ~ResponseStream() = default;
+
+    virtual void begin(int status, const ResponseHeaders& headers) = 0;
+
+    // Returns false once the client is gone, so producers can stop
+    virtual bool write(std::string data) = 0;
+
+    virtual void end() = 0;
+
+    virtual bool client_connected() = 0;
+
+    /**
+     * Runs callback once if the client goes away before the response is
+     * complete (right away if it already has), on whichever thread notices.
+     */
+    virtual void on_disconnect(std::function<void()> callback) = 0;
+};
+
+} // namespace prompt_portal
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace prompt_portal {
+
+/**
+ * FIFO over a power-of-two array of slots. pop_front() just advances the
+ * head, resetting the slot it leaves so its element is freed at once; the
+ * elements that stay are never moved or copied. Grows by doubling when full
+ * and never shrinks, so a sliding window settles into one allocation.
+ */
+template <typename T>
+class RingBuffer {
+public:
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    T& front() { return slots_[head_]; }
+    const T& front() const { return slots_[head_]; }
+    T& back() { return (*this)[size_ - 1]; }
+    const T& back() const { return (*this)[size_ - 1]; }
+
+    // Oldest first
+    T& operator[](size_t i) { return slots_[(head_ + i) & mask()]; }
+    const T& operator[](size_t i) const { return slots_[(head_ + i) & mask()]; }
+
+    void push_back(T value) {
+        if (size_ == slots_.size()) {
+            grow();
+        }
+        slots_[(head_ + size_) & mask()] = std::move(value);
+        ++size_;
+    }
+
+    void pop_front() {
+        slots_[head_] = T{};
+        head_ = (head_ + 1) & mask();
+        --size_;
+    }
+
+private:
+    static constexpr size_t kInitialCapacity = 8;
+
+    std::vector<T> slots_;
+    size_t head_ = 0;
+    size_t size_ = 0;
+
+    size_t mask() const { return slots_.size() - 1; }
+
+    void grow() {
+        std::vector<T> slots(std::max(kInitialCapacity, slots_.size() * 2));
+        for (size_t i = 0; i < size_; ++i) {
+            slots[i] = std::move((*this)[i]);
+        }
+        slots_.swap(slots);
+        head_ = 0;
+    }
+};
+
+} // namespace prompt_portal
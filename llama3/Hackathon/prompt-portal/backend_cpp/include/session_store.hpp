@@ -0,0 +1,129 @@
+#pragma once
+
+#include <SQLiteCpp/SQLiteCpp.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "chat_request.hpp"
+
+namespace prompt_portal {
+
+/**
+ * Durable copy of the SessionManager's dialogs in a SQLite file of its own
+ * (WAL mode, so loads never wait on the writer). Request threads only queue
+ * their changes; a writer thread commits everything queued in one
+ * transaction every flush interval, or sooner once kBatchSize changes are
+ * waiting. A load first waits until the session's queued changes are written,
+ * so a session evicted from memory comes back exactly as it left.
+ *
+ * If the writer falls kMaxQueued changes behind, further appends are dropped
+ * (and counted) rather than holding unbounded memory. Creates, trims and
+ * removes are always queued, since dropping one would leave a stale or
+ * deleted session in the file; a trim replaces the session's queued trim.
+ * A session that lost an append, or had changes in a batch that failed to
+ * commit, is dirty: append() refuses it until the caller rewrite()s the
+ * session's whole window. A load keeps only the messages after the last gap
+ * in the sequence numbers, in case a dirty session was never rewritten.
+ */
+class SessionStore {
+public:
+    struct StoredMessage {
+        int64_t seq;
+        ChatMessage message;
+    };
+
+    struct Record {
+        std::string system_prompt;
+        int64_t created_at = 0;
+        int64_t last_access = 0;
+        int message_count = 0;
+        std::vector<StoredMessage> messages;  // Oldest first
+    };
+
+    // Throws SQLite::Exception if the file cannot be opened
+    SessionStore(const std::string& path, std::chrono::milliseconds flush_interval);
+    ~SessionStore();  // Writes whatever is still queued
+    SessionStore(const SessionStore&) = delete;
+    SessionStore& operator=(const SessionStore&) = delete;
+
+    // Adds the session unless it is already stored; only remove() deletes messages
+    void create(const std::string& session_id, const std::string& system_prompt, int64_t created_at);
+    // False if the session is dirty, or becomes so because the queue is full; rewrite() it then
+    bool append(const std::string& session_id, int64_t seq, MessagePtr message,
+                int64_t last_access, int message_count);
+    // Replaces the stored session with messages (seq, message), oldest first; clears dirty
+    void rewrite(const std::string& session_id, const std::string& system_prompt, int64_t created_at,
+                 int64_t last_access, int message_count, std::vector<std::pair<int64_t, MessagePtr>> messages);
+    // Forgets the messages before first_kept_seq
+    void trim(const std::string& session_id, int64_t first_kept_seq, int64_t last_access, int message_count);
+    void remove(const std::string& session_id);
+
+    // Blocks on disk; nullopt if the session was never stored or has been removed
+    std::optional<Record> load(const std::string& session_id);
+
+    // {"queued", "written", "batches", "dropped", "failed_batches", "failed_ops", "dirty", "rewrites", "loaded"}
+    nlohmann::json stats() const;
+
+private:
+    static constexpr size_t kBatchSize = 512;
+    static constexpr size_t kMaxQueued = 100000;
+
+    enum class OpKind { Create, Append, Trim, Remove, Rewrite };
+
+    struct Op {
+        OpKind kind;
+        std::string session_id;
+        int64_t seq = 0;        // Append: the message; Trim: first kept
+        int64_t time = 0;       // Create: created_at; Append, Trim, Rewrite: last_access
+        int64_t created_at = 0; // Rewrite
+        int message_count = 0;
+        std::string system_prompt{};  // Create, Rewrite
+        MessagePtr message{};         // Append; shared with the session, not copied
+        std::vector<std::pair<int64_t, MessagePtr>> messages{};  // Rewrite
+    };
+
+    std::chrono::milliseconds flush_interval_;
+    SQLite::Database writer_db_;  // Used by the writer thread only
+
+    std::mutex reader_mutex_;
+    SQLite::Database reader_db_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable wake_writer_;
+    std::condition_variable written_;
+    std::vector<Op> queue_;
+    std::unordered_map<std::string, int> pending_;  // Queued or in-flight ops per session
+    std::unordered_map<std::string, size_t> queued_trims_;  // Index in queue_ of each session's trim
+    std::unordered_set<std::string> dirty_;  // Sessions whose file copy has lost changes
+    bool flush_now_ = false;
+    bool stopping_ = false;
+
+    std::atomic<uint64_t> written_ops_{0};
+    std::atomic<uint64_t> batches_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<uint64_t> failed_batches_{0};
+    std::atomic<uint64_t> failed_ops_{0};
+    std::atomic<uint64_t> rewrites_{0};
+    std::atomic<uint64_t> loaded_{0};
+
+    std::thread writer_;
+
+    // False if the op was not queued (only appends and rewrites can be refused)
+    bool enqueue(Op op);
+    void run_writer();
+    // False if the batch could not be committed
+    bool write_batch(const std::vector<Op>& batch);
+};
+
+} // namespace prompt_portal
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <asio.hpp>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <nlohmann/json.hpp>
+#include "response_stream.hpp"
+
+namespace prompt_portal {
+
+struct StreamRequest {
+    std::string method;
+    std::string path;  // Without the query string
+    std::map<std::string, std::string> headers;  // Lower-case names
+    std::string body;
+
+    // Case-insensitive; empty if absent
+    std::string get_header_value(const std::string& name) const;
+};
+
+/**
+ * Minimal HTTP/1.1 listener for the endpoints whose responses are produced
+ * piece by piece (SSE chat, NDJSON batches). Crow 1.2 only sends a dynamic
+ * body once the response ends, so these routes get a socket of their own:
+ * the response goes out with chunked transfer-encoding and every write() is
+ * queued on the connection's strand and sent with async_write as soon as the
+ * previous write finishes (writes queued meanwhile go out together). A client
+ * that lets kMaxQueuedBytes pile up is disconnected rather than buffered for.
+ * A read stays pending while the response is produced, so a client closing
+ * its connection fires on_disconnect() right away, not at the next write.
+ *
+ * One request per connection (Connection: close); requests need a
+ * Content-Length body. Sockets are served on the HttpClient's io threads,
+ * but handlers run on a pool of their own, since they authenticate against
+ * SQLite and parse bodies of up to 8 MB; only the upstream work they start
+ * comes back to the io threads.
+ */
+class StreamServer {
+public:
+    using Handler = std::function<void(const StreamRequest& req, std::shared_ptr<ResponseStream> res)>;
+
+    static StreamServer& instance();
+
+    // Register before start()
+    void route(const std::string& method, const std::string& path, Handler handler);
+
+    // Throws asio::system_error if the address cannot be bound
+    void start(const std::string& host, int port, int handler_threads = 4);
+    // Stops accepting and waits for handlers already running
+    void stop();
+
+    // The bound port, e.g. after start() with port 0
+    unsigned short port() const;
+
+    // {"accepted", "active", "bytes_sent", "disconnects", "slow_clients_dropped", "bad_requests"}
+    nlohmann::json stats() const;
+
+private:
+    class Connection;
+
+    StreamServer() = default;
+    StreamServer(const StreamServer&) = delete;
+    StreamServer& operator=(const StreamServer&) = delete;
+
+    std::map<std::string, Handler> routes_;  // "METHOD path"
+    asio::io_context* io_ = nullptr;
+    std::unique_ptr<asio::ip::tcp::acceptor> acceptor_;
+    std::unique_ptr<asio::thread_pool> handlers_;
+
+    std::atomic<uint64_t> accepted_{0};
+    std::atomic<int64_t> active_{0};
+    std::atomic<uint64_t> bytes_sent_{0};
+    std::atomic<uint64_t> disconnects_{0};
+    std::atomic<uint64_t> slow_clients_dropped_{0};
+    std::atomic<uint64_t> bad_requests_{0};
+
+    void accept();
+    const Handler* find(const std::string& method, const std::string& path) const;
+};
+
+} // namespace prompt_portal
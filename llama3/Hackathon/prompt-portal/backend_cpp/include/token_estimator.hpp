@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string_view>
+#include "chat_request.hpp"
+
+namespace prompt_portal {
+
+/**
+ * Approximate Llama-3 style BPE token count of text, in one pass and without
+ * a vocabulary. Common words count as one token and longer ones as one per
+ * six letters; digits go in groups of three; punctuation and line breaks are
+ * a token each; non-ASCII text counts per code point (CJK one each, emoji
+ * two). It errs high rather than low, since it is used to stay inside the
+ * model's context.
+ */
+int estimate_tokens(std::string_view text);
+
+// estimate_tokens(content) plus the chat template's per-message framing
+int estimate_message_tokens(const ChatMessage& message);
+
+} // namespace prompt_portal
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <deque>
+#include <mutex>
+#include <functional>
+#include <exception>
+#include <nlohmann/json.hpp>
+#include "config.hpp"
+
+namespace prompt_portal {
+
+/**
+ * Thrown by UpstreamSet::select() when every upstream's circuit is open.
+ */
+class NoHealthyUpstream : public std::runtime_error {
+public:
+    NoHealthyUpstream() : std::runtime_error("No healthy LLM upstream available") {}
+};
+
+/**
+ * Weighted set of llama.cpp servers behind one LLMClient.
+ * select() picks the upstream with the fewest outstanding requests per unit of
+ * weight, either across all of them ("least_outstanding") or between two
+ * weighted random candidates ("power_of_two").
+ *
+ * Each upstream has a circuit breaker: eject_after_failures request failures in
+ * a row open it for eject_duration seconds, after which requests are let
+ * through again and the first failure reopens it (half-open). Failed health
+ * probes open it until a probe succeeds.
+ */
+class UpstreamSet {
+public:
+    enum class Health { Unknown, Up, Down };
+
+    struct Upstream {
+        size_t index = 0;
+        std::string url;
+        int weight = 1;
+        std::atomic<unsigned> next_slot{0};  // Round-robin llama.cpp slot assignment
+
+        std::atomic<int> in_flight{0};
+        std::atomic<uint64_t> requests{0};
+        std::atomic<uint64_t> failures{0};
+        std::atomic<uint64_t> ejections{0};
+        std::atomic<int> consecutive_failures{0};
+        std::atomic<int64_t> ejected_until{0};  // steady_clock ticks; 0 when healthy
+
+        std::atomic<Health> health{Health::Unknown};  // From the health prober
+        std::atomic<int> consecutive_probe_failures{0};
+        std::atomic<uint64_t> probes{0};
+        std::atomic<uint64_t> probe_failures{0};
+    };
+
+    using AcquireCallback = std::function<void(std::exception_ptr error, Upstream* upstream)>;
+
+    explicit UpstreamSet(const LlmConfig& config);
+
+    /**
+     * Choose an upstream with fewer than max_concurrent_per_upstream requests
+     * and count the request against it. Every non-null result must be paired
+     * with release(). A preferred upstream (by index) is used as long as its
+     * circuit is closed and it has room. Returns nullptr when every healthy
+     * upstream is full, and throws NoHealthyUpstream when every circuit is
+     * open, so callers fail fast instead of waiting on a dead server.
+     */
+    Upstream* select(int preferred = -1);
+
+    /**
+     * select(), but when every healthy upstream is full the request waits in
+     * line, and on_acquired runs on an I/O thread once a release() frees room.
+     * Runs inline otherwise; NoHealthyUpstream is passed as the error.
+     */
+    void acquire(int preferred, AcquireCallback on_acquired);
+
+    /**
+     * Like select(), but never returns exclude, and nullptr instead of
+     * throwing. Used to place a hedged copy of a request running on exclude.
+     */
+    Upstream* select_other(const Upstream& exclude);
+
+    // Finish a request started by select(); success = false counts toward ejection
+    void release(Upstream& upstream, bool success);
+
+    // Result of a health probe; a success closes the circuit at once
+    void report_probe(Upstream& upstream, bool success);
+
+    // True if select() would find an upstream right now
+    bool any_available() const;
+
+    const std::vector<std::unique_ptr<Upstream>>& upstreams() const { return upstreams_; }
+    const Upstream& primary() const { return *upstreams_.front(); }
+
+    nlohmann::json stats() const;
+
+private:
+    enum class Policy { LeastOutstanding, PowerOfTwo };
+
+    std::vector<std::unique_ptr<Upstream>> upstreams_;
+    Policy policy_ = Policy::LeastOutstanding;
+    int eject_after_failures_;
+    int max_in_flight_;
+    int64_t eject_duration_ticks_;
+
+    struct Waiter {
+        int preferred;
+        AcquireCallback on_acquired;
+    };
+
+    // Requests waiting in acquire() for an upstream with room, oldest first
+    std::mutex waiters_mutex_;
+    std::deque<Waiter> waiters_;
+
+    bool available(const Upstream& upstream, int64_t now) const;
+    bool has_room(const Upstream& upstream) const;
+    // Counts a request against upstream unless that would exceed max_in_flight_
+    bool reserve(Upstream& upstream);
+    // Candidates are available and have room; nullptr if there is none
+    Upstream* pick(int preferred, int64_t now, const Upstream* exclude);
+    Upstream* pick_least_outstanding(int64_t now, const Upstream* exclude = nullptr);
+    Upstream* pick_power_of_two(int64_t now);
+    Upstream* pick_weighted_random(int64_t now, const Upstream* exclude);
+    // Hands room freed by release() or a recovered upstream to waiting requests
+    void wake_waiters(size_t count);
+};
+
+} // namespace prompt_portal
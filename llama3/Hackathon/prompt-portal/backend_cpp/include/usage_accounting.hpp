@@ -0,0 +1,109 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include "completion_extractor.hpp"
+#include "metrics.hpp"
+
+namespace prompt_portal {
+
+/**
+ * Token usage of one finished completion, from its "usage" object and
+ * llama.cpp's "timings". Rates are 0 when the upstream reported no timings.
+ */
+struct UsageSample {
+    int prompt_tokens = 0;        // Evaluated + taken from the prompt cache
+    int cached_tokens = 0;
+    int completion_tokens = 0;
+    double prompt_ms = 0.0;
+    double predicted_ms = 0.0;
+    double prompt_per_second = 0.0;
+    double predicted_per_second = 0.0;
+    std::chrono::steady_clock::duration latency{};
+
+    // Takes whatever fields carries; a stream spreads them over its last chunks
+    void merge(const CompletionFields& fields);
+};
+
+/**
+ * Lock-free usage totals and distributions for one user, model or upstream.
+ */
+class UsageCounters {
+public:
+    void add(const UsageSample& sample);
+    nlohmann::json to_json() const;
+
+private:
+    std::atomic<uint64_t> requests_{0};
+    std::atomic<uint64_t> prompt_tokens_{0};
+    std::atomic<uint64_t> cached_tokens_{0};
+    std::atomic<uint64_t> completion_tokens_{0};
+    std::atomic<uint64_t> prompt_us_{0};
+    std::atomic<uint64_t> predicted_us_{0};
+    Log2Histogram prompt_per_second_;
+    Log2Histogram predicted_per_second_;
+    Log2Histogram completion_tokens_per_request_;
+    LatencyHistogram latency_;
+};
+
+/**
+ * Fixed-capacity open-addressing map from key to UsageCounters. Lookups and
+ * inserts are a CAS on a slot, never a lock; entries live as long as the
+ * table. Once it is three quarters full, new keys share an "(other)" entry, so
+ * client-chosen keys (model names) cannot grow it without bound.
+ */
+class UsageTable {
+public:
+    explicit UsageTable(size_t capacity);
+    ~UsageTable();
+    UsageTable(const UsageTable&) = delete;
+    UsageTable& operator=(const UsageTable&) = delete;
+
+    UsageCounters& find_or_insert(std::string_view key);
+    nlohmann::json to_json() const;
+
+private:
+    static constexpr size_t kMaxKeyLength = 128;
+
+    struct Entry {
+        std::string key;
+        UsageCounters counters;
+    };
+
+    size_t mask_;
+    size_t max_entries_;
+    std::unique_ptr<std::atomic<Entry*>[]> slots_;
+    std::atomic<size_t> size_{0};
+    Entry other_{"(other)", {}};
+};
+
+/**
+ * Usage of every completion served, totalled and broken down by user, model
+ * and upstream. Cache hits and coalesced followers cost the upstream nothing
+ * and are not recorded.
+ */
+class UsageAccounting {
+public:
+    static UsageAccounting& instance();
+
+    // Empty user is recorded as "anonymous"
+    void record(std::string_view user, std::string_view model, std::string_view upstream, const UsageSample& sample);
+
+    // {"total", "users", "models", "upstreams"}
+    nlohmann::json stats() const;
+
+private:
+    UsageAccounting() = default;
+
+    UsageCounters total_;
+    UsageTable users_{8192};
+    UsageTable models_{256};
+    UsageTable upstreams_{256};
+};
+
+} // namespace prompt_portal
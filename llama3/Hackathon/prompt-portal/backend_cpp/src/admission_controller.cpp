@@ -0,0 +1,176 @@
+#include "admission_controller.hpp"
+#include "http_client.hpp"
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+
+namespace prompt_portal {
+
+// =====================
+// Ticket
+// =====================
+
+AdmissionController::Ticket::Ticket(AdmissionController& owner)
+    : owner_(owner), granted_(std::chrono::steady_clock::now()) {}
+
+AdmissionController::Ticket::~Ticket() {
+    release();
+}
+
+void AdmissionController::Ticket::release() {
+    if (released_.exchange(true)) return;
+    owner_.release(std::chrono::steady_clock::now() - granted_);
+}
+
+// =====================
+// AdmissionController
+// =====================
+
+AdmissionController& AdmissionController::instance() {
+    static AdmissionController instance;
+    return instance;
+}
+
+void AdmissionController::configure(const LlmConfig& config, size_t upstream_count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    capacity_ = std::max(1, config.max_concurrent_per_upstream) * static_cast<int>(std::max<size_t>(1, upstream_count));
+    max_queue_ = static_cast<size_t>(std::max(0, config.max_queue));
+    max_queue_per_user_ = static_cast<size_t>(std::max(1, config.max_queue_per_user));
+    max_wait_ = std::chrono::milliseconds(config.max_queue_wait_ms);
+    std::cout << "[Admission] " << capacity_ << " concurrent generations, queue of " << max_queue_ << std::endl;
+}
+
+double AdmissionController::estimate_wait_locked(size_t position) const {
+    // Requests ahead drain at roughly capacity per average service time
+    return avg_service_sec_ * static_cast<double>(position + 1) / capacity_;
+}
+
+int AdmissionController::retry_after_locked() const {
+    return std::max(1, static_cast<int>(std::ceil(estimate_wait_locked(queue_.size()))));
+}
+
+void AdmissionController::admit(const std::string& user_key, double weight, AdmitCallback on_admitted) {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    if (active_ < capacity_ && queue_.empty()) {
+        ++active_;
+        lock.unlock();
+        admitted_++;
+        queue_wait_.record_us(0);
+        return on_admitted(nullptr, std::make_shared<Ticket>(*this));
+    }
+
+    auto reject = [&](std::atomic<uint64_t>& counter, const std::string& reason) {
+        int retry_after = retry_after_locked();
+        lock.unlock();
+        counter++;
+        on_admitted(std::make_exception_ptr(AdmissionRejected(reason, retry_after)), nullptr);
+    };
+
+    if (queue_.size() >= max_queue_) {
+        return reject(rejected_queue_full_, "Server is busy, please retry later");
+    }
+    auto existing = users_.find(user_key);
+    if (existing != users_.end() && existing->second.queued >= max_queue_per_user_) {
+        return reject(rejected_user_limit_, "Too many queued requests for this user");
+    }
+    if (estimate_wait_locked(queue_.size()) > std::chrono::duration<double>(max_wait_).count()) {
+        // No point queueing a request that will hit its deadline anyway
+        return reject(rejected_predicted_, "Server is busy, please retry later");
+    }
+
+    UserState& user = users_[user_key];
+
+    // Start-time fair queuing: a user's requests are spaced 1/weight apart in
+    // virtual time, so a burst can't push ahead of other users' next request
+    double tag = std::max(virtual_time_, user.last_tag) + 1.0 / std::max(weight, 0.01);
+    user.last_tag = tag;
+    user.queued++;
+    QueueKey key{tag, sequence_++};
+
+    // The timer is only touched on its strand. Arming it is posted before the
+    // waiter can be handed capacity, so release()'s cancel always comes after
+    auto deadline = std::make_shared<asio::steady_timer>(asio::make_strand(HttpClient::instance().io_context()));
+    queue_.emplace(key, Waiter{user_key, std::move(on_admitted), std::chrono::steady_clock::now(), deadline});
+    queued_total_++;
+    asio::post(deadline->get_executor(), [this, key, deadline, wait = max_wait_]() {
+        deadline->expires_after(wait);
+        deadline->async_wait([this, key](const asio::error_code& ec) {
+            if (!ec) expire(key);
+        });
+    });
+}
+
+void AdmissionController::expire(QueueKey key) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = queue_.find(key);
+    if (it == queue_.end()) return;  // admitted in the meantime
+
+    Waiter waiter = std::move(it->second);
+    queue_.erase(it);
+    forget_user_locked(waiter.user);
+    int retry_after = retry_after_locked();
+    lock.unlock();
+
+    rejected_deadline_++;
+    queue_wait_.record(std::chrono::steady_clock::now() - waiter.enqueued);
+    waiter.on_admitted(std::make_exception_ptr(AdmissionRejected("Timed out waiting for capacity", retry_after)), nullptr);
+}
+
+void AdmissionController::forget_user_locked(const std::string& user) {
+    auto it = users_.find(user);
+    if (it == users_.end()) return;
+    // A user with nothing queued starts again from the current virtual time
+    if (--it->second.queued == 0) {
+        users_.erase(it);
+    }
+}
+
+void AdmissionController::release(std::chrono::steady_clock::duration held) {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    double held_sec = std::chrono::duration<double>(held).count();
+    avg_service_sec_ = avg_service_sec_ == 0.0 ? held_sec : 0.9 * avg_service_sec_ + 0.1 * held_sec;
+
+    if (queue_.empty()) {
+        --active_;
+        return;
+    }
+
+    // Hand the capacity straight to the lowest-tagged waiter
+    auto it = queue_.begin();
+    virtual_time_ = it->first.first;
+    Waiter waiter = std::move(it->second);
+    queue_.erase(it);
+    forget_user_locked(waiter.user);
+    lock.unlock();
+
+    asio::post(waiter.deadline->get_executor(), [deadline = waiter.deadline]() { deadline->cancel(); });
+    admitted_++;
+    queue_wait_.record(std::chrono::steady_clock::now() - waiter.enqueued);
+
+    auto ticket = std::make_shared<Ticket>(*this);
+    asio::post(HttpClient::instance().io_context(), [on_admitted = std::move(waiter.on_admitted), ticket]() {
+        on_admitted(nullptr, ticket);
+    });
+}
+
+nlohmann::json AdmissionController::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return {
+        {"capacity", capacity_},
+        {"active", active_},
+        {"queued", queue_.size()},
+        {"queued_users", users_.size()},
+        {"admitted", admitted_.load()},
+        {"queued_total", queued_total_.load()},
+        {"rejected_queue_full", rejected_queue_full_.load()},
+        {"rejected_user_limit", rejected_user_limit_.load()},
+        {"rejected_predicted", rejected_predicted_.load()},
+        {"rejected_deadline", rejected_deadline_.load()},
+        {"avg_service_ms", avg_service_sec_ * 1000.0},
+        {"queue_wait", queue_wait_.to_json()}
+    };
+}
+
+} // namespace prompt_portal
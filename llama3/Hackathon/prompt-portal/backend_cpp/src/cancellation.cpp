@@ -0,0 +1,28 @@
+#include "cancellation.hpp"
+
+namespace prompt_portal {
+
+void CancellationToken::cancel() {
+    std::vector<std::function<void()>> callbacks;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cancelled_.exchange(true, std::memory_order_acq_rel)) return;
+        callbacks.swap(callbacks_);
+    }
+    for (auto& callback : callbacks) {
+        callback();
+    }
+}
+
+void CancellationToken::on_cancel(std::function<void()> fn) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!cancelled_.load(std::memory_order_acquire)) {
+            callbacks_.push_back(std::move(fn));
+            return;
+        }
+    }
+    fn();
+}
+
+} // namespace prompt_portal
@@ -0,0 +1,214 @@
+#include "chat_request.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <charconv>
+
+namespace prompt_portal {
+
+namespace {
+
+constexpr uint64_t kOnes = 0x0101010101010101ULL;
+constexpr uint64_t kHighBits = 0x8080808080808080ULL;
+
+// Non-zero if some byte of word is below n (n <= 0x80)
+inline uint64_t has_byte_below(uint64_t word, uint8_t n) {
+    return (word - kOnes * n) & ~word & kHighBits;
+}
+
+inline uint64_t has_byte(uint64_t word, uint8_t c) {
+    return has_byte_below(word ^ (kOnes * c), 1);
+}
+
+// Non-zero if any of the eight bytes is a control character, '"', '\\' or non-ASCII
+inline uint64_t needs_escaping(uint64_t word) {
+    return has_byte_below(word, 0x20) | has_byte(word, '"') | has_byte(word, '\\') | (word & kHighBits);
+}
+
+inline bool is_continuation(unsigned char c) {
+    return (c & 0xC0) == 0x80;
+}
+
+// Length of the UTF-8 sequence at p. A malformed one clears valid and spans its
+// longest well-formed prefix (at least one byte), which becomes a single U+FFFD
+// as Unicode recommends and nlohmann's error_handler_t::replace does
+size_t utf8_sequence_length(const unsigned char* p, size_t available, bool& valid) {
+    valid = false;
+    unsigned char c = p[0];
+    size_t length;
+    unsigned char min_second = 0x80, max_second = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF) {
+        length = 2;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        length = 3;
+        if (c == 0xE0) min_second = 0xA0;       // Overlong
+        if (c == 0xED) max_second = 0x9F;       // Surrogates
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        length = 4;
+        if (c == 0xF0) min_second = 0x90;       // Overlong
+        if (c == 0xF4) max_second = 0x8F;       // Above U+10FFFF
+    } else {
+        return 1;
+    }
+    if (available < 2 || p[1] < min_second || p[1] > max_second) return 1;
+    for (size_t i = 2; i < length; ++i) {
+        if (i >= available || !is_continuation(p[i])) return i;
+    }
+    valid = true;
+    return length;
+}
+
+void append_escaped(std::string& out, unsigned char c) {
+    switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\b': out += "\\b"; break;
+        case '\f': out += "\\f"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default: {
+            static const char hex[] = "0123456789abcdef";
+            char escaped[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+            out.append(escaped, sizeof(escaped));
+        }
+    }
+}
+
+void append_int(std::string& out, int value) {
+    char buffer[16];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    out.append(buffer, result.ptr);
+}
+
+// Shortest of %.15g / %.17g that reads back as the same double
+void append_double(std::string& out, double value) {
+    if (!std::isfinite(value)) {
+        out += "null";
+        return;
+    }
+    char buffer[32];
+    int length = std::snprintf(buffer, sizeof(buffer), "%.15g", value);
+    if (std::strtod(buffer, nullptr) != value) {
+        length = std::snprintf(buffer, sizeof(buffer), "%.17g", value);
+    }
+    out.append(buffer, static_cast<size_t>(length));
+    // Keep it a JSON number that parses back as floating point
+    if (std::strpbrk(buffer, ".eE") == nullptr) {
+        out += ".0";
+    }
+}
+
+void append_key(std::string& out, std::string_view key) {
+    out += '"';
+    out += key;
+    out += "\":";
+}
+
+} // anonymous namespace
+
+void append_json_string(std::string& out, std::string_view value) {
+    const char* data = value.data();
+    size_t size = value.size();
+    size_t run_start = 0;
+    size_t i = 0;
+
+    out += '"';
+    while (i < size) {
+        if (i + 8 <= size) {
+            uint64_t word;
+            std::memcpy(&word, data + i, sizeof(word));
+            if (!needs_escaping(word)) {
+                i += 8;
+                continue;
+            }
+        }
+
+        auto c = static_cast<unsigned char>(data[i]);
+        if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\') {
+            ++i;
+            continue;
+        }
+
+        out.append(data + run_start, i - run_start);
+        if (c < 0x80) {
+            append_escaped(out, c);
+            ++i;
+        } else {
+            bool valid;
+            size_t length = utf8_sequence_length(reinterpret_cast<const unsigned char*>(data + i), size - i, valid);
+            if (valid) {
+                out.append(data + i, length);
+            } else {
+                out += "\xEF\xBF\xBD";
+            }
+            i += length;
+        }
+        run_start = i;
+    }
+    out.append(data + run_start, size - run_start);
+    out += '"';
+}
+
+std::string_view write_chat_request(const ChatRequest& request) {
+    thread_local std::string out;
+    out.clear();
+
+    size_t estimate = 256 + request.model.size();
+    for (size_t i = 0; i < request.messages.size(); ++i) {
+        estimate += request.messages[i].role.size() + request.messages[i].content.size() + 32;
+    }
+    out.reserve(estimate + estimate / 16);
+
+    out += '{';
+    append_key(out, "model");
+    append_json_string(out, request.model);
+    out += ',';
+    append_key(out, "messages");
+    out += '[';
+    for (size_t i = 0; i < request.messages.size(); ++i) {
+        const ChatMessage& msg = request.messages[i];
+        if (i > 0) out += ',';
+        out += "{\"role\":";
+        append_json_string(out, msg.role);
+        out += ",\"content\":";
+        append_json_string(out, msg.content);
+        out += '}';
+    }
+    out += "],";
+    append_key(out, "temperature");
+    append_double(out, request.temperature);
+    out += ',';
+    append_key(out, "top_p");
+    append_double(out, request.top_p);
+    out += ',';
+    append_key(out, "max_tokens");
+    append_int(out, request.max_tokens);
+    if (request.cache_prompt) {
+        out += ",\"cache_prompt\":true";
+    }
+    if (request.seed >= 0) {
+        out += ',';
+        append_key(out, "seed");
+        append_int(out, request.seed);
+    }
+    if (request.id_slot >= 0) {
+        out += ',';
+        append_key(out, "id_slot");
+        append_int(out, request.id_slot);
+    }
+    if (request.stream) {
+        // Ask for the usage object on the final chunk, as non-stream responses have it
+        out += ",\"stream\":true,\"stream_options\":{\"include_usage\":true}";
+    }
+    if (request.skip_thinking) {
+        out += ",\"extra_body\":{\"enable_thinking\":false}";
+    }
+    out += '}';
+
+    return out;
+}
+
+} // namespace prompt_portal
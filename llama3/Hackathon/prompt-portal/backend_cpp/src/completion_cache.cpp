@@ -0,0 +1,100 @@
+#include "completion_cache.hpp"
+
+namespace prompt_portal {
+
+CompletionCache::CompletionCache(size_t max_bytes, int ttl_sec)
+    : shard_budget_(max_bytes / kShards), ttl_(ttl_sec) {}
+
+uint64_t CompletionCache::hash(const std::string& key) {
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned char c : key) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+void CompletionCache::erase_locked(Shard& shard, std::list<Entry>::iterator it) {
+    shard.bytes -= it->bytes;
+    shard.index.erase(it->hash);
+    shard.lru.erase(it);
+}
+
+std::optional<std::string> CompletionCache::get(const std::string& key) {
+    uint64_t h = hash(key);
+    Shard& shard = shard_for(h);
+    std::shared_ptr<const std::string> value;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto found = shard.index.find(h);
+        if (found != shard.index.end() && found->second->key == key) {
+            auto it = found->second;
+            if (ttl_.count() > 0 && std::chrono::steady_clock::now() >= it->expires) {
+                erase_locked(shard, it);
+                expired_++;
+            } else {
+                shard.lru.splice(shard.lru.begin(), shard.lru, it);
+                value = it->value;
+            }
+        }
+    }
+
+    if (!value) {
+        misses_++;
+        return std::nullopt;
+    }
+    hits_++;
+    // Copy outside the shard lock
+    return *value;
+}
+
+void CompletionCache::put(const std::string& key, const std::string& value) {
+    size_t bytes = key.size() + value.size() + kEntryOverhead;
+    if (bytes > shard_budget_) return;
+
+    uint64_t h = hash(key);
+    Shard& shard = shard_for(h);
+    auto stored = std::make_shared<const std::string>(value);
+    auto expires = std::chrono::steady_clock::now() + ttl_;
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.index.find(h);
+    if (found != shard.index.end()) {
+        // Same key (or a colliding one): the newer answer replaces it
+        erase_locked(shard, found->second);
+    }
+
+    while (shard.bytes + bytes > shard_budget_ && !shard.lru.empty()) {
+        erase_locked(shard, std::prev(shard.lru.end()));
+        evictions_++;
+    }
+
+    shard.lru.push_front({h, key, std::move(stored), expires, bytes});
+    shard.index[h] = shard.lru.begin();
+    shard.bytes += bytes;
+}
+
+nlohmann::json CompletionCache::stats() const {
+    size_t bytes = 0;
+    size_t entries = 0;
+    for (const auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        bytes += shard.bytes;
+        entries += shard.lru.size();
+    }
+
+    uint64_t hits = hits_.load();
+    uint64_t lookups = hits + misses_.load();
+    return {
+        {"entries", entries},
+        {"bytes_used", bytes},
+        {"max_bytes", shard_budget_ * kShards},
+        {"hits", hits},
+        {"misses", misses_.load()},
+        {"hit_rate", lookups > 0 ? static_cast<double>(hits) / lookups : 0.0},
+        {"evictions", evictions_.load()},
+        {"expired", expired_.load()}
+    };
+}
+
+} // namespace prompt_portal
@@ -0,0 +1,192 @@
+#include "completion_extractor.hpp"
+#include <nlohmann/json.hpp>
+#include <array>
+#include <initializer_list>
+
+namespace prompt_portal {
+
+void CompletionFields::reset() {
+    has_choice = false;
+    content.clear();
+    finish_reason.clear();
+    usage = Usage{};
+    timings = Timings{};
+    id_slot = -1;
+    has_error = false;
+    error.clear();
+}
+
+namespace {
+
+using json = nlohmann::json;
+
+// Object keys the extractor cares about; array elements are stored as their index (>= 0)
+enum Key : int {
+    kUnknown = -1,
+    kChoices = -2,
+    kMessage = -3,
+    kDelta = -4,
+    kContent = -5,
+    kFinishReason = -6,
+    kUsage = -7,
+    kPromptTokens = -8,
+    kCompletionTokens = -9,
+    kTotalTokens = -10,
+    kTimings = -11,
+    kPromptN = -12,
+    kCacheN = -13,
+    kPredictedN = -14,
+    kPromptMs = -15,
+    kPredictedMs = -16,
+    kPromptPerSecond = -17,
+    kPredictedPerSecond = -18,
+    kIdSlot = -19,
+    kError = -20,
+};
+
+Key classify(const std::string& key) {
+    struct Entry { const char* name; Key key; };
+    static constexpr Entry kKeys[] = {
+        {"choices", kChoices}, {"message", kMessage}, {"delta", kDelta}, {"content", kContent},
+        {"finish_reason", kFinishReason}, {"usage", kUsage}, {"prompt_tokens", kPromptTokens},
+        {"completion_tokens", kCompletionTokens}, {"total_tokens", kTotalTokens},
+        {"timings", kTimings}, {"prompt_n", kPromptN}, {"cache_n", kCacheN},
+        {"predicted_n", kPredictedN}, {"prompt_ms", kPromptMs}, {"predicted_ms", kPredictedMs},
+        {"prompt_per_second", kPromptPerSecond}, {"predicted_per_second", kPredictedPerSecond},
+        {"id_slot", kIdSlot}, {"error", kError},
+    };
+    for (const auto& entry : kKeys) {
+        if (key == entry.name) return entry.key;
+    }
+    return kUnknown;
+}
+
+/**
+ * SAX handler that tracks the path to the current value (one frame per open
+ * object or array: the current key, or the current element index) and keeps
+ * only the values at the paths it knows. Frames deeper than kMaxDepth are
+ * counted but not recorded; nothing of interest lives that deep.
+ */
+class Extractor {
+public:
+    explicit Extractor(CompletionFields& fields) : fields_(fields) {}
+
+    bool null() { return value_done(); }
+    bool boolean(bool) { return value_done(); }
+    bool number_integer(json::number_integer_t value) { return number(static_cast<double>(value)); }
+    bool number_unsigned(json::number_unsigned_t value) { return number(static_cast<double>(value)); }
+    bool number_float(json::number_float_t value, const json::string_t&) { return number(value); }
+    bool binary(json::binary_t&) { return value_done(); }
+
+    bool string(json::string_t& value) {
+        if (at({kChoices, 0, kMessage, kContent}) || at({kChoices, 0, kDelta, kContent})) {
+            // Take the parser's buffer instead of copying; it gets ours back to reuse
+            fields_.content.clear();
+            fields_.content.swap(value);
+        } else if (at({kChoices, 0, kFinishReason})) {
+            fields_.finish_reason.assign(value);
+        } else if (at({kError})) {
+            fields_.has_error = true;
+            fields_.error.assign(value);
+        } else if (at({kError, kMessage})) {
+            fields_.error.assign(value);
+        }
+        return value_done();
+    }
+
+    bool start_object(std::size_t) {
+        if (at({kChoices, 0})) fields_.has_choice = true;
+        else if (at({kTimings})) fields_.timings.present = true;
+        else if (at({kError})) fields_.has_error = true;
+        return push(false);
+    }
+
+    bool key(json::string_t& key) {
+        if (depth_ <= kMaxDepth) frames_[depth_ - 1].segment = classify(key);
+        return true;
+    }
+
+    bool end_object() { return pop(); }
+    bool start_array(std::size_t) { return push(true); }
+    bool end_array() { return pop(); }
+
+    bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception&) {
+        return false;
+    }
+
+private:
+    static constexpr int kMaxDepth = 6;
+
+    struct Frame {
+        bool array = false;
+        int segment = kUnknown;  // Key for objects, element index for arrays
+    };
+
+    CompletionFields& fields_;
+    std::array<Frame, kMaxDepth> frames_{};
+    int depth_ = 0;
+
+    bool at(std::initializer_list<int> path) const {
+        if (depth_ != static_cast<int>(path.size())) return false;
+        int i = 0;
+        for (int segment : path) {
+            if (frames_[i++].segment != segment) return false;
+        }
+        return true;
+    }
+
+    bool push(bool array) {
+        if (depth_ < kMaxDepth) frames_[depth_] = Frame{array, array ? 0 : kUnknown};
+        ++depth_;
+        return true;
+    }
+
+    bool pop() {
+        --depth_;
+        return value_done();
+    }
+
+    // A value just ended: step the enclosing array to its next element
+    bool value_done() {
+        if (depth_ > 0 && depth_ <= kMaxDepth && frames_[depth_ - 1].array) {
+            ++frames_[depth_ - 1].segment;
+        }
+        return true;
+    }
+
+    bool number(double value) {
+        if (at({kIdSlot})) {
+            fields_.id_slot = static_cast<int>(value);
+        } else if (depth_ == 2 && frames_[0].segment == kUsage) {
+            int n = static_cast<int>(value);
+            switch (frames_[1].segment) {
+                case kPromptTokens: fields_.usage.prompt_tokens = n; break;
+                case kCompletionTokens: fields_.usage.completion_tokens = n; break;
+                case kTotalTokens: fields_.usage.total_tokens = n; break;
+                default: break;
+            }
+        } else if (depth_ == 2 && frames_[0].segment == kTimings) {
+            switch (frames_[1].segment) {
+                case kPromptN: fields_.timings.prompt_n = static_cast<int>(value); break;
+                case kCacheN: fields_.timings.cache_n = static_cast<int>(value); break;
+                case kPredictedN: fields_.timings.predicted_n = static_cast<int>(value); break;
+                case kPromptMs: fields_.timings.prompt_ms = value; break;
+                case kPredictedMs: fields_.timings.predicted_ms = value; break;
+                case kPromptPerSecond: fields_.timings.prompt_per_second = value; break;
+                case kPredictedPerSecond: fields_.timings.predicted_per_second = value; break;
+                default: break;
+            }
+        }
+        return value_done();
+    }
+};
+
+} // anonymous namespace
+
+bool extract_completion(std::string_view body, CompletionFields& fields) {
+    fields.reset();
+    Extractor extractor(fields);
+    return json::sax_parse(body.begin(), body.end(), &extractor);
+}
+
+} // namespace prompt_portal
@@ -0,0 +1,137 @@
+#include "dns_cache.hpp"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+namespace prompt_portal {
+
+namespace {
+
+// RFC 8305 section 4: alternate address families, starting with IPv6
+DnsCache::Endpoints interleave(const asio::ip::tcp::resolver::results_type& results) {
+    DnsCache::Endpoints v6, v4;
+    for (const auto& entry : results) {
+        (entry.endpoint().address().is_v6() ? v6 : v4).push_back(entry.endpoint());
+    }
+
+    DnsCache::Endpoints ordered;
+    ordered.reserve(v6.size() + v4.size());
+    for (size_t i = 0; i < std::max(v6.size(), v4.size()); ++i) {
+        if (i < v6.size()) ordered.push_back(v6[i]);
+        if (i < v4.size()) ordered.push_back(v4[i]);
+    }
+    return ordered;
+}
+
+} // anonymous namespace
+
+DnsCache::DnsCache(asio::io_context& io, int ttl_sec, int negative_ttl_sec)
+    : io_(io), ttl_(ttl_sec), negative_ttl_(negative_ttl_sec) {}
+
+void DnsCache::configure(int ttl_sec, int negative_ttl_sec) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ttl_ = std::chrono::seconds(ttl_sec);
+    negative_ttl_ = std::chrono::seconds(negative_ttl_sec);
+}
+
+void DnsCache::resolve(const std::string& host, int port, ResolveCallback on_resolved) {
+    // IP literals never touch the resolver
+    asio::error_code literal_ec;
+    auto address = asio::ip::make_address(host, literal_ec);
+    if (!literal_ec) {
+        auto endpoints = std::make_shared<const Endpoints>(
+            Endpoints{asio::ip::tcp::endpoint(address, static_cast<unsigned short>(port))});
+        asio::post(io_, [on_resolved = std::move(on_resolved), endpoints]() {
+            on_resolved(nullptr, endpoints);
+        });
+        return;
+    }
+
+    std::string key = host + ":" + std::to_string(port);
+    std::unique_lock<std::mutex> lock(mutex_);
+    Entry& entry = entries_[key];
+
+    if (entry.resolving) {
+        coalesced_++;
+        entry.waiters.push_back(std::move(on_resolved));
+        return;
+    }
+
+    if (std::chrono::steady_clock::now() < entry.expires) {
+        auto endpoints = entry.endpoints;
+        auto error = entry.error;
+        lock.unlock();
+        (error ? negative_hits_ : hits_)++;
+        asio::post(io_, [on_resolved = std::move(on_resolved), error, endpoints]() {
+            on_resolved(error, endpoints);
+        });
+        return;
+    }
+
+    misses_++;
+    entry.resolving = true;
+    entry.waiters.push_back(std::move(on_resolved));
+    lock.unlock();
+    start_resolution(key, host, port);
+}
+
+void DnsCache::start_resolution(const std::string& key, const std::string& host, int port) {
+    auto resolver = std::make_shared<asio::ip::tcp::resolver>(io_);
+    auto started = std::chrono::steady_clock::now();
+
+    resolver->async_resolve(host, std::to_string(port),
+        [this, resolver, key, host, started](const asio::error_code& ec, asio::ip::tcp::resolver::results_type results) {
+            resolve_latency_.record(std::chrono::steady_clock::now() - started);
+
+            if (ec || results.empty()) {
+                failures_++;
+                std::cerr << "[DNS] Failed to resolve " << host << ": " << ec.message() << std::endl;
+                return complete(key, std::make_exception_ptr(std::runtime_error("Failed to resolve hostname: " + host)), nullptr);
+            }
+            complete(key, nullptr, std::make_shared<const Endpoints>(interleave(results)));
+        });
+}
+
+void DnsCache::complete(const std::string& key, std::exception_ptr error, std::shared_ptr<const Endpoints> endpoints) {
+    std::vector<ResolveCallback> waiters;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Entry& entry = entries_[key];
+        entry.resolving = false;
+        entry.error = error;
+        entry.endpoints = endpoints;
+        entry.expires = std::chrono::steady_clock::now() + (error ? negative_ttl_ : ttl_);
+        waiters.swap(entry.waiters);
+    }
+
+    for (auto& waiter : waiters) {
+        waiter(error, endpoints);
+    }
+}
+
+void DnsCache::invalidate(const std::string& host, int port) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(host + ":" + std::to_string(port));
+    if (it != entries_.end() && !it->second.resolving) {
+        entries_.erase(it);
+    }
+}
+
+nlohmann::json DnsCache::stats() const {
+    size_t cached;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cached = entries_.size();
+    }
+    return {
+        {"entries", cached},
+        {"hits", hits_.load()},
+        {"negative_hits", negative_hits_.load()},
+        {"misses", misses_.load()},
+        {"coalesced", coalesced_.load()},
+        {"failures", failures_.load()},
+        {"resolve_latency", resolve_latency_.to_json()}
+    };
+}
+
+} // namespace prompt_portal
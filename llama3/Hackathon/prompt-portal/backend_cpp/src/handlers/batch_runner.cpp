@@ -0,0 +1,171 @@
+#include "handlers/batch_runner.hpp"
+#include "admission_controller.hpp"
+#include "http_client.hpp"
+#include <iostream>
+#include <algorithm>
+
+namespace prompt_portal {
+namespace handlers {
+
+namespace {
+
+double elapsed_ms(std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// Same status a single /api/llm/chat request would have answered with
+nlohmann::json describe_error(std::exception_ptr error) {
+    try {
+        std::rethrow_exception(error);
+    } catch (const AdmissionRejected& e) {
+        return {{"error", e.what()}, {"status", 429}, {"retry_after", e.retry_after()}};
+    } catch (const DeadlineExceeded& e) {
+        return {{"error", e.what()}, {"status", 504}};
+    } catch (const RequestCancelled& e) {
+        return {{"error", e.what()}, {"status", 499}};
+    } catch (const std::runtime_error& e) {
+        return {{"error", e.what()}, {"status", 503}};
+    } catch (const std::exception& e) {
+        return {{"error", e.what()}, {"status", 500}};
+    } catch (...) {
+        return {{"error", "Unknown error"}, {"status", 500}};
+    }
+}
+
+} // anonymous namespace
+
+void BatchRunner::start(std::shared_ptr<ResponseStream> out, int user_id, std::vector<Item> items, size_t parallelism, bool ndjson) {
+    std::shared_ptr<BatchRunner> runner(new BatchRunner(std::move(out), user_id, std::move(items), ndjson));
+    std::cout << "[LLM] Batch of " << runner->items_.size() << " items, " << parallelism << " at a time" << std::endl;
+    size_t initial = std::min(std::max<size_t>(1, parallelism), runner->items_.size());
+    for (size_t i = 0; i < initial; ++i) {
+        runner->launch_next();
+    }
+}
+
+BatchRunner::BatchRunner(std::shared_ptr<ResponseStream> out, int user_id, std::vector<Item> items, bool ndjson)
+    : out_(std::move(out)),
+      user_key_(std::to_string(user_id)),
+      items_(std::move(items)),
+      ndjson_(ndjson),
+      started_(Clock::now()) {
+    // The token only; the runner itself is kept alive by its items
+    out_->on_disconnect([cancel = cancel_]() { cancel->cancel(); });
+    if (!ndjson_) {
+        results_.resize(items_.size());
+    } else {
+        out_->begin(200, {
+            {"Content-Type", "application/x-ndjson"},
+            {"Cache-Control", "no-cache"},
+            {"X-Accel-Buffering", "no"}
+        });
+    }
+}
+
+void BatchRunner::launch_next() {
+    size_t index;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (next_ >= items_.size()) return;
+        index = next_++;
+    }
+    if (cancel_->cancelled()) {
+        auto now = Clock::now();
+        return complete(index, std::make_exception_ptr(RequestCancelled()), "", now, now);
+    }
+    run(index);
+}
+
+void BatchRunner::run(size_t index) {
+    auto self = shared_from_this();
+    auto launched = Clock::now();
+
+    AdmissionController::instance().admit(user_key_, 1.0,
+        [self, index, launched](std::exception_ptr error, AdmissionController::TicketPtr ticket) {
+            if (error) {
+                return self->complete(index, error, "", launched, launched);
+            }
+            auto admitted = Clock::now();
+            RequestContext context;
+            context.cancel = self->cancel_;
+            context.user = self->user_key_;
+            context.deadline = launched + std::chrono::seconds(get_config().llm.timeout);
+            const Item& item = self->items_[index];
+            try {
+                get_llm_client().generate_async(item.messages,
+                    [self, index, launched, admitted, ticket](std::exception_ptr error, std::string content) {
+                        ticket->release();
+                        self->complete(index, error, std::move(content), launched, admitted);
+                    },
+                    item.temperature, item.top_p, item.max_tokens, item.model, std::move(context));
+            } catch (...) {
+                self->complete(index, std::current_exception(), "", launched, admitted);
+            }
+        });
+}
+
+void BatchRunner::complete(size_t index, std::exception_ptr error, std::string content,
+                           Clock::time_point launched, Clock::time_point admitted) {
+    auto now = Clock::now();
+    nlohmann::json result = error ? describe_error(error) : nlohmann::json{{"response", std::move(content)}};
+    result["index"] = index;
+    result["timings"] = {
+        {"queue_ms", elapsed_ms(admitted - launched)},
+        {"generation_ms", elapsed_ms(now - admitted)},
+        {"total_ms", elapsed_ms(now - launched)}
+    };
+
+    bool client_gone = !out_->client_connected();
+    bool done;
+    {
+        // Lines go out in completion order; the lock keeps them from interleaving
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error) ++succeeded_;
+        if (ndjson_) {
+            if (!client_gone) out_->write(result.dump() + "\n");
+        } else {
+            results_[index] = std::move(result);
+        }
+        done = ++completed_ == items_.size();
+    }
+
+    if (client_gone) {
+        cancel_->cancel();
+    }
+    if (done) {
+        finish();
+    } else {
+        // complete() may be running inside admit() or generate_async() of the
+        // previous item; start the next one from a fresh stack
+        auto self = shared_from_this();
+        asio::post(HttpClient::instance().io_context(), [self]() { self->launch_next(); });
+    }
+}
+
+void BatchRunner::finish() {
+    auto totals = summary();
+    std::cout << "[LLM] Batch finished: " << succeeded_ << "/" << items_.size()
+              << " succeeded in " << totals["elapsed_ms"].get<double>() << "ms" << std::endl;
+
+    if (ndjson_) {
+        totals["done"] = true;
+        out_->write(totals.dump() + "\n");
+    } else {
+        totals["results"] = std::move(results_);
+        out_->begin(200, {{"Content-Type", "application/json"}});
+        out_->write(totals.dump());
+    }
+    out_->end();
+}
+
+nlohmann::json BatchRunner::summary() const {
+    return {
+        {"count", items_.size()},
+        {"succeeded", succeeded_},
+        {"failed", items_.size() - succeeded_},
+        {"elapsed_ms", elapsed_ms(Clock::now() - started_)}
+    };
+}
+
+} // namespace handlers
+} // namespace prompt_portal
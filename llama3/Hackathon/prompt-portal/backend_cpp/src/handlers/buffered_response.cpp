@@ -0,0 +1,41 @@
+#include "handlers/buffered_response.hpp"
+
+namespace prompt_portal {
+namespace handlers {
+
+void BufferedResponse::begin(int status, const ResponseHeaders& headers) {
+    res_.code = status;
+    for (const auto& [name, value] : headers) {
+        res_.set_header(name, value);
+    }
+}
+
+bool BufferedResponse::write(std::string data) {
+    if (ended_) {
+        return false;
+    }
+    if (!client_connected()) {
+        disconnected_.cancel();
+        return false;
+    }
+    res_.body += data;
+    return true;
+}
+
+void BufferedResponse::end() {
+    if (!ended_) {
+        ended_ = true;
+        res_.end();
+    }
+}
+
+bool BufferedResponse::client_connected() {
+    return res_.is_alive();
+}
+
+void BufferedResponse::on_disconnect(std::function<void()> callback) {
+    disconnected_.on_cancel(std::move(callback));
+}
+
+} // namespace handlers
+} // namespace prompt_portal
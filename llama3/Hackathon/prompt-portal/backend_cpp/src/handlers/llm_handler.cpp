@@ -1,12 +1,33 @@
 #include "handlers/llm_handler.hpp"
+#include "handlers/sse_writer.hpp"
+#include "handlers/buffered_response.hpp"
+#include "handlers/batch_runner.hpp"
 #include "llm_client.hpp"
+#include "http_client.hpp"
+#include "stream_server.hpp"
+#include "usage_accounting.hpp"
 #include "auth.hpp"
 #include <iostream>
-#include <sstream>
+#include <chrono>
+#include <algorithm>
 
 namespace prompt_portal {
 namespace handlers {
 
+namespace {
+
+std::string describe(std::exception_ptr error) {
+    try {
+        std::rethrow_exception(error);
+    } catch (const std::exception& e) {
+        return e.what();
+    } catch (...) {
+        return "Unknown error";
+    }
+}
+
+} // anonymous namespace
+
 crow::response LLMHandler::error_response(int status, const std::string& detail) {
     nlohmann::json error = {{"detail", detail}};
     crow::response res(status, error.dump());
@@ -20,21 +41,22 @@ crow::response LLMHandler::json_response(int status, const nlohmann::json& data)
     return res;
 }
 
-crow::response LLMHandler::chat(const crow::request& req) {
+void LLMHandler::chat(const crow::request& req, crow::response& res) {
+    auto out = std::make_shared<BufferedResponse>(res);
     try {
         // Authenticate user
         std::string auth_header = req.get_header_value("Authorization");
         auto user = Auth::instance().get_current_user(auth_header);
         
         if (!user) {
-            return error_response(401, "Could not validate credentials");
+            return end_with_error(*out, 401, "Could not validate credentials");
         }
         
         auto body = nlohmann::json::parse(req.body);
         
         // Parse messages
         if (!body.contains("messages") || !body["messages"].is_array()) {
-            return error_response(400, "messages array is required");
+            return end_with_error(*out, 400, "messages array is required");
         }
         
         std::vector<ChatMessage> messages;
@@ -46,7 +68,7 @@ crow::response LLMHandler::chat(const crow::request& req) {
         }
         
         if (messages.empty()) {
-            return error_response(400, "At least one message is required");
+            return end_with_error(*out, 400, "At least one message is required");
         }
         
         // Optional parameters
@@ -66,33 +88,35 @@ crow::response LLMHandler::chat(const crow::request& req) {
         
         std::string model = body.value("model", "default");
         
-        // Generate response
-        auto& client = get_llm_client();
-        std::string response = client.generate(messages, temperature, top_p, max_tokens, model);
-        
-        nlohmann::json result = {
-            {"response", response}
-        };
-        
-        return json_response(200, result);
+        // Wait for a generation slot, then generate; out is completed from the upstream I/O thread
+        admit_then(out, user->id, "Chat", [out, messages, temperature, top_p, max_tokens, model](AdmissionController::TicketPtr ticket, RequestContext context) {
+            get_llm_client().generate_async(messages, [out, ticket](std::exception_ptr error, std::string response) {
+                ticket->release();
+                if (error) {
+                    return end_with_exception(*out, error, "Chat");
+                }
+                end_with_json(*out, 200, {{"response", response}});
+            }, temperature, top_p, max_tokens, model, std::move(context));
+        });
         
     } catch (const std::runtime_error& e) {
         std::cerr << "[LLM] Chat error: " << e.what() << std::endl;
-        return error_response(503, e.what());
+        return end_with_error(*out, 503, e.what());
     } catch (const std::exception& e) {
         std::cerr << "[LLM] Chat error: " << e.what() << std::endl;
-        return error_response(500, "Internal server error");
+        return end_with_error(*out, 500, "Internal server error");
     }
 }
 
-crow::response LLMHandler::session_chat(const crow::request& req) {
+void LLMHandler::session_chat(const crow::request& req, crow::response& res) {
+    auto out = std::make_shared<BufferedResponse>(res);
     try {
         // Authenticate user
         std::string auth_header = req.get_header_value("Authorization");
         auto user = Auth::instance().get_current_user(auth_header);
         
         if (!user) {
-            return error_response(401, "Could not validate credentials");
+            return end_with_error(*out, 401, "Could not validate credentials");
         }
         
         auto body = nlohmann::json::parse(req.body);
@@ -102,10 +126,10 @@ crow::response LLMHandler::session_chat(const crow::request& req) {
         std::string system_prompt = body.value("system_prompt", "You are a helpful AI assistant.");
         
         if (session_id.empty()) {
-            return error_response(400, "session_id is required");
+            return end_with_error(*out, 400, "session_id is required");
         }
         if (message.empty()) {
-            return error_response(400, "message is required");
+            return end_with_error(*out, 400, "message is required");
         }
         
         // Optional parameters
@@ -123,43 +147,98 @@ crow::response LLMHandler::session_chat(const crow::request& req) {
             max_tokens = body["max_tokens"].get<int>();
         }
         
-        // Process message with session
-        auto& session_manager = get_session_manager();
-        std::string response = session_manager.process_message(
-            session_id, system_prompt, message, temperature, top_p, max_tokens
-        );
-        
-        nlohmann::json result = {
-            {"response", response},
-            {"session_id", session_id}
-        };
-        
-        return json_response(200, result);
+        // Process message with session once admitted; out is completed from the upstream I/O thread
+        admit_then(out, user->id, "Session chat", [out, session_id, system_prompt, message, temperature, top_p, max_tokens](AdmissionController::TicketPtr ticket, RequestContext context) {
+            get_session_manager().process_message_async(
+                session_id, system_prompt, message,
+                [out, session_id, ticket](std::exception_ptr error, std::string response) {
+                    ticket->release();
+                    if (error) {
+                        return end_with_exception(*out, error, "Session chat");
+                    }
+                    end_with_json(*out, 200, {{"response", response}, {"session_id", session_id}});
+                },
+                temperature, top_p, max_tokens, std::move(context)
+            );
+        });
         
     } catch (const std::runtime_error& e) {
         std::cerr << "[LLM] Session chat error: " << e.what() << std::endl;
-        return error_response(503, e.what());
+        return end_with_error(*out, 503, e.what());
     } catch (const std::exception& e) {
         std::cerr << "[LLM] Session chat error: " << e.what() << std::endl;
-        return error_response(500, "Internal server error");
+        return end_with_error(*out, 500, "Internal server error");
+    }
+}
+
+void LLMHandler::end_with_json(ResponseStream& out, int status, const nlohmann::json& data, ResponseHeaders headers) {
+    headers.emplace_back("Content-Type", "application/json");
+    out.begin(status, headers);
+    out.write(data.dump());
+    out.end();
+}
+
+void LLMHandler::end_with_error(ResponseStream& out, int status, const std::string& detail) {
+    end_with_json(out, status, {{"detail", detail}});
+}
+
+void LLMHandler::end_with_exception(ResponseStream& out, std::exception_ptr error, const std::string& context) {
+    try {
+        std::rethrow_exception(error);
+    } catch (const AdmissionRejected& e) {
+        end_with_json(out, 429, {{"detail", e.what()}}, {{"Retry-After", std::to_string(e.retry_after())}});
+    } catch (const DeadlineExceeded& e) {
+        std::cerr << "[LLM] " << context << " error: " << e.what() << std::endl;
+        end_with_error(out, 504, e.what());
+    } catch (const std::runtime_error& e) {
+        std::cerr << "[LLM] " << context << " error: " << e.what() << std::endl;
+        end_with_error(out, 503, e.what());
+    } catch (const std::exception& e) {
+        std::cerr << "[LLM] " << context << " error: " << e.what() << std::endl;
+        end_with_error(out, 500, "Internal server error");
     }
 }
 
-crow::response LLMHandler::chat_stream(const crow::request& req) {
+void LLMHandler::admit_then(
+    std::shared_ptr<ResponseStream> out,
+    int user_id,
+    const std::string& context,
+    std::function<void(AdmissionController::TicketPtr, RequestContext)> start
+) {
+    RequestContext request;
+    request.user = std::to_string(user_id);
+    request.deadline = std::chrono::steady_clock::now() + std::chrono::seconds(get_config().llm.timeout);
+    AdmissionController::instance().admit(std::to_string(user_id), 1.0,
+        [out, context, request, start = std::move(start)](std::exception_ptr error, AdmissionController::TicketPtr ticket) {
+            if (error) {
+                return end_with_exception(*out, error, context);
+            }
+            try {
+                start(std::move(ticket), request);
+            } catch (...) {
+                end_with_exception(*out, std::current_exception(), context);
+            }
+        });
+}
+
+void LLMHandler::chat_stream(const crow::request& req, crow::response& res) {
+    chat_stream(req.get_header_value("Authorization"), req.body, std::make_shared<BufferedResponse>(res));
+}
+
+void LLMHandler::chat_stream(const std::string& auth_header, const std::string& request_body, std::shared_ptr<ResponseStream> out) {
     try {
         // Authenticate user
-        std::string auth_header = req.get_header_value("Authorization");
         auto user = Auth::instance().get_current_user(auth_header);
         
         if (!user) {
-            return error_response(401, "Could not validate credentials");
+            return end_with_error(*out, 401, "Could not validate credentials");
         }
         
-        auto body = nlohmann::json::parse(req.body);
+        auto body = nlohmann::json::parse(request_body);
         
         // Parse messages
         if (!body.contains("messages") || !body["messages"].is_array()) {
-            return error_response(400, "messages array is required");
+            return end_with_error(*out, 400, "messages array is required");
         }
         
         std::vector<ChatMessage> messages;
@@ -187,53 +266,72 @@ crow::response LLMHandler::chat_stream(const crow::request& req) {
         
         std::string model = body.value("model", "default");
         
-        // Generate response (for now, non-streaming wrapped as SSE)
-        auto& client = get_llm_client();
-        
-        std::ostringstream sse_stream;
-        
-        client.generate_stream(messages, [&sse_stream](const std::string& chunk) {
-            nlohmann::json chunk_data = {{"content", chunk}};
-            sse_stream << "data: " << chunk_data.dump() << "\n\n";
-        }, temperature, top_p, max_tokens, model);
-        
-        // Send done signal
-        nlohmann::json done = {{"done", true}};
-        sse_stream << "data: " << done.dump() << "\n\n";
-        
-        crow::response res(200, sse_stream.str());
-        res.set_header("Content-Type", "text/event-stream");
-        res.set_header("Cache-Control", "no-cache");
-        res.set_header("Connection", "keep-alive");
-        return res;
+        // Closing the connection stops the generation, or keeps it from starting
+        auto cancel = std::make_shared<CancellationToken>();
+        out->on_disconnect([cancel]() { cancel->cancel(); });
+        
+        // A rejected request gets a plain 429; the SSE stream only starts once admitted
+        admit_then(out, user->id, "Stream", [out, cancel, messages, temperature, top_p, max_tokens, model](AdmissionController::TicketPtr ticket, RequestContext context) {
+            if (cancel->cancelled()) {
+                ticket->release();
+                return out->end();
+            }
+            // The writer outlives this call; the last upstream callback completes out
+            auto sse = std::make_shared<SseWriter>(out);
+            context.cancel = cancel;
+            
+            get_llm_client().generate_stream_async(
+                messages,
+                [sse, cancel](const std::string& chunk) {
+                    // Also catches a disconnect the transport could not report
+                    if (!sse->send({{"content", chunk}})) {
+                        cancel->cancel();
+                    }
+                },
+                [sse, ticket](std::exception_ptr error) {
+                    ticket->release();
+                    if (error) {
+                        sse->send({{"content", "Error: " + describe(error)}});
+                    }
+                    
+                    // Send done signal
+                    sse->send({{"done", true}});
+                    sse->close();
+                },
+                temperature, top_p, max_tokens, model, std::move(context)
+            );
+        });
         
     } catch (const std::runtime_error& e) {
         std::cerr << "[LLM] Stream error: " << e.what() << std::endl;
-        return error_response(503, e.what());
+        end_with_error(*out, 503, e.what());
     } catch (const std::exception& e) {
         std::cerr << "[LLM] Stream error: " << e.what() << std::endl;
-        return error_response(500, "Internal server error");
+        end_with_error(*out, 500, "Internal server error");
     }
 }
 
-crow::response LLMHandler::session_chat_stream(const crow::request& req) {
+void LLMHandler::session_chat_stream(const crow::request& req, crow::response& res) {
+    session_chat_stream(req.get_header_value("Authorization"), req.body, std::make_shared<BufferedResponse>(res));
+}
+
+void LLMHandler::session_chat_stream(const std::string& auth_header, const std::string& request_body, std::shared_ptr<ResponseStream> out) {
     try {
         // Authenticate user
-        std::string auth_header = req.get_header_value("Authorization");
         auto user = Auth::instance().get_current_user(auth_header);
         
         if (!user) {
-            return error_response(401, "Could not validate credentials");
+            return end_with_error(*out, 401, "Could not validate credentials");
         }
         
-        auto body = nlohmann::json::parse(req.body);
+        auto body = nlohmann::json::parse(request_body);
         
         std::string session_id = body.value("session_id", "");
         std::string message = body.value("message", "");
         std::string system_prompt = body.value("system_prompt", "You are a helpful AI assistant.");
         
         if (session_id.empty() || message.empty()) {
-            return error_response(400, "session_id and message are required");
+            return end_with_error(*out, 400, "session_id and message are required");
         }
         
         // Optional parameters
@@ -251,35 +349,124 @@ crow::response LLMHandler::session_chat_stream(const crow::request& req) {
             max_tokens = body["max_tokens"].get<int>();
         }
         
-        auto& session_manager = get_session_manager();
+        auto cancel = std::make_shared<CancellationToken>();
+        out->on_disconnect([cancel]() { cancel->cancel(); });
+        
+        admit_then(out, user->id, "Session stream", [out, cancel, session_id, system_prompt, message, temperature, top_p, max_tokens](AdmissionController::TicketPtr ticket, RequestContext context) {
+            if (cancel->cancelled()) {
+                ticket->release();
+                return out->end();
+            }
+            // The writer outlives this call; the last upstream callback completes out
+            auto sse = std::make_shared<SseWriter>(out);
+            context.cancel = cancel;
+            
+            get_session_manager().process_message_stream_async(
+                session_id, system_prompt, message,
+                [sse, cancel, session_id](const std::string& chunk) {
+                    if (!sse->send({{"content", chunk}, {"session_id", session_id}})) {
+                        cancel->cancel();
+                    }
+                },
+                [sse, session_id, ticket](std::exception_ptr error) {
+                    ticket->release();
+                    if (error) {
+                        sse->send({{"content", "Error: " + describe(error)}, {"session_id", session_id}});
+                    }
+                    
+                    // Send done signal
+                    sse->send({{"done", true}, {"session_id", session_id}});
+                    sse->close();
+                },
+                temperature, top_p, max_tokens, std::move(context)
+            );
+        });
+        
+    } catch (const std::runtime_error& e) {
+        std::cerr << "[LLM] Session stream error: " << e.what() << std::endl;
+        end_with_error(*out, 503, e.what());
+    } catch (const std::exception& e) {
+        std::cerr << "[LLM] Session stream error: " << e.what() << std::endl;
+        end_with_error(*out, 500, "Internal server error");
+    }
+}
+
+void LLMHandler::chat_batch(const crow::request& req, crow::response& res) {
+    chat_batch(req.get_header_value("Authorization"), req.body, std::make_shared<BufferedResponse>(res));
+}
+
+void LLMHandler::chat_batch(const std::string& auth_header, const std::string& request_body, std::shared_ptr<ResponseStream> out) {
+    try {
+        // Authenticate user
+        auto user = Auth::instance().get_current_user(auth_header);
         
-        std::ostringstream sse_stream;
+        if (!user) {
+            return end_with_error(*out, 401, "Could not validate credentials");
+        }
         
-        session_manager.process_message_stream(
-            session_id, system_prompt, message,
-            [&sse_stream, &session_id](const std::string& chunk) {
-                nlohmann::json chunk_data = {{"content", chunk}, {"session_id", session_id}};
-                sse_stream << "data: " << chunk_data.dump() << "\n\n";
-            },
-            temperature, top_p, max_tokens
-        );
+        auto body = nlohmann::json::parse(request_body);
+        const auto& llm_config = get_config().llm;
         
-        // Send done signal
-        nlohmann::json done = {{"done", true}, {"session_id", session_id}};
-        sse_stream << "data: " << done.dump() << "\n\n";
+        if (!body.contains("requests") || !body["requests"].is_array() || body["requests"].empty()) {
+            return end_with_error(*out, 400, "requests array is required");
+        }
+        if (body["requests"].size() > static_cast<size_t>(llm_config.batch_max_items)) {
+            return end_with_error(*out, 400, "At most " + std::to_string(llm_config.batch_max_items) + " requests per batch");
+        }
         
-        crow::response res(200, sse_stream.str());
-        res.set_header("Content-Type", "text/event-stream");
-        res.set_header("Cache-Control", "no-cache");
-        res.set_header("Connection", "keep-alive");
-        return res;
+        // Top-level parameters are the defaults for every item
+        BatchRunner::Item defaults;
+        if (body.contains("temperature") && !body["temperature"].is_null()) {
+            defaults.temperature = body["temperature"].get<double>();
+        }
+        if (body.contains("top_p") && !body["top_p"].is_null()) {
+            defaults.top_p = body["top_p"].get<double>();
+        }
+        if (body.contains("max_tokens") && !body["max_tokens"].is_null()) {
+            defaults.max_tokens = body["max_tokens"].get<int>();
+        }
+        defaults.model = body.value("model", "default");
+        
+        std::vector<BatchRunner::Item> items;
+        items.reserve(body["requests"].size());
+        for (const auto& entry : body["requests"]) {
+            BatchRunner::Item item = defaults;
+            const nlohmann::json* messages = &entry;
+            if (entry.is_object()) {
+                static const nlohmann::json no_messages = nlohmann::json::array();
+                messages = entry.contains("messages") ? &entry["messages"] : &no_messages;
+                if (entry.contains("temperature") && !entry["temperature"].is_null()) {
+                    item.temperature = entry["temperature"].get<double>();
+                }
+                if (entry.contains("top_p") && !entry["top_p"].is_null()) {
+                    item.top_p = entry["top_p"].get<double>();
+                }
+                if (entry.contains("max_tokens") && !entry["max_tokens"].is_null()) {
+                    item.max_tokens = entry["max_tokens"].get<int>();
+                }
+                item.model = entry.value("model", item.model);
+            }
+            for (const auto& msg : *messages) {
+                item.messages.push_back({msg.value("role", "user"), msg.value("content", "")});
+            }
+            if (item.messages.empty()) {
+                return end_with_error(*out, 400, "requests[" + std::to_string(items.size()) + "] has no messages");
+            }
+            items.push_back(std::move(item));
+        }
+        
+        // Every item in flight may sit in the user's admission queue, so stay under
+        // max_queue_per_user and leave the user room for an interactive chat
+        int max_parallel = std::min(llm_config.batch_max_parallel, llm_config.max_queue_per_user - 1);
+        int parallelism = std::clamp(body.value("parallelism", max_parallel), 1, std::max(1, max_parallel));
+        BatchRunner::start(out, user->id, std::move(items), static_cast<size_t>(parallelism), body.value("stream", false));
         
     } catch (const std::runtime_error& e) {
-        std::cerr << "[LLM] Session stream error: " << e.what() << std::endl;
-        return error_response(503, e.what());
+        std::cerr << "[LLM] Batch error: " << e.what() << std::endl;
+        end_with_error(*out, 503, e.what());
     } catch (const std::exception& e) {
-        std::cerr << "[LLM] Session stream error: " << e.what() << std::endl;
-        return error_response(500, "Internal server error");
+        std::cerr << "[LLM] Batch error: " << e.what() << std::endl;
+        end_with_error(*out, 500, "Internal server error");
     }
 }
 
@@ -302,7 +489,7 @@ crow::response LLMHandler::get_session_history(const crow::request& req, const s
         
         nlohmann::json messages = nlohmann::json::array();
         for (const auto& msg : *history) {
-            messages.push_back({{"role", msg.role}, {"content", msg.content}});
+            messages.push_back({{"role", msg->role}, {"content", msg->content}});
         }
         
         nlohmann::json result = {
@@ -344,7 +531,7 @@ crow::response LLMHandler::post_session_history(const crow::request& req) {
         
         nlohmann::json messages = nlohmann::json::array();
         for (const auto& msg : *history) {
-            messages.push_back({{"role", msg.role}, {"content", msg.content}});
+            messages.push_back({{"role", msg->role}, {"content", msg->content}});
         }
         
         nlohmann::json result = {
@@ -393,6 +580,7 @@ crow::response LLMHandler::health() {
         nlohmann::json result = {
             {"status", client.is_available() ? "ok" : "unavailable"},
             {"server_url", client.server_url()},
+            {"upstreams", client.upstream_stats()},
             {"temperature", client.default_temperature()},
             {"max_tokens", client.default_max_tokens()}
         };
@@ -406,6 +594,53 @@ crow::response LLMHandler::health() {
     }
 }
 
+crow::response LLMHandler::metrics(const crow::request& req) {
+    try {
+        if (!Auth::instance().get_current_user(req.get_header_value("Authorization"))) {
+            return error_response(401, "Could not validate credentials");
+        }
+        
+        nlohmann::json result = {
+            {"upstreams", get_llm_client().upstream_stats()},
+            {"coalesced_requests", get_llm_client().coalesced_requests()},
+            {"upstream_waits", get_llm_client().upstream_waits()},
+            {"completion_cache", get_llm_client().completion_cache_stats()},
+            {"prompt_cache", get_llm_client().prompt_cache_stats()},
+            {"admission", AdmissionController::instance().stats()},
+            {"cancellation", get_llm_client().cancellation_stats()},
+            {"hedging", get_llm_client().hedging_stats()},
+            {"sessions", get_session_manager().stats()},
+            {"connection_pools", HttpClient::instance().stats()},
+            {"stream_server", StreamServer::instance().stats()}
+        };
+        
+        return json_response(200, result);
+        
+    } catch (const std::exception& e) {
+        std::cerr << "[LLM] Metrics error: " << e.what() << std::endl;
+        return error_response(500, "Internal server error");
+    }
+}
+
+crow::response LLMHandler::usage(const crow::request& req) {
+    try {
+        auto user = Auth::instance().get_current_user(req.get_header_value("Authorization"));
+        if (!user) {
+            return error_response(401, "Could not validate credentials");
+        }
+        const auto& admins = get_config().auth.admin_emails;
+        if (std::find(admins.begin(), admins.end(), user->email) == admins.end()) {
+            return error_response(403, "Not enough permissions");
+        }
+        
+        return json_response(200, UsageAccounting::instance().stats());
+        
+    } catch (const std::exception& e) {
+        std::cerr << "[LLM] Usage error: " << e.what() << std::endl;
+        return error_response(500, "Internal server error");
+    }
+}
+
 } // namespace handlers
 } // namespace prompt_portal
 
@@ -0,0 +1,37 @@
+#include "handlers/sse_writer.hpp"
+
+namespace prompt_portal {
+namespace handlers {
+
+SseWriter::SseWriter(std::shared_ptr<ResponseStream> out) : out_(std::move(out)) {
+    out_->begin(200, {
+        {"Content-Type", "text/event-stream"},
+        {"Cache-Control", "no-cache"},
+        {"X-Accel-Buffering", "no"}
+    });
+}
+
+bool SseWriter::send(const nlohmann::json& event) {
+    if (closed_) {
+        return false;
+    }
+    
+    std::string frame = "data: ";
+    frame += event.dump();
+    frame += "\n\n";
+    return out_->write(std::move(frame));
+}
+
+bool SseWriter::client_connected() {
+    return out_->client_connected();
+}
+
+void SseWriter::close() {
+    if (!closed_) {
+        closed_ = true;
+        out_->end();
+    }
+}
+
+} // namespace handlers
+} // namespace prompt_portal
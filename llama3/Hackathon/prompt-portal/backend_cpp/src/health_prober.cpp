@@ -0,0 +1,65 @@
+#include "health_prober.hpp"
+#include "http_client.hpp"
+#include <iostream>
+#include <algorithm>
+
+namespace prompt_portal {
+
+std::shared_ptr<HealthProber> HealthProber::start(std::shared_ptr<UpstreamSet> upstreams, const LlmConfig& config) {
+    if (config.health_check_interval_ms <= 0) {
+        return nullptr;
+    }
+    std::shared_ptr<HealthProber> prober(new HealthProber(std::move(upstreams), config));
+    std::cout << "[LLM] Probing " << prober->path_ << " every " << prober->interval_.count() << "ms" << std::endl;
+    prober->probe_all();
+    asio::post(prober->timer_.get_executor(), [prober]() { prober->schedule(); });
+    return prober;
+}
+
+HealthProber::HealthProber(std::shared_ptr<UpstreamSet> upstreams, const LlmConfig& config)
+    : upstreams_(std::move(upstreams)),
+      path_(config.health_check_path),
+      interval_(config.health_check_interval_ms),
+      timeout_(std::max(1, config.health_check_timeout_ms)),
+      timer_(asio::make_strand(HttpClient::instance().io_context())) {}
+
+void HealthProber::stop() {
+    asio::post(timer_.get_executor(), [self = shared_from_this()]() {
+        self->stopped_ = true;
+        self->timer_.cancel();
+    });
+}
+
+// Runs on the timer's strand
+void HealthProber::schedule() {
+    if (stopped_) return;
+    timer_.expires_after(interval_);
+    timer_.async_wait([self = shared_from_this()](const asio::error_code& ec) {
+        if (ec || self->stopped_) return;
+        self->probe_all();
+        self->schedule();
+    });
+}
+
+void HealthProber::probe_all() {
+    for (const auto& upstream : upstreams_->upstreams()) {
+        probe(*upstream);
+    }
+}
+
+void HealthProber::probe(UpstreamSet::Upstream& upstream) {
+    HttpDeadlines deadlines;
+    deadlines.connect = timeout_;
+    deadlines.first_byte = timeout_;
+    deadlines.idle = timeout_;
+    deadlines.total = std::chrono::steady_clock::now() + timeout_;
+
+    // Holding the set keeps upstream alive until the probe reports
+    HttpClient::instance().async_get(upstream.url + path_, deadlines,
+        [upstreams = upstreams_, &upstream](std::exception_ptr error, HttpResponse response) {
+            // llama-server answers 503 while it is still loading the model
+            upstreams->report_probe(upstream, !error && response.status == 200);
+        });
+}
+
+} // namespace prompt_portal
@@ -0,0 +1,183 @@
+#include "hedging.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace prompt_portal {
+
+// =====================
+// LatencyWindow
+// =====================
+
+void LatencyWindow::record(std::chrono::steady_clock::duration elapsed) {
+    int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (samples_.size() < kCapacity) {
+        samples_.push_back(us);
+    } else {
+        samples_[next_] = us;
+        next_ = (next_ + 1) % kCapacity;
+    }
+    if (++since_refresh_ < kRefreshEvery || samples_.size() < kMinSamples) {
+        return;
+    }
+    since_refresh_ = 0;
+
+    std::vector<int64_t> sorted(samples_);
+    auto rank = static_cast<size_t>(quantile_ * static_cast<double>(sorted.size() - 1));
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    percentile_us_.store(sorted[rank], std::memory_order_relaxed);
+}
+
+// =====================
+// HedgePolicy
+// =====================
+
+HedgePolicy::HedgePolicy(const LlmConfig& config)
+    : enabled_(config.hedge_requests),
+      min_delay_(std::chrono::milliseconds(std::max(0, config.hedge_min_delay_ms))),
+      deposit_milli_(std::clamp(config.hedge_budget_percent, 0, 100) * kMilli / 100),
+      first_token_(std::clamp(config.hedge_percentile, 0.0, 1.0)),
+      completion_(std::clamp(config.hedge_percentile, 0.0, 1.0)) {}
+
+std::optional<std::chrono::microseconds> HedgePolicy::on_request(bool stream) {
+    int64_t budget = budget_milli_.load(std::memory_order_relaxed);
+    while (budget < kMaxBurst
+           && !budget_milli_.compare_exchange_weak(budget, std::min(kMaxBurst, budget + deposit_milli_),
+                                                   std::memory_order_relaxed)) {}
+
+    int64_t us = (stream ? first_token_ : completion_).percentile_us();
+    if (us <= 0) {
+        return std::nullopt;
+    }
+    return std::max(min_delay_, std::chrono::microseconds(us));
+}
+
+void HedgePolicy::observe(bool stream, std::chrono::steady_clock::duration elapsed) {
+    (stream ? first_token_ : completion_).record(elapsed);
+}
+
+bool HedgePolicy::try_spend() {
+    int64_t budget = budget_milli_.load(std::memory_order_relaxed);
+    do {
+        if (budget < kMilli) {
+            over_budget_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    } while (!budget_milli_.compare_exchange_weak(budget, budget - kMilli, std::memory_order_relaxed));
+    return true;
+}
+
+nlohmann::json HedgePolicy::stats() const {
+    return {
+        {"enabled", enabled_},
+        {"hedged", hedged_.load(std::memory_order_relaxed)},
+        {"hedges_won", hedges_won_.load(std::memory_order_relaxed)},
+        {"over_budget", over_budget_.load(std::memory_order_relaxed)},
+        {"budget", static_cast<double>(budget_milli_.load(std::memory_order_relaxed)) / kMilli},
+        {"first_token_delay_ms", first_token_.percentile_us() / 1000.0},
+        {"completion_delay_ms", completion_.percentile_us() / 1000.0}
+    };
+}
+
+// =====================
+// HedgedRace
+// =====================
+
+std::shared_ptr<HedgedRace> HedgedRace::create(asio::io_context& io, std::shared_ptr<CancellationToken> parent) {
+    std::shared_ptr<HedgedRace> race(new HedgedRace(io));
+    if (parent) {
+        parent->on_cancel([weak = std::weak_ptr<HedgedRace>(race)]() {
+            auto race = weak.lock();
+            if (!race) return;
+            std::vector<std::shared_ptr<CancellationToken>> attempts;
+            std::function<void()> launch_hedge;
+            {
+                std::lock_guard<std::mutex> lock(race->mutex_);
+                race->cancelled_ = true;
+                launch_hedge.swap(race->launch_hedge_);
+                attempts.assign(race->attempts_.begin(), race->attempts_.begin() + race->launched_);
+            }
+            for (auto& attempt : attempts) {
+                attempt->cancel();
+            }
+        });
+    }
+    return race;
+}
+
+HedgedRace::HedgedRace(asio::io_context& io)
+    : timer_(io), started_(std::chrono::steady_clock::now()) {}
+
+std::shared_ptr<CancellationToken> HedgedRace::add_attempt(int& attempt) {
+    auto token = std::make_shared<CancellationToken>();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (winner_ >= 0 || cancelled_ || launched_ >= static_cast<int>(attempts_.size())) {
+        return nullptr;
+    }
+    attempt = launched_;
+    attempts_[launched_++] = token;
+    ++pending_;
+    return token;
+}
+
+void HedgedRace::arm(std::chrono::microseconds delay, std::function<void()> launch_hedge) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        launch_hedge_ = std::move(launch_hedge);
+    }
+    // Never cancelled, since claims run on other threads; a decided race just ignores it
+    timer_.expires_after(delay);
+    timer_.async_wait([self = shared_from_this()](const asio::error_code& ec) {
+        std::function<void()> launch;
+        {
+            std::lock_guard<std::mutex> lock(self->mutex_);
+            launch.swap(self->launch_hedge_);
+            if (ec || self->winner_ >= 0 || self->pending_ == 0 || self->launched_ >= 2) return;
+        }
+        if (launch) launch();
+    });
+}
+
+bool HedgedRace::claim(int attempt) {
+    std::vector<std::shared_ptr<CancellationToken>> losers;
+    std::function<void()> launch_hedge;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (winner_ >= 0) return winner_ == attempt;
+        losers = take_losers(attempt, launch_hedge);
+    }
+    for (auto& loser : losers) {
+        loser->cancel();
+    }
+    return true;
+}
+
+bool HedgedRace::settle(int attempt, bool failed) {
+    std::vector<std::shared_ptr<CancellationToken>> losers;
+    std::function<void()> launch_hedge;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --pending_;
+        if (winner_ >= 0) return winner_ == attempt;
+        // Another attempt may still succeed where this one failed
+        if (failed && pending_ > 0) return false;
+        losers = take_losers(attempt, launch_hedge);
+    }
+    for (auto& loser : losers) {
+        loser->cancel();
+    }
+    return true;
+}
+
+std::vector<std::shared_ptr<CancellationToken>> HedgedRace::take_losers(int winner, std::function<void()>& launch_hedge) {
+    winner_ = winner;
+    // Destroyed by the caller after unlocking, since it holds a reference to this race
+    launch_hedge.swap(launch_hedge_);
+    std::vector<std::shared_ptr<CancellationToken>> losers;
+    for (int i = 0; i < launched_; ++i) {
+        if (i != winner) losers.push_back(attempts_[i]);
+    }
+    return losers;
+}
+
+} // namespace prompt_portal
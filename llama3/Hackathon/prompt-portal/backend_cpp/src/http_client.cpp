@@ -0,0 +1,692 @@
+#include "http_client.hpp"
+#include "http_response_parser.hpp"
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <string_view>
+
+#ifndef _WIN32
+    #include <sys/socket.h>
+#endif
+
+namespace prompt_portal {
+
+UrlParts parse_url(const std::string& url) {
+    UrlParts parts;
+    parts.port = 80;
+    parts.path = "/";
+
+    std::string work = url;
+
+    // Remove protocol
+    if (work.find("http://") == 0) {
+        work = work.substr(7);
+    } else if (work.find("https://") == 0) {
+        work = work.substr(8);
+        parts.port = 443;
+    }
+
+    // Find path
+    size_t path_pos = work.find('/');
+    if (path_pos != std::string::npos) {
+        parts.path = work.substr(path_pos);
+        work = work.substr(0, path_pos);
+    }
+
+    // Find port
+    size_t port_pos = work.find(':');
+    if (port_pos != std::string::npos) {
+        parts.port = std::stoi(work.substr(port_pos + 1));
+        work = work.substr(0, port_pos);
+    }
+
+    parts.host = work;
+    return parts;
+}
+
+const char* HttpDeadlines::phase_name(Phase phase) {
+    switch (phase) {
+        case Phase::Connect: return "connect";
+        case Phase::FirstByte: return "first_byte";
+        case Phase::Idle: return "inter_token";
+        case Phase::Total: return "total";
+    }
+    return "unknown";
+}
+
+DeadlineExceeded::DeadlineExceeded(HttpDeadlines::Phase phase, const std::string& target)
+    : std::runtime_error("Request to " + target + " exceeded its " + HttpDeadlines::phase_name(phase) + " deadline"),
+      phase_(phase) {}
+
+namespace {
+
+// True if the peer has closed an idle keep-alive socket (or sent unexpected data).
+bool is_stale(asio::ip::tcp::socket& socket) {
+    asio::error_code ec;
+    if (socket.available(ec) > 0 || ec) return true;
+    #ifndef _WIN32
+    char c;
+    ssize_t n = ::recv(socket.native_handle(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n == 0) return true;
+    #endif
+    return false;
+}
+
+std::exception_ptr make_error(const std::string& message) {
+    return std::make_exception_ptr(std::runtime_error(message));
+}
+
+/**
+ * Happy-eyeballs connect (RFC 8305): attempts start in resolver order, each one
+ * attempt_delay after the previous or as soon as it fails. The first socket to
+ * connect wins and the rest are closed.
+ */
+class HappyEyeballsConnect : public std::enable_shared_from_this<HappyEyeballsConnect> {
+public:
+    using Socket = asio::ip::tcp::socket;
+    using Callback = std::function<void(const asio::error_code& ec, std::unique_ptr<Socket> socket, size_t index)>;
+
+    HappyEyeballsConnect(
+        asio::io_context& io,
+        std::shared_ptr<const DnsCache::Endpoints> endpoints,
+        std::chrono::milliseconds attempt_delay,
+        Callback on_done
+    ) : io_(io),
+        strand_(asio::make_strand(io)),
+        timer_(strand_),
+        endpoints_(std::move(endpoints)),
+        attempt_delay_(attempt_delay),
+        on_done_(std::move(on_done)) {}
+
+    void start() {
+        auto self = shared_from_this();
+        asio::post(strand_, [self] { self->launch_next(); });
+    }
+
+private:
+    asio::io_context& io_;
+    asio::strand<asio::io_context::executor_type> strand_;
+    asio::steady_timer timer_;
+    std::shared_ptr<const DnsCache::Endpoints> endpoints_;
+    std::chrono::milliseconds attempt_delay_;
+    Callback on_done_;
+
+    std::vector<std::unique_ptr<Socket>> attempts_;
+    size_t next_ = 0;
+    int pending_ = 0;
+    bool done_ = false;
+    asio::error_code last_error_ = asio::error::host_not_found;
+
+    void launch_next() {
+        if (done_ || next_ >= endpoints_->size()) return;
+
+        size_t index = next_++;
+        attempts_.push_back(std::make_unique<Socket>(io_));
+        ++pending_;
+
+        auto self = shared_from_this();
+        attempts_[index]->async_connect((*endpoints_)[index],
+            asio::bind_executor(strand_, [self, index](const asio::error_code& ec) {
+                self->on_attempt(ec, index);
+            }));
+
+        if (next_ < endpoints_->size()) {
+            timer_.expires_after(attempt_delay_);
+            timer_.async_wait(asio::bind_executor(strand_, [self](const asio::error_code& ec) {
+                if (!ec) self->launch_next();
+            }));
+        }
+    }
+
+    void on_attempt(const asio::error_code& ec, size_t index) {
+        --pending_;
+        if (done_) return;
+
+        if (!ec) {
+            done_ = true;
+            timer_.cancel();
+            auto winner = std::move(attempts_[index]);
+            for (auto& attempt : attempts_) {
+                asio::error_code ignored;
+                if (attempt) attempt->close(ignored);
+            }
+            return on_done_({}, std::move(winner), index);
+        }
+
+        last_error_ = ec;
+        if (next_ < endpoints_->size()) {
+            // Don't wait out the stagger once an attempt has already failed
+            timer_.cancel();
+            return launch_next();
+        }
+        if (pending_ == 0) {
+            done_ = true;
+            on_done_(last_error_, nullptr, index);
+        }
+    }
+};
+
+/**
+ * One request/response on a pooled connection. All handlers run on the
+ * exchange's strand, so the timeout and the socket callbacks never race.
+ */
+class HttpExchange : public std::enable_shared_from_this<HttpExchange> {
+public:
+    HttpExchange(
+        asio::io_context& io,
+        ConnectionPool& pool,
+        std::string request,
+        std::string target,
+        const HttpDeadlines& deadlines,
+        HttpClient::BodyCallback on_body,
+        HttpClient::ResponseCallback on_done
+    ) : strand_(asio::make_strand(io)),
+        phase_timer_(strand_),
+        total_timer_(strand_),
+        pool_(pool),
+        request_(std::move(request)),
+        target_(std::move(target)),
+        deadlines_(deadlines),
+        on_body_(std::move(on_body)),
+        on_done_(std::move(on_done)) {}
+
+    void start(const std::shared_ptr<CancellationToken>& cancel) {
+        auto self = shared_from_this();
+        if (deadlines_.total != std::chrono::steady_clock::time_point::max()) {
+            total_timer_.expires_at(deadlines_.total);
+            total_timer_.async_wait([self](const asio::error_code& ec) {
+                if (!ec) self->expire(HttpDeadlines::Phase::Total);
+            });
+        }
+        if (cancel) {
+            std::weak_ptr<HttpExchange> weak = self;
+            cancel->on_cancel([weak]() {
+                if (auto exchange = weak.lock()) {
+                    asio::post(exchange->strand_, [exchange]() {
+                        exchange->finish(std::make_exception_ptr(RequestCancelled()));
+                    });
+                }
+            });
+        }
+        asio::post(strand_, [self]() { self->acquire(); });
+    }
+
+private:
+    static constexpr size_t kInitialBuffer = 16 * 1024;
+    static constexpr size_t kMaxBuffer = 256 * 1024;
+
+    asio::strand<asio::io_context::executor_type> strand_;
+    asio::steady_timer phase_timer_;
+    asio::steady_timer total_timer_;
+    ConnectionPool& pool_;
+    std::string request_;
+    std::string target_;
+    HttpDeadlines deadlines_;
+    HttpClient::BodyCallback on_body_;
+    HttpClient::ResponseCallback on_done_;
+
+    ConnectionPool::Connection conn_;
+    HttpResponseParser parser_;
+    HttpResponse response_;
+    bool finished_ = false;
+    bool received_any_ = false;
+    bool leftover_ = false;
+    std::exception_ptr body_error_;
+    int attempt_ = 0;
+
+    // Restarts the phase timer; re-arming cancels the previous phase's wait
+    void arm_phase(HttpDeadlines::Phase phase, std::chrono::milliseconds limit) {
+        if (limit == std::chrono::milliseconds::max()) {
+            phase_timer_.cancel();
+            return;
+        }
+        auto self = shared_from_this();
+        phase_timer_.expires_after(limit);
+        phase_timer_.async_wait([self, phase](const asio::error_code& ec) {
+            if (!ec) self->expire(phase);
+        });
+    }
+
+    void expire(HttpDeadlines::Phase phase) {
+        finish(std::make_exception_ptr(DeadlineExceeded(phase, target_)));
+    }
+
+    void acquire() {
+        arm_phase(HttpDeadlines::Phase::Connect, deadlines_.connect);
+        auto self = shared_from_this();
+        pool_.acquire([self](std::exception_ptr error, ConnectionPool::Connection conn) {
+            asio::post(self->strand_, [self, error, conn = std::make_shared<ConnectionPool::Connection>(std::move(conn))]() {
+                self->on_connection(error, std::move(*conn));
+            });
+        });
+    }
+
+    void on_connection(std::exception_ptr error, ConnectionPool::Connection conn) {
+        if (finished_) {
+            // Timed out while queued for a connection; the socket is still clean
+            if (conn.socket) pool_.release(std::move(conn), true);
+            return;
+        }
+        if (error) {
+            return finish(error);
+        }
+
+        conn_ = std::move(conn);
+        if (conn_.buffer.size() < kInitialBuffer) conn_.buffer.resize(kInitialBuffer);
+        arm_phase(HttpDeadlines::Phase::FirstByte, deadlines_.first_byte);
+
+        auto self = shared_from_this();
+        asio::async_write(*conn_.socket, asio::buffer(request_),
+            asio::bind_executor(strand_, [self](const asio::error_code& ec, size_t) {
+                if (self->finished_) return;
+                if (ec) return self->retry_or_fail("Failed to send request: " + ec.message());
+                self->read();
+            }));
+    }
+
+    // A reused socket may have been closed by the server in the meantime;
+    // that only shows up on send/recv, so retry once on a fresh connection.
+    void retry_or_fail(const std::string& message) {
+        if (conn_.reused && !received_any_ && attempt_ == 0) {
+            ++attempt_;
+            pool_.release(std::move(conn_), false);
+            conn_ = {};
+            parser_.reset();
+            return acquire();
+        }
+        fail(message);
+    }
+
+    void read() {
+        auto self = shared_from_this();
+        conn_.socket->async_read_some(asio::buffer(conn_.buffer),
+            asio::bind_executor(strand_, [self](const asio::error_code& ec, size_t n) {
+                if (self->finished_) return;
+                self->on_read(ec, n);
+            }));
+    }
+
+    void on_read(const asio::error_code& ec, size_t n) {
+        if (ec) {
+            if (!received_any_) {
+                return retry_or_fail("Connection to " + target_ + " closed without response");
+            }
+            if (ec != asio::error::eof) {
+                return fail("Truncated HTTP response: " + ec.message());
+            }
+            try {
+                parser_.finish_eof();
+            } catch (const std::exception& e) {
+                return fail(e.what());
+            }
+            return finish(nullptr);
+        }
+
+        received_any_ = true;
+        arm_phase(HttpDeadlines::Phase::Idle, deadlines_.idle);
+        size_t consumed = 0;
+        try {
+            // Body bytes are handed over straight from the read buffer
+            consumed = parser_.feed(conn_.buffer.data(), n, [this](const char* data, size_t len) {
+                deliver(data, len);
+            });
+        } catch (const std::exception& e) {
+            return fail(e.what());
+        }
+        if (body_error_) return finish(body_error_);
+
+        if (parser_.complete()) {
+            leftover_ = consumed < n;
+            return finish(nullptr);
+        }
+
+        // A full read suggests a large body; read bigger slices from now on
+        if (n == conn_.buffer.size() && conn_.buffer.size() < kMaxBuffer) {
+            conn_.buffer.resize(conn_.buffer.size() * 2);
+        }
+        read();
+    }
+
+    void deliver(const char* data, size_t len) {
+        if (body_error_) return;
+        int status = parser_.status();
+        bool success = status >= 200 && status < 300;
+        if (on_body_ && success) {
+            // A throwing body callback aborts the exchange instead of the io thread
+            try {
+                on_body_(data, len);
+            } catch (...) {
+                body_error_ = std::current_exception();
+            }
+        } else {
+            response_.body.append(data, len);
+        }
+    }
+
+    void fail(const std::string& message) {
+        finish(make_error(message));
+    }
+
+    void finish(std::exception_ptr error) {
+        if (finished_) return;
+        finished_ = true;
+        phase_timer_.cancel();
+        total_timer_.cancel();
+
+        response_.status = parser_.status();
+        if (conn_.socket) {
+            bool reusable = !error && parser_.complete() && parser_.keep_alive() && !leftover_;
+            if (!reusable) {
+                asio::error_code ignored;
+                conn_.socket->close(ignored);
+            }
+            pool_.release(std::move(conn_), reusable);
+        }
+
+        auto on_done = std::move(on_done_);
+        try {
+            on_done(error, std::move(response_));
+        } catch (const std::exception& e) {
+            std::cerr << "[HTTP] Completion handler failed: " << e.what() << std::endl;
+        }
+    }
+};
+
+} // anonymous namespace
+
+// =====================
+// ConnectionPool Implementation
+// =====================
+
+ConnectionPool::ConnectionPool(
+    asio::io_context& io,
+    DnsCache& dns,
+    std::string host,
+    int port,
+    int max_connections,
+    int idle_timeout_sec,
+    int connect_attempt_delay_ms
+) : io_(io), dns_(dns), host_(std::move(host)), port_(port),
+    max_connections_(std::max(1, max_connections)),
+    idle_timeout_(idle_timeout_sec),
+    connect_attempt_delay_(std::max(10, connect_attempt_delay_ms)) {}
+
+ConnectionPool::~ConnectionPool() = default;
+
+ConnectionPool::Connection ConnectionPool::take_idle_locked() {
+    // Most recently returned connection first
+    while (!idle_.empty()) {
+        IdleConnection idle = std::move(idle_.back());
+        idle_.pop_back();
+
+        if (std::chrono::steady_clock::now() - idle.idle_since > idle_timeout_ || is_stale(*idle.conn.socket)) {
+            asio::error_code ignored;
+            idle.conn.socket->close(ignored);
+            --open_;
+            expired_++;
+            continue;
+        }
+
+        hits_++;
+        idle.conn.reused = true;
+        return std::move(idle.conn);
+    }
+    return {};
+}
+
+void ConnectionPool::acquire(AcquireCallback on_ready) {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    if (auto idle = take_idle_locked(); idle.socket) {
+        lock.unlock();
+        auto conn = std::make_shared<Connection>(std::move(idle));
+        asio::post(io_, [on_ready = std::move(on_ready), conn]() {
+            on_ready(nullptr, std::move(*conn));
+        });
+        return;
+    }
+
+    if (open_ < max_connections_) {
+        ++open_;
+        lock.unlock();
+        connect_new(std::move(on_ready));
+        return;
+    }
+
+    waits_++;
+    waiters_.push_back(std::move(on_ready));
+}
+
+void ConnectionPool::connect_new(AcquireCallback on_ready) {
+    misses_++;
+
+    dns_.resolve(host_, port_,
+        [this, on_ready](std::exception_ptr error, std::shared_ptr<const DnsCache::Endpoints> endpoints) {
+            if (error) return connect_failed(on_ready, "Failed to resolve hostname: " + host_);
+
+            auto started = std::chrono::steady_clock::now();
+            auto connect = std::make_shared<HappyEyeballsConnect>(io_, endpoints, connect_attempt_delay_,
+                [this, on_ready, started](const asio::error_code& ec, std::unique_ptr<Socket> socket, size_t index) {
+                    if (ec) {
+                        // Every cached address refused; the upstream may have moved
+                        dns_.invalidate(host_, port_);
+                        return connect_failed(on_ready, "Failed to connect to " + host_ + ":" + std::to_string(port_));
+                    }
+
+                    connect_latency_.record(std::chrono::steady_clock::now() - started);
+                    if (index > 0) connect_fallbacks_++;
+
+                    // Requests are small and latency-bound; don't let Nagle hold them back
+                    asio::error_code ignored;
+                    socket->set_option(asio::ip::tcp::no_delay(true), ignored);
+                    on_ready(nullptr, {std::move(socket), false, {}});
+                });
+            connect->start();
+        });
+}
+
+void ConnectionPool::connect_failed(const AcquireCallback& on_ready, const std::string& message) {
+    connect_failures_++;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --open_;
+    }
+    dispatch_waiters();
+    on_ready(make_error(message), {});
+}
+
+void ConnectionPool::release(Connection conn, bool keep_alive) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (keep_alive && conn.socket && conn.socket->is_open()) {
+            idle_.push_back({std::move(conn), std::chrono::steady_clock::now()});
+        } else {
+            --open_;
+        }
+    }
+    dispatch_waiters();
+}
+
+void ConnectionPool::dispatch_waiters() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!waiters_.empty()) {
+        if (auto idle = take_idle_locked(); idle.socket) {
+            auto waiter = std::move(waiters_.front());
+            waiters_.pop_front();
+            auto conn = std::make_shared<Connection>(std::move(idle));
+            asio::post(io_, [waiter = std::move(waiter), conn]() {
+                waiter(nullptr, std::move(*conn));
+            });
+            continue;
+        }
+        if (open_ < max_connections_) {
+            ++open_;
+            auto waiter = std::move(waiters_.front());
+            waiters_.pop_front();
+            lock.unlock();
+            connect_new(std::move(waiter));
+            lock.lock();
+            continue;
+        }
+        break;
+    }
+}
+
+nlohmann::json ConnectionPool::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return {
+        {"open", open_},
+        {"idle", idle_.size()},
+        {"waiting", waiters_.size()},
+        {"max_connections", max_connections_},
+        {"hits", hits_.load()},
+        {"misses", misses_.load()},
+        {"waits", waits_.load()},
+        {"expired", expired_.load()},
+        {"connect_failures", connect_failures_.load()},
+        {"connect_fallbacks", connect_fallbacks_.load()},
+        {"connect_latency", connect_latency_.to_json()}
+    };
+}
+
+// =====================
+// HttpClient Implementation
+// =====================
+
+HttpClient& HttpClient::instance() {
+    static HttpClient instance;
+    return instance;
+}
+
+HttpClient::HttpClient() : work_(asio::make_work_guard(io_)), dns_(io_, 30, 5) {}
+
+HttpClient::~HttpClient() {
+    work_.reset();
+    io_.stop();
+    for (auto& thread : threads_) {
+        if (thread.joinable()) thread.join();
+    }
+}
+
+void HttpClient::configure(const LlmConfig& config) {
+    std::lock_guard<std::mutex> lock(pools_mutex_);
+    max_connections_per_upstream_ = config.pool_max_connections;
+    idle_timeout_sec_ = config.pool_idle_timeout;
+    io_threads_ = std::max(1, config.io_threads);
+    connect_attempt_delay_ms_ = config.connect_attempt_delay_ms;
+    dns_.configure(config.dns_ttl, config.dns_negative_ttl);
+}
+
+void HttpClient::start() {
+    std::call_once(started_, [this] {
+        int count;
+        {
+            std::lock_guard<std::mutex> lock(pools_mutex_);
+            count = io_threads_;
+        }
+        for (int i = 0; i < count; ++i) {
+            threads_.emplace_back([this] { io_.run(); });
+        }
+        std::cout << "[HTTP] Upstream I/O running on " << count << " threads" << std::endl;
+    });
+}
+
+asio::io_context& HttpClient::io_context() {
+    start();
+    return io_;
+}
+
+ConnectionPool& HttpClient::pool_for(const std::string& host, int port, bool probe) {
+    std::string key = host + ":" + std::to_string(port) + (probe ? " (probe)" : "");
+
+    std::lock_guard<std::mutex> lock(pools_mutex_);
+    auto it = pools_.find(key);
+    if (it == pools_.end()) {
+        int max_connections = probe ? 1 : max_connections_per_upstream_;
+        it = pools_.emplace(key, std::make_unique<ConnectionPool>(
+            io_, dns_, host, port, max_connections, idle_timeout_sec_, connect_attempt_delay_ms_)).first;
+    }
+    return *it->second;
+}
+
+void HttpClient::async_post(
+    const std::string& url,
+    std::string body,
+    const HttpDeadlines& deadlines,
+    BodyCallback on_body,
+    ResponseCallback on_done,
+    std::shared_ptr<CancellationToken> cancel
+) {
+    send("POST", url, body, deadlines, std::move(on_body), std::move(on_done), std::move(cancel));
+}
+
+void HttpClient::async_get(const std::string& url, const HttpDeadlines& deadlines, ResponseCallback on_done) {
+    send("GET", url, "", deadlines, nullptr, std::move(on_done), nullptr);
+}
+
+void HttpClient::send(
+    const char* method,
+    const std::string& url,
+    const std::string& body,
+    const HttpDeadlines& deadlines,
+    BodyCallback on_body,
+    ResponseCallback on_done,
+    std::shared_ptr<CancellationToken> cancel
+) {
+    start();
+
+    auto parts = parse_url(url);
+    auto& pool = pool_for(parts.host, parts.port, std::string_view(method) == "GET");
+
+    // Build HTTP request
+    std::string request;
+    request.reserve(body.size() + parts.path.size() + parts.host.size() + 128);
+    request += std::string(method) + " " + parts.path + " HTTP/1.1\r\n";
+    request += "Host: " + parts.host + ":" + std::to_string(parts.port) + "\r\n";
+    if (std::string_view(method) != "GET") {
+        request += "Content-Type: application/json\r\n";
+        request += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+    }
+    request += "Connection: keep-alive\r\n";
+    request += "\r\n";
+    request += body;
+
+    in_flight_++;
+    auto exchange = std::make_shared<HttpExchange>(
+        io_, pool, std::move(request), parts.host + ":" + std::to_string(parts.port), deadlines,
+        std::move(on_body),
+        [this, on_done = std::move(on_done)](std::exception_ptr error, HttpResponse response) {
+            in_flight_--;
+            if (error) {
+                try {
+                    std::rethrow_exception(error);
+                } catch (const DeadlineExceeded& e) {
+                    deadlines_exceeded_[static_cast<size_t>(e.phase())]++;
+                } catch (...) {}
+            }
+            on_done(error, std::move(response));
+        });
+    exchange->start(cancel);
+}
+
+nlohmann::json HttpClient::stats() {
+    std::lock_guard<std::mutex> lock(pools_mutex_);
+    nlohmann::json pools = nlohmann::json::object();
+    for (const auto& [key, pool] : pools_) {
+        pools[key] = pool->stats();
+    }
+    nlohmann::json deadlines = nlohmann::json::object();
+    for (auto phase : {HttpDeadlines::Phase::Connect, HttpDeadlines::Phase::FirstByte,
+                       HttpDeadlines::Phase::Idle, HttpDeadlines::Phase::Total}) {
+        deadlines[HttpDeadlines::phase_name(phase)] = deadlines_exceeded_[static_cast<size_t>(phase)].load();
+    }
+    return {
+        {"in_flight", in_flight_.load()},
+        {"deadlines_exceeded", deadlines},
+        {"io_threads", static_cast<int>(threads_.size())},
+        {"dns", dns_.stats()},
+        {"pools", pools}
+    };
+}
+
+} // namespace prompt_portal
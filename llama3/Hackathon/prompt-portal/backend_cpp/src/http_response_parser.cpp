@@ -0,0 +1,196 @@
+#include "http_response_parser.hpp"
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+
+namespace prompt_portal {
+
+namespace {
+
+bool iequals(const char* a, size_t a_len, const char* b) {
+    size_t b_len = std::strlen(b);
+    if (a_len != b_len) return false;
+    for (size_t i = 0; i < a_len; ++i) {
+        if (std::tolower(static_cast<unsigned char>(a[i])) != b[i]) return false;
+    }
+    return true;
+}
+
+// Case-insensitive search for a lowercase token in a header value
+bool icontains(const std::string& value, size_t from, const char* token) {
+    size_t n = std::strlen(token);
+    for (size_t i = from; i + n <= value.size(); ++i) {
+        if (iequals(value.data() + i, n, token)) return true;
+    }
+    return false;
+}
+
+} // anonymous namespace
+
+void HttpResponseParser::reset() {
+    state_ = State::StatusLine;
+    framing_ = Framing::None;
+    status_ = 0;
+    keep_alive_ = false;
+    http11_ = false;
+    remaining_ = 0;
+    content_length_ = -1;
+    chunked_ = false;
+    line_.clear();
+}
+
+size_t HttpResponseParser::take_line(const char* data, size_t len, bool& done) {
+    const char* newline = static_cast<const char*>(std::memchr(data, '\n', len));
+    size_t n = newline ? static_cast<size_t>(newline - data) + 1 : len;
+    if (line_.size() + n > kMaxLine) {
+        throw std::runtime_error("HTTP header line too long");
+    }
+    line_.append(data, n);
+    done = newline != nullptr;
+    return n;
+}
+
+void HttpResponseParser::on_line() {
+    // Strip CRLF (a bare LF is tolerated)
+    line_.pop_back();
+    if (!line_.empty() && line_.back() == '\r') line_.pop_back();
+
+    switch (state_) {
+        case State::StatusLine: parse_status_line(); break;
+        case State::Headers:
+            if (line_.empty()) {
+                end_of_headers();
+            } else {
+                parse_header_line();
+            }
+            break;
+        case State::ChunkSize: parse_chunk_size(); break;
+        case State::ChunkDataEnd:
+            if (!line_.empty()) throw std::runtime_error("Invalid chunk terminator");
+            state_ = State::ChunkSize;
+            break;
+        case State::Trailers:
+            if (line_.empty()) state_ = State::Complete;
+            break;
+        default:
+            break;
+    }
+    line_.clear();
+}
+
+void HttpResponseParser::parse_status_line() {
+    // HTTP/1.1 200 OK
+    if (line_.compare(0, 5, "HTTP/") != 0) {
+        throw std::runtime_error("Invalid HTTP response");
+    }
+    size_t space = line_.find(' ');
+    if (space == std::string::npos || space + 4 > line_.size()) {
+        throw std::runtime_error("Invalid HTTP status line");
+    }
+    http11_ = line_.compare(0, space, "HTTP/1.1") == 0;
+    keep_alive_ = http11_;
+
+    // Exactly three digits, then the reason phrase or the end of the line
+    int status = 0;
+    for (size_t i = space + 1; i < space + 4; ++i) {
+        char c = line_[i];
+        if (c < '0' || c > '9') throw std::runtime_error("Invalid HTTP status line");
+        status = status * 10 + (c - '0');
+    }
+    if (space + 4 < line_.size() && line_[space + 4] != ' ') {
+        throw std::runtime_error("Invalid HTTP status line");
+    }
+    status_ = status;
+    state_ = State::Headers;
+}
+
+void HttpResponseParser::parse_header_line() {
+    size_t colon = line_.find(':');
+    if (colon == std::string::npos) return;
+
+    size_t value_start = line_.find_first_not_of(" \t", colon + 1);
+    if (value_start == std::string::npos) value_start = line_.size();
+    const char* name = line_.data();
+
+    if (iequals(name, colon, "content-length")) {
+        uint64_t length = 0;
+        size_t digits = 0;
+        for (size_t i = value_start; i < line_.size() && line_[i] != ' ' && line_[i] != '\t'; ++i) {
+            char c = line_[i];
+            if (c < '0' || c > '9') throw std::runtime_error("Invalid Content-Length");
+            length = length * 10 + static_cast<uint64_t>(c - '0');
+            // Checked per digit, so length never gets near overflowing
+            if (length > kMaxBodyLength) throw std::runtime_error("Content-Length too large");
+            ++digits;
+        }
+        if (digits == 0) throw std::runtime_error("Invalid Content-Length");
+        content_length_ = static_cast<int64_t>(length);
+    } else if (iequals(name, colon, "transfer-encoding")) {
+        chunked_ = icontains(line_, value_start, "chunked");
+    } else if (iequals(name, colon, "connection")) {
+        if (icontains(line_, value_start, "close")) keep_alive_ = false;
+        if (icontains(line_, value_start, "keep-alive")) keep_alive_ = true;
+    }
+}
+
+void HttpResponseParser::end_of_headers() {
+    // Interim responses (100 Continue) are followed by the real one
+    if (status_ >= 100 && status_ < 200) {
+        bool http11 = http11_;
+        reset();
+        http11_ = http11;
+        return;
+    }
+
+    if (status_ == 204 || status_ == 304) {
+        framing_ = Framing::ContentLength;
+        state_ = State::Complete;
+    } else if (chunked_) {
+        framing_ = Framing::Chunked;
+        state_ = State::ChunkSize;
+    } else if (content_length_ >= 0) {
+        framing_ = Framing::ContentLength;
+        remaining_ = static_cast<uint64_t>(content_length_);
+        state_ = remaining_ == 0 ? State::Complete : State::Body;
+    } else {
+        // No framing: body runs until the server closes the connection
+        framing_ = Framing::UntilClose;
+        keep_alive_ = false;
+        state_ = State::Body;
+    }
+}
+
+void HttpResponseParser::parse_chunk_size() {
+    uint64_t size = 0;
+    size_t digits = 0;
+    for (char c : line_) {
+        int v;
+        if (c >= '0' && c <= '9') v = c - '0';
+        else if (c >= 'a' && c <= 'f') v = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') v = c - 'A' + 10;
+        else break;  // chunk extensions (";name=value") are ignored
+        size = size * 16 + static_cast<uint64_t>(v);
+        if (size > kMaxBodyLength) throw std::runtime_error("Chunk size too large");
+        ++digits;
+    }
+    if (digits == 0) throw std::runtime_error("Invalid chunk size");
+
+    if (size == 0) {
+        state_ = State::Trailers;
+    } else {
+        remaining_ = size;
+        state_ = State::ChunkData;
+    }
+}
+
+void HttpResponseParser::finish_eof() {
+    if (state_ == State::Body && framing_ == Framing::UntilClose) {
+        state_ = State::Complete;
+        return;
+    }
+    if (state_ != State::Complete) {
+        throw std::runtime_error(headers_done() ? "Truncated HTTP response" : "Invalid HTTP response");
+    }
+}
+
+} // namespace prompt_portal
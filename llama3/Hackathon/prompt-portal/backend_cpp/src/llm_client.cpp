@@ -1,151 +1,109 @@
 #include "llm_client.hpp"
+#include "http_client.hpp"
+#include "admission_controller.hpp"
+#include "usage_accounting.hpp"
+#include "hedging.hpp"
+#include "token_estimator.hpp"
 #include <iostream>
+#include <algorithm>
+#include <bit>
+#include <limits>
 #include <sstream>
 #include <chrono>
-#include <thread>
-#include <cstring>
-
-// Simple HTTP client using sockets
-// For production, consider using libcurl or cpp-httplib
-
-#ifdef _WIN32
-    #include <winsock2.h>
-    #include <ws2tcpip.h>
-    #pragma comment(lib, "ws2_32.lib")
-    typedef SOCKET socket_t;
-    #define SOCKET_ERROR_CODE SOCKET_ERROR
-    #define INVALID_SOCKET_VAL INVALID_SOCKET
-    #define CLOSE_SOCKET closesocket
-#else
-    #include <sys/socket.h>
-    #include <netinet/in.h>
-    #include <arpa/inet.h>
-    #include <netdb.h>
-    #include <unistd.h>
-    typedef int socket_t;
-    #define SOCKET_ERROR_CODE -1
-    #define INVALID_SOCKET_VAL -1
-    #define CLOSE_SOCKET close
-#endif
+#include <future>
 
 namespace prompt_portal {
 
 namespace {
 
-struct UrlParts {
-    std::string host;
-    int port;
-    std::string path;
-};
-
-UrlParts parse_url(const std::string& url) {
-    UrlParts parts;
-    parts.port = 80;
-    parts.path = "/";
-    
-    std::string work = url;
-    
-    // Remove protocol
-    if (work.find("http://") == 0) {
-        work = work.substr(7);
-    } else if (work.find("https://") == 0) {
-        work = work.substr(8);
-        parts.port = 443;
-    }
-    
-    // Find path
-    size_t path_pos = work.find('/');
-    if (path_pos != std::string::npos) {
-        parts.path = work.substr(path_pos);
-        work = work.substr(0, path_pos);
-    }
-    
-    // Find port
-    size_t port_pos = work.find(':');
-    if (port_pos != std::string::npos) {
-        parts.port = std::stoi(work.substr(port_pos + 1));
-        work = work.substr(0, port_pos);
+void check_status(const HttpResponse& response) {
+    if (response.status < 200 || response.status >= 300) {
+        throw std::runtime_error("LLM server returned HTTP " + std::to_string(response.status) + ": " + response.body.substr(0, 200));
     }
-    
-    parts.host = work;
-    return parts;
 }
 
-std::string http_post(const std::string& url, const std::string& body, int timeout_sec = 300) {
-    auto parts = parse_url(url);
-    
-    #ifdef _WIN32
-    WSADATA wsaData;
-    WSAStartup(MAKEWORD(2, 2), &wsaData);
-    #endif
-    
-    socket_t sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock == INVALID_SOCKET_VAL) {
-        throw std::runtime_error("Failed to create socket");
-    }
-    
-    // Set timeout
-    #ifdef _WIN32
-    DWORD tv = timeout_sec * 1000;
-    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
-    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (const char*)&tv, sizeof(tv));
-    #else
-    struct timeval tv;
-    tv.tv_sec = timeout_sec;
-    tv.tv_usec = 0;
-    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
-    #endif
-    
-    // Resolve hostname
-    struct addrinfo hints = {}, *result;
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    
-    if (getaddrinfo(parts.host.c_str(), std::to_string(parts.port).c_str(), &hints, &result) != 0) {
-        CLOSE_SOCKET(sock);
-        throw std::runtime_error("Failed to resolve hostname: " + parts.host);
-    }
-    
-    // Connect
-    if (connect(sock, result->ai_addr, (int)result->ai_addrlen) == SOCKET_ERROR_CODE) {
-        freeaddrinfo(result);
-        CLOSE_SOCKET(sock);
-        throw std::runtime_error("Failed to connect to " + parts.host + ":" + std::to_string(parts.port));
+/**
+ * Splits an OpenAI-style SSE body into "data:" payloads, across arbitrary read boundaries.
+ * Stops after the "[DONE]" sentinel.
+ */
+class SseEventParser {
+public:
+    void feed(const char* data, size_t len, const std::function<void(const std::string&)>& on_event) {
+        if (done_) {
+            return;
+        }
+        pending_.append(data, len);
+        
+        size_t line_start = 0;
+        size_t line_end;
+        while (!done_ && (line_end = pending_.find('\n', line_start)) != std::string::npos) {
+            size_t line_len = line_end - line_start;
+            if (line_len > 0 && pending_[line_end - 1] == '\r') {
+                --line_len;
+            }
+            if (line_len >= 5 && pending_.compare(line_start, 5, "data:") == 0) {
+                size_t value_start = line_start + 5;
+                if (value_start < line_start + line_len && pending_[value_start] == ' ') {
+                    ++value_start;
+                }
+                std::string value = pending_.substr(value_start, line_start + line_len - value_start);
+                if (value == "[DONE]") {
+                    done_ = true;
+                } else {
+                    on_event(value);
+                }
+            }
+            line_start = line_end + 1;
+        }
+        pending_.erase(0, line_start);
     }
-    freeaddrinfo(result);
-    
-    // Build HTTP request
-    std::ostringstream request;
-    request << "POST " << parts.path << " HTTP/1.1\r\n";
-    request << "Host: " << parts.host << ":" << parts.port << "\r\n";
-    request << "Content-Type: application/json\r\n";
-    request << "Content-Length: " << body.length() << "\r\n";
-    request << "Connection: close\r\n";
-    request << "\r\n";
-    request << body;
     
-    std::string req_str = request.str();
-    send(sock, req_str.c_str(), (int)req_str.length(), 0);
-    
-    // Read response
-    std::string response;
-    char buffer[4096];
-    int received;
-    while ((received = recv(sock, buffer, sizeof(buffer) - 1, 0)) > 0) {
-        buffer[received] = '\0';
-        response += buffer;
+private:
+    std::string pending_;
+    bool done_ = false;
+};
+
+// Session map node, LRU node and bookkeeping
+constexpr size_t kSessionOverhead = 256;
+
+// Heap held by one history entry: the shared message with its control block, and its ring slot
+size_t entry_bytes(const ChatMessage& message) {
+    return sizeof(ChatMessage) + 3 * sizeof(MessagePtr) + sizeof(int64_t) + sizeof(int)
+           + message.role.size() + message.content.size();
+}
+
+// Greedy decoding or a fixed seed gives the same answer for the same request body
+bool is_deterministic(const ChatRequest& request) {
+    return request.temperature <= 0.0 || request.seed >= 0;
+}
+
+bool is_cancellation(std::exception_ptr error) {
+    try {
+        std::rethrow_exception(error);
+    } catch (const RequestCancelled&) {
+        return true;
+    } catch (...) {
+        return false;
     }
-    
-    CLOSE_SOCKET(sock);
-    
-    // Parse HTTP response
-    size_t header_end = response.find("\r\n\r\n");
-    if (header_end == std::string::npos) {
-        throw std::runtime_error("Invalid HTTP response");
+}
+
+// The total deadline is the request's budget (queue wait included), so missing it
+// does not mark the upstream unhealthy the way a connect or token stall does
+bool is_request_deadline(std::exception_ptr error) {
+    try {
+        std::rethrow_exception(error);
+    } catch (const DeadlineExceeded& e) {
+        return e.phase() == HttpDeadlines::Phase::Total;
+    } catch (...) {
+        return false;
     }
-    
-    return response.substr(header_end + 4);
+}
+
+// Transport errors and 5xx count against the upstream; 4xx is the caller's problem
+// and a cancelled request says nothing either way
+bool upstream_succeeded(std::exception_ptr error, const HttpResponse& response) {
+    if (error) return is_cancellation(error) || is_request_deadline(error);
+    return response.status < 500;
 }
 
 } // anonymous namespace
@@ -154,184 +112,838 @@ std::string http_post(const std::string& url, const std::string& body, int timeo
 // LLMClient Implementation
 // =====================
 
-LLMClient::LLMClient() {
-    auto& config = get_config();
-    server_url_ = config.llm.server_url;
-    timeout_ = config.llm.timeout;
-    default_temperature_ = config.llm.temperature;
-    default_top_p_ = config.llm.top_p;
-    default_max_tokens_ = config.llm.max_tokens;
-    skip_thinking_ = true;
-    available_ = test_connection();
-}
+LLMClient::LLMClient() : LLMClient(get_config().llm) {}
 
-LLMClient::LLMClient(const LlmConfig& config) {
-    server_url_ = config.server_url;
+LLMClient::LLMClient(const LlmConfig& config) : hedging_(config) {
+    upstreams_ = std::make_shared<UpstreamSet>(config);
+    AdmissionController::instance().configure(config, upstreams_->upstreams().size());
+    coalesce_requests_ = config.coalesce_requests;
+    if (config.completion_cache_mb > 0) {
+        completion_cache_ = std::make_unique<CompletionCache>(
+            static_cast<size_t>(config.completion_cache_mb) * 1024 * 1024, config.completion_cache_ttl);
+    }
     timeout_ = config.timeout;
+    connect_timeout_ = std::chrono::milliseconds(config.connect_timeout_ms);
+    first_token_timeout_ = std::chrono::milliseconds(config.first_token_timeout_ms);
+    inter_token_timeout_ = std::chrono::milliseconds(config.inter_token_timeout_ms);
     default_temperature_ = config.temperature;
     default_top_p_ = config.top_p;
     default_max_tokens_ = config.max_tokens;
+    seed_ = config.seed;
+    slots_per_upstream_ = config.slots_per_upstream;
     skip_thinking_ = true;
-    available_ = test_connection();
+    HttpClient::instance().configure(config);
+    prober_ = HealthProber::start(upstreams_, config);
 }
 
-bool LLMClient::test_connection() {
-    try {
-        std::cout << "[LLM] Testing connection to " << server_url_ << std::endl;
-        
-        nlohmann::json body = {
-            {"model", "default"},
-            {"messages", {{{"role", "system"}, {"content", "test"}}}},
-            {"max_tokens", 1}
-        };
-        
-        std::string response = http_post(server_url_ + "/v1/chat/completions", body.dump(), 10);
-        auto json = nlohmann::json::parse(response);
-        
-        if (json.contains("choices")) {
-            std::cout << "[LLM] Connection test successful" << std::endl;
-            return true;
-        }
-    } catch (const std::exception& e) {
-        std::cerr << "[LLM] Connection test failed: " << e.what() << std::endl;
-    }
-    return false;
+LLMClient::~LLMClient() {
+    if (prober_) prober_->stop();
+}
+
+ChatRequest LLMClient::build_request(
+    ChatMessages messages,
+    std::optional<double> temperature,
+    std::optional<double> top_p,
+    std::optional<int> max_tokens,
+    const std::string& model
+) const {
+    ChatRequest request;
+    request.messages = messages;
+    request.model = model;
+    request.temperature = temperature.value_or(default_temperature_);
+    request.top_p = top_p.value_or(default_top_p_);
+    request.max_tokens = max_tokens.value_or(default_max_tokens_);
+    request.seed = seed_;
+    request.skip_thinking = skip_thinking_;
+    return request;
 }
 
 std::string LLMClient::generate(
-    const std::vector<ChatMessage>& messages,
+    ChatMessages messages,
     std::optional<double> temperature,
     std::optional<double> top_p,
     std::optional<int> max_tokens,
     const std::string& model
 ) {
-    double temp = temperature.value_or(default_temperature_);
-    double tp = top_p.value_or(default_top_p_);
-    int mt = max_tokens.value_or(default_max_tokens_);
-    
-    // Build messages array
-    nlohmann::json msgs = nlohmann::json::array();
-    for (const auto& msg : messages) {
-        msgs.push_back({{"role", msg.role}, {"content", msg.content}});
-    }
-    
-    nlohmann::json body = {
-        {"model", model},
-        {"messages", msgs},
-        {"temperature", temp},
-        {"top_p", tp},
-        {"max_tokens", mt}
-    };
+    std::promise<std::string> promise;
+    auto future = promise.get_future();
+    
+    generate_async(messages, [&promise](std::exception_ptr error, std::string content) {
+        if (error) {
+            promise.set_exception(error);
+        } else {
+            promise.set_value(std::move(content));
+        }
+    }, temperature, top_p, max_tokens, model);
     
-    if (skip_thinking_) {
-        body["extra_body"] = {{"enable_thinking", false}};
+    return future.get();
+}
+
+void LLMClient::generate_async(
+    ChatMessages messages,
+    CompletionCallback on_done,
+    std::optional<double> temperature,
+    std::optional<double> top_p,
+    std::optional<int> max_tokens,
+    const std::string& model,
+    RequestContext context
+) {
+    auto& affinity = context.affinity;
+    auto cancel = context.cancel;
+    ChatRequest request = build_request(messages, temperature, top_p, max_tokens, model);
+    bool deterministic = is_deterministic(request);
+    
+    // Cache and coalescing key: the body before any slot is pinned
+    std::string payload;
+    if (deterministic && (completion_cache_ || coalesce_requests_)) {
+        payload = write_chat_request(request);
     }
     
-    try {
-        auto start = std::chrono::steady_clock::now();
-        
-        std::string response = http_post(server_url_ + "/v1/chat/completions", body.dump(), timeout_);
-        auto json = nlohmann::json::parse(response);
-        
-        auto end = std::chrono::steady_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-        
-        if (json.contains("choices") && json["choices"].size() > 0) {
-            std::string content = json["choices"][0]["message"]["content"].get<std::string>();
-            std::cout << "[LLM] Generated response in " << duration.count() << "ms" << std::endl;
-            return content;
+    if (deterministic && completion_cache_) {
+        if (auto cached = completion_cache_->get(payload)) {
+            return on_done(nullptr, std::move(*cached));
         }
-        
-        throw std::runtime_error("Invalid response from LLM server");
-        
-    } catch (const nlohmann::json::exception& e) {
-        throw std::runtime_error(std::string("JSON parse error: ") + e.what());
-    } catch (const std::exception& e) {
-        throw std::runtime_error(std::string("LLM generation failed: ") + e.what());
     }
+    
+    // Identical concurrent requests share one upstream call, which no single
+    // caller may cancel
+    if (deterministic && coalesce_requests_) {
+        cancel = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(inflight_mutex_);
+            auto [it, leader] = inflight_.try_emplace(payload);
+            it->second.push_back(std::move(on_done));
+            if (!leader) {
+                coalesced_++;
+                return;
+            }
+        }
+        on_done = [this, payload](std::exception_ptr error, std::string content) {
+            std::vector<CompletionCallback> waiters;
+            {
+                std::lock_guard<std::mutex> lock(inflight_mutex_);
+                auto it = inflight_.find(payload);
+                waiters.swap(it->second);
+                inflight_.erase(it);
+            }
+            for (auto& waiter : waiters) {
+                try {
+                    waiter(error, content);
+                } catch (const std::exception& e) {
+                    std::cerr << "[LLM] Completion handler failed: " << e.what() << std::endl;
+                }
+            }
+        };
+    }
+    
+    if (deterministic && completion_cache_) {
+        on_done = [this, payload, on_done = std::move(on_done)](std::exception_ptr error, std::string content) {
+            if (!error) completion_cache_->put(payload, content);
+            on_done(error, std::move(content));
+        };
+    }
+    
+    auto start = std::chrono::steady_clock::now();
+    int preferred = affinity ? affinity->upstream.load() : -1;
+    with_upstream(preferred, request, [this, payload = std::move(payload), on_done = std::move(on_done), cancel = std::move(cancel),
+                                       context = std::move(context), model = std::string(model), start](
+            std::exception_ptr error, UpstreamSet::Upstream* upstream, ChatRequest& request) mutable {
+        if (error) {
+            return on_done(error, "");
+        }
+        send_completion(*upstream, request, std::move(payload), std::move(on_done), std::move(cancel),
+                        std::move(context), model, start);
+    });
+}
+
+void LLMClient::send_completion(UpstreamSet::Upstream& upstream, ChatRequest& request, std::string payload,
+                                CompletionCallback on_done, std::shared_ptr<CancellationToken> cancel,
+                                RequestContext context, const std::string& model,
+                                std::chrono::steady_clock::time_point start) {
+    auto& affinity = context.affinity;
+    if (affinity) {
+        request.id_slot = route(upstream, affinity.get());
+    }
+    if (payload.empty() || request.id_slot >= 0) {
+        payload = write_chat_request(request);
+    }
+    
+    auto race = hedge_race(cancel);
+    auto finish = std::make_shared<CompletionCallback>(std::move(on_done));
+    auto attempt = [this, affinity, race, finish, start, deadline = context.deadline,
+                    user = std::move(context.user), model](UpstreamSet::Upstream& upstream, int index,
+                                                           std::string body, std::shared_ptr<CancellationToken> cancel) {
+        HttpClient::instance().async_post(
+            upstream.url + "/v1/chat/completions", std::move(body), deadlines_for(deadline, false), nullptr,
+            [this, &upstream, index, affinity, race, finish, start, user, model](std::exception_ptr error, HttpResponse response) {
+                bool succeeded = upstream_succeeded(error, response);
+                upstreams_->release(upstream, succeeded);
+                if (race && !race->settle(index, error || response.status < 200 || response.status >= 300)) {
+                    return;  // Lost the race, or failed while the other attempt runs
+                }
+                if (!succeeded && affinity) {
+                    // Let the next turn pick a healthy upstream
+                    affinity->upstream = -1;
+                    affinity->slot = -1;
+                }
+                auto& on_done = *finish;
+                if (error && is_cancellation(error)) {
+                    return on_done(error, "");
+                }
+                std::string content;
+                try {
+                    if (error) {
+                        std::rethrow_exception(error);
+                    }
+                    check_status(response);
+                    
+                    CompletionFields fields;
+                    if (!extract_completion(response.body, fields)) {
+                        throw std::runtime_error("JSON parse error: invalid completion body");
+                    }
+                    if (!fields.has_choice) {
+                        throw std::runtime_error("Invalid response from LLM server");
+                    }
+                    content = std::move(fields.content);
+                    if (race) {
+                        won_race(upstream, index, affinity.get());
+                    }
+                    record_timings(fields, affinity.get());
+                    
+                    auto end = std::chrono::steady_clock::now();
+                    if (race) {
+                        hedging_.observe(false, end - start);
+                    }
+                    UsageSample usage;
+                    usage.merge(fields);
+                    usage.latency = end - start;
+                    UsageAccounting::instance().record(user, model, upstream.url, usage);
+                    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+                    std::cout << "[LLM] Generated response in " << duration.count() << "ms" << std::endl;
+                    
+                } catch (const DeadlineExceeded&) {
+                    return on_done(std::current_exception(), "");
+                } catch (const std::exception& e) {
+                    return on_done(std::make_exception_ptr(std::runtime_error(std::string("LLM generation failed: ") + e.what())), "");
+                }
+                on_done(nullptr, std::move(content));
+            },
+            std::move(cancel)
+        );
+    };
+    
+    if (!race) {
+        return attempt(upstream, 0, std::move(payload), cancel);
+    }
+    int index = 0;
+    auto token = race->add_attempt(index);
+    if (auto delay = hedging_.on_request(false)) {
+        std::string hedge_body = payload;
+        if (request.id_slot >= 0) {
+            // The copy goes to another upstream, where this slot means nothing
+            request.id_slot = -1;
+            hedge_body = write_chat_request(request);
+        }
+        arm_hedge(race, upstream, *delay, std::move(hedge_body), attempt);
+    }
+    attempt(upstream, index, std::move(payload), std::move(token));
 }
 
 void LLMClient::generate_stream(
-    const std::vector<ChatMessage>& messages,
+    ChatMessages messages,
     std::function<void(const std::string&)> on_chunk,
     std::optional<double> temperature,
     std::optional<double> top_p,
     std::optional<int> max_tokens,
     const std::string& model
 ) {
-    // For simplicity, use non-streaming and chunk the response
-    // A full implementation would use SSE/chunked transfer encoding
-    try {
-        std::string full_response = generate(messages, temperature, top_p, max_tokens, model);
-        
-        // Simulate streaming by sending chunks
-        const size_t chunk_size = 10;
-        for (size_t i = 0; i < full_response.length(); i += chunk_size) {
-            std::string chunk = full_response.substr(i, chunk_size);
-            on_chunk(chunk);
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::promise<void> promise;
+    auto future = promise.get_future();
+    
+    generate_stream_async(messages, on_chunk, [&promise](std::exception_ptr error) {
+        if (error) {
+            promise.set_exception(error);
+        } else {
+            promise.set_value();
         }
+    }, temperature, top_p, max_tokens, model);
+    
+    try {
+        future.get();
     } catch (const std::exception& e) {
         on_chunk(std::string("Error: ") + e.what());
     }
 }
 
-std::string LLMClient::make_request(const std::string& endpoint, const nlohmann::json& body) {
-    return http_post(server_url_ + endpoint, body.dump(), timeout_);
+void LLMClient::generate_stream_async(
+    ChatMessages messages,
+    ChunkCallback on_chunk,
+    StreamDoneCallback on_done,
+    std::optional<double> temperature,
+    std::optional<double> top_p,
+    std::optional<int> max_tokens,
+    const std::string& model,
+    RequestContext context
+) {
+    auto& affinity = context.affinity;
+    ChatRequest request = build_request(messages, temperature, top_p, max_tokens, model);
+    request.stream = true;
+    auto start = std::chrono::steady_clock::now();
+    int preferred = affinity ? affinity->upstream.load() : -1;
+    with_upstream(preferred, request, [this, on_chunk = std::move(on_chunk), on_done = std::move(on_done),
+                                       context = std::move(context), model = std::string(model), start](
+            std::exception_ptr error, UpstreamSet::Upstream* upstream, ChatRequest& request) mutable {
+        if (error) {
+            return on_done(error);
+        }
+        send_stream(*upstream, request, std::move(on_chunk), std::move(on_done), std::move(context), model, start);
+    });
+}
+
+void LLMClient::send_stream(UpstreamSet::Upstream& upstream, ChatRequest& request, ChunkCallback on_chunk,
+                            StreamDoneCallback on_done, RequestContext context, const std::string& model,
+                            std::chrono::steady_clock::time_point start) {
+    auto& affinity = context.affinity;
+    int token_budget = request.max_tokens;
+    if (affinity) {
+        request.id_slot = route(upstream, affinity.get());
+    }
+    std::string payload(write_chat_request(request));
+    
+    auto race = hedge_race(context.cancel);
+    auto chunk = std::make_shared<ChunkCallback>(std::move(on_chunk));
+    auto finish = std::make_shared<StreamDoneCallback>(std::move(on_done));
+    auto attempt = [this, affinity, race, chunk, finish, start, token_budget, deadline = context.deadline,
+                    user = std::move(context.user), model](UpstreamSet::Upstream& upstream, int index,
+                                                           std::string body, std::shared_ptr<CancellationToken> cancel) {
+        auto events = std::make_shared<SseEventParser>();
+        auto fields = std::make_shared<CompletionFields>();  // Reused for every chunk
+        auto generated = std::make_shared<std::atomic<int>>(0);
+        auto usage = std::make_shared<UsageSample>();
+        auto claimed = std::make_shared<bool>(false);
+        
+        HttpClient::instance().async_post(
+            upstream.url + "/v1/chat/completions", std::move(body), deadlines_for(deadline, true),
+            [this, &upstream, index, events, fields, generated, usage, claimed, race, affinity, chunk, start](const char* data, size_t len) {
+                events->feed(data, len, [&](const std::string& event) {
+                    if (!extract_completion(event, *fields)) {
+                        return;
+                    }
+                    if (race && !*claimed) {
+                        // The first attempt to produce an event streams; the other is cancelled
+                        if (!race->claim(index)) return;
+                        *claimed = true;
+                        hedging_.observe(true, std::chrono::steady_clock::now() - start);
+                        won_race(upstream, index, affinity.get());
+                    }
+                    if (fields->has_error) {
+                        throw std::runtime_error("LLM server error: " + (fields->error.empty() ? std::string("unknown") : fields->error));
+                    }
+                    // llama.cpp attaches timings to the final chunk, and usage
+                    // (requested through stream_options) follows it
+                    record_timings(*fields, affinity.get());
+                    usage->merge(*fields);
+                    if (!fields->content.empty()) {
+                        // llama.cpp streams one token per delta
+                        generated->fetch_add(1, std::memory_order_relaxed);
+                        (*chunk)(fields->content);
+                    }
+                });
+            },
+            [this, &upstream, index, race, affinity, generated, usage, token_budget, finish, start, user, model](std::exception_ptr error, HttpResponse response) {
+                bool succeeded = upstream_succeeded(error, response);
+                upstreams_->release(upstream, succeeded);
+                if (race && !race->settle(index, error || response.status < 200 || response.status >= 300)) {
+                    return;  // Lost the race, or failed while the other attempt runs
+                }
+                if (!succeeded && affinity) {
+                    affinity->upstream = -1;
+                    affinity->slot = -1;
+                }
+                auto& on_done = *finish;
+                if (error && is_cancellation(error)) {
+                    int produced = generated->load();
+                    cancelled_streams_++;
+                    tokens_before_cancel_ += produced;
+                    aborted_tokens_ += std::max(0, token_budget - produced);
+                    std::cout << "[LLM] Stream cancelled after " << produced << " tokens" << std::endl;
+                    return on_done(error);
+                }
+                try {
+                    if (error) {
+                        std::rethrow_exception(error);
+                    }
+                    check_status(response);
+                    
+                    auto end = std::chrono::steady_clock::now();
+                    if (usage->completion_tokens == 0) {
+                        // Upstream sent neither usage nor timings
+                        usage->completion_tokens = generated->load();
+                    }
+                    usage->latency = end - start;
+                    UsageAccounting::instance().record(user, model, upstream.url, *usage);
+                    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+                    std::cout << "[LLM] Streamed response in " << duration.count() << "ms" << std::endl;
+                    
+                } catch (...) {
+                    return on_done(std::current_exception());
+                }
+                on_done(nullptr);
+            },
+            std::move(cancel)
+        );
+    };
+    
+    if (!race) {
+        return attempt(upstream, 0, std::move(payload), context.cancel);
+    }
+    int index = 0;
+    auto token = race->add_attempt(index);
+    if (auto delay = hedging_.on_request(true)) {
+        std::string hedge_body = payload;
+        if (request.id_slot >= 0) {
+            // The copy goes to another upstream, where this slot means nothing
+            request.id_slot = -1;
+            hedge_body = write_chat_request(request);
+        }
+        arm_hedge(race, upstream, *delay, std::move(hedge_body), attempt);
+    }
+    attempt(upstream, index, std::move(payload), std::move(token));
+}
+
+void LLMClient::with_upstream(int preferred, ChatRequest& request, UpstreamCallback send) {
+    UpstreamSet::Upstream* upstream = nullptr;
+    try {
+        upstream = upstreams_->select(preferred);
+    } catch (const NoHealthyUpstream&) {
+        return send(std::current_exception(), nullptr, request);
+    }
+    if (upstream) {
+        return send(nullptr, upstream, request);
+    }
+    
+    // Every healthy upstream is full: hedges, and upstreams ejected since their
+    // requests were admitted, can take more room than admission accounts for.
+    // The request borrows its messages and model for this call only, so the
+    // one that waits keeps copies
+    upstream_waits_++;
+    auto messages = std::make_shared<std::vector<ChatMessage>>();
+    messages->reserve(request.messages.size());
+    for (size_t i = 0; i < request.messages.size(); ++i) {
+        messages->push_back(request.messages[i]);
+    }
+    auto model = std::make_shared<std::string>(request.model);
+    upstreams_->acquire(preferred, [request, messages, model, send = std::move(send)](
+            std::exception_ptr error, UpstreamSet::Upstream* upstream) mutable {
+        request.messages = *messages;
+        request.model = *model;
+        send(error, upstream, request);
+    });
+}
+
+HttpDeadlines LLMClient::deadlines_for(std::chrono::steady_clock::time_point deadline, bool stream) const {
+    HttpDeadlines deadlines;
+    deadlines.connect = connect_timeout_;
+    deadlines.idle = inter_token_timeout_;
+    deadlines.total = std::min(deadline, std::chrono::steady_clock::now() + std::chrono::seconds(timeout_));
+    // A non-streamed completion sends nothing until generation ends, so only
+    // the total deadline bounds the wait for its first byte
+    if (stream) {
+        deadlines.first_byte = first_token_timeout_;
+    }
+    return deadlines;
+}
+
+std::shared_ptr<HedgedRace> LLMClient::hedge_race(std::shared_ptr<CancellationToken> cancel) {
+    if (!hedging_.enabled() || upstreams_->upstreams().size() < 2) {
+        return nullptr;
+    }
+    return HedgedRace::create(HttpClient::instance().io_context(), std::move(cancel));
+}
+
+void LLMClient::arm_hedge(std::shared_ptr<HedgedRace> race, const UpstreamSet::Upstream& primary,
+                          std::chrono::microseconds delay, std::string body, Attempt launch) {
+    race->arm(delay, [this, race, &primary, delay, body = std::move(body), launch = std::move(launch)]() mutable {
+        if (!hedging_.try_spend()) {
+            return;
+        }
+        UpstreamSet::Upstream* other = upstreams_->select_other(primary);
+        if (!other) {
+            return;
+        }
+        int index = 0;
+        auto token = race->add_attempt(index);
+        if (!token) {
+            // Decided while the upstream was being picked
+            upstreams_->release(*other, true);
+            return;
+        }
+        hedging_.record_hedge();
+        std::cout << "[LLM] Hedging to " << other->url << ", " << primary.url << " silent for "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(delay).count() << "ms" << std::endl;
+        launch(*other, index, std::move(body), std::move(token));
+    });
+}
+
+void LLMClient::won_race(UpstreamSet::Upstream& upstream, int index, UpstreamAffinity* affinity) {
+    if (index == 0) {
+        return;
+    }
+    hedging_.record_hedge_won();
+    if (affinity) {
+        // The next turn follows the conversation to where its KV cache now is
+        affinity->upstream = static_cast<int>(upstream.index);
+        affinity->slot = -1;
+    }
+}
+
+int LLMClient::route(UpstreamSet::Upstream& upstream, UpstreamAffinity* affinity) {
+    int index = static_cast<int>(upstream.index);
+    if (affinity->upstream.exchange(index) != index) {
+        // New or moved session: its old slot means nothing on this upstream
+        affinity->slot = -1;
+    }
+    
+    int slot = affinity->slot.load();
+    if (slot < 0 && slots_per_upstream_ > 0) {
+        slot = static_cast<int>(upstream.next_slot++ % static_cast<unsigned>(slots_per_upstream_));
+        affinity->slot = slot;
+    }
+    return slot;
+}
+
+void LLMClient::record_timings(const CompletionFields& fields, UpstreamAffinity* affinity) {
+    if (affinity && fields.id_slot >= 0) {
+        affinity->slot = fields.id_slot;
+    }
+    
+    if (!fields.timings.present) {
+        return;
+    }
+    timed_requests_++;
+    prompt_tokens_evaluated_ += fields.timings.prompt_n;
+    prompt_tokens_cached_ += fields.timings.cache_n;
+    prompt_eval_us_ += static_cast<uint64_t>(fields.timings.prompt_ms * 1000.0);
+}
+
+nlohmann::json LLMClient::prompt_cache_stats() const {
+    uint64_t evaluated = prompt_tokens_evaluated_.load();
+    uint64_t cached = prompt_tokens_cached_.load();
+    uint64_t total = evaluated + cached;
+    return {
+        {"requests", timed_requests_.load()},
+        {"prompt_tokens_evaluated", evaluated},
+        {"prompt_tokens_cached", cached},
+        {"reuse_ratio", total > 0 ? static_cast<double>(cached) / total : 0.0},
+        {"prompt_eval_ms", prompt_eval_us_.load() / 1000.0}
+    };
+}
+
+nlohmann::json LLMClient::cancellation_stats() const {
+    return {
+        {"cancelled_streams", cancelled_streams_.load()},
+        {"tokens_before_cancel", tokens_before_cancel_.load()},
+        {"aborted_tokens", aborted_tokens_.load()}
+    };
+}
+
+nlohmann::json LLMClient::completion_cache_stats() const {
+    if (!completion_cache_) {
+        return {{"enabled", false}};
+    }
+    auto stats = completion_cache_->stats();
+    stats["enabled"] = true;
+    return stats;
 }
 
 // =====================
 // SessionManager Implementation
 // =====================
 
-SessionManager::SessionManager(LLMClient& client, int max_history_messages)
-    : client_(client), max_history_messages_(max_history_messages) {
-    std::cout << "[SessionManager] Initialized with max_history_messages=" << max_history_messages << std::endl;
+SessionManager::SessionManager(LLMClient& client, const LlmConfig& config)
+    : client_(client),
+      max_history_messages_(config.max_history_messages),
+      history_token_budget_(config.history_token_budget),
+      session_ttl_(std::max(0, config.session_ttl)),
+      memory_budget_(static_cast<size_t>(std::max(0, config.session_memory_mb)) * 1024 * 1024),
+      reap_interval_(std::max(1, config.session_reap_interval)) {
+    std::cout << "[SessionManager] Initialized with max_history_messages=" << max_history_messages_
+              << ", history_token_budget=" << history_token_budget_ << std::endl;
+    if (!config.session_store_path.empty()) {
+        try {
+            store_ = std::make_unique<SessionStore>(config.session_store_path,
+                                                    std::chrono::milliseconds(config.session_store_flush_ms));
+            loader_.emplace(2);
+        } catch (const std::exception& e) {
+            std::cerr << "[SessionManager] Session persistence disabled: " << e.what() << std::endl;
+        }
+    }
+    if (session_ttl_.count() > 0 || memory_budget_ > 0) {
+        reaper_ = std::thread([this] { run_reaper(); });
+    }
+}
+
+SessionManager::~SessionManager() {
+    {
+        std::lock_guard<std::mutex> lock(reaper_mutex_);
+        stopping_ = true;
+    }
+    reaper_wake_.notify_all();
+    if (reaper_.joinable()) {
+        reaper_.join();
+    }
+    if (loader_) {
+        loader_->join();
+    }
+}
+
+SessionManager::Shard& SessionManager::shard_for(const std::string& session_id) {
+    // Fibonacci hashing takes the top bits, which the map's own bucketing does not use
+    uint64_t hash = std::hash<std::string>{}(session_id) * 0x9E3779B97F4A7C15ULL;
+    return shards_[hash >> (64 - std::bit_width(kShards - 1))];
+}
+
+std::unique_lock<std::mutex> SessionManager::lock_restored(
+    Shard& shard,
+    const std::string& session_id,
+    std::optional<SessionStore::Record>& restored
+) {
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    while (store_ && !shard.sessions.count(session_id)) {
+        uint64_t generation = shard.generation;
+        lock.unlock();
+        try {
+            restored = store_->load(session_id);
+        } catch (const std::exception& e) {
+            std::cerr << "[SessionManager] Failed to load session " << session_id << ": " << e.what() << std::endl;
+            throw;
+        }
+        lock.lock();
+        if (shard.generation == generation) {
+            break;
+        }
+        // It may have been loaded, changed and evicted again while this load read the file
+        restored.reset();
+    }
+    return lock;
 }
 
 SessionManager::Session& SessionManager::get_or_create_session(
+    Shard& shard,
     const std::string& session_id, 
-    const std::string& system_prompt
+    const std::string& system_prompt,
+    std::optional<SessionStore::Record>& restored
 ) {
-    std::lock_guard<std::mutex> lock(sessions_mutex_);
-    
-    auto it = sessions_.find(session_id);
-    if (it != sessions_.end()) {
-        it->second.last_access = std::chrono::system_clock::now().time_since_epoch().count();
-        return it->second;
+    if (Session* session = find_session(shard, session_id, restored)) {
+        return *session;
     }
     
-    // Create new session
-    Session session;
-    session.dialog.push_back({.role = "system", .content = system_prompt});
-    session.created_at = std::chrono::system_clock::now().time_since_epoch().count();
-    session.last_access = session.created_at;
-    session.message_count = 0;
+    // Create new session: the store has none either, since it would be restored
+    int64_t now = std::chrono::system_clock::now().time_since_epoch().count();
+    Session& session = insert_session(shard, session_id, system_prompt, now);
+    if (store_) {
+        store_->create(session_id, system_prompt, now);
+    }
     
-    sessions_[session_id] = std::move(session);
     std::cout << "[SessionManager] Created new session: " << session_id << std::endl;
+    return session;
+}
+
+SessionManager::Session* SessionManager::find_session(
+    Shard& shard,
+    const std::string& session_id,
+    std::optional<SessionStore::Record>& restored
+) {
+    auto it = shard.sessions.find(session_id);
+    if (it != shard.sessions.end()) {
+        // Loaded concurrently, or never gone; restored is stale either way
+        touch(shard, it->second);
+        return &it->second;
+    }
+    if (!restored) {
+        return nullptr;
+    }
+    
+    Session& session = insert_session(shard, session_id, std::move(restored->system_prompt), restored->created_at);
+    session.message_count = restored->message_count;
+    for (auto& stored : restored->messages) {
+        push_entry(session, stored.seq, std::make_shared<const ChatMessage>(std::move(stored.message)));
+    }
+    if (!session.history.empty()) {
+        session.next_seq = session.history.back().seq + 1;
+    }
+    restored.reset();
     
-    return sessions_[session_id];
+    std::cout << "[SessionManager] Restored session: " << session_id
+              << " (" << session.history.size() << " messages)" << std::endl;
+    return &session;
 }
 
-void SessionManager::trim_history(Session& session) {
-    // Keep system message + last N message pairs
-    if (session.dialog.size() > 1) {
-        int non_system = static_cast<int>(session.dialog.size()) - 1;
-        int max_keep = max_history_messages_ * 2;  // User + assistant pairs
-        
-        if (non_system > max_keep) {
-            // Keep system message and trim old messages
-            std::vector<ChatMessage> new_dialog;
-            new_dialog.push_back(session.dialog[0]);  // System message
-            
-            int start = static_cast<int>(session.dialog.size()) - max_keep;
-            for (size_t i = start; i < session.dialog.size(); ++i) {
-                new_dialog.push_back(session.dialog[i]);
-            }
-            
-            session.dialog = std::move(new_dialog);
+SessionManager::Session& SessionManager::insert_session(
+    Shard& shard,
+    const std::string& session_id,
+    std::string system_prompt,
+    int64_t created_at
+) {
+    auto it = shard.sessions.try_emplace(session_id).first;
+    Session& session = it->second;
+    add_bytes(session, static_cast<int64_t>(kSessionOverhead + session_id.size() + system_prompt.size()));
+    session.system = std::make_shared<const ChatMessage>(ChatMessage{.role = "system", .content = std::move(system_prompt)});
+    session.system_tokens = estimate_message_tokens(*session.system);
+    session.created_at = created_at;
+    session.last_access = std::chrono::system_clock::now().time_since_epoch().count();
+    session.message_count = 0;
+    session.lru_position = shard.lru.insert(shard.lru.end(), &it->first);
+    live_sessions_++;
+    return session;
+}
+
+void SessionManager::touch(Shard& shard, Session& session) {
+    session.last_access = std::chrono::system_clock::now().time_since_epoch().count();
+    shard.lru.splice(shard.lru.end(), shard.lru, session.lru_position);
+}
+
+void SessionManager::append_message(const std::string& session_id, Session& session, MessagePtr message) {
+    int64_t seq = session.next_seq++;
+    push_entry(session, seq, message);
+    // Queued under the shard lock, so the store sees each session's changes in order
+    if (store_ && !store_->append(session_id, seq, std::move(message), session.last_access, session.message_count)) {
+        // The file lost some of this session's changes; write its whole window again
+        std::vector<std::pair<int64_t, MessagePtr>> window;
+        window.reserve(session.history.size());
+        for (size_t i = 0; i < session.history.size(); ++i) {
+            window.emplace_back(session.history[i].seq, session.history[i].message);
         }
+        store_->rewrite(session_id, session.system->content, session.created_at, session.last_access,
+                        session.message_count, std::move(window));
+    }
+}
+
+void SessionManager::push_entry(Session& session, int64_t seq, MessagePtr message) {
+    int tokens = estimate_message_tokens(*message);
+    add_bytes(session, static_cast<int64_t>(entry_bytes(*message)));
+    session.history.push_back({std::move(message), tokens, seq});
+    session.history_tokens += tokens;
+    session.snapshot.reset();
+}
+
+void SessionManager::add_bytes(Session& session, int64_t bytes) {
+    session.bytes += bytes;
+    bytes_held_.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+bool SessionManager::trim_history(Session& session) {
+    size_t max_messages = static_cast<size_t>(std::max(1, max_history_messages_ * 2));  // User + assistant pairs
+    auto over_budget = [&] {
+        return history_token_budget_ > 0 && session.system_tokens + session.history_tokens > history_token_budget_;
+    };
+    auto drop_oldest = [&] {
+        session.history_tokens -= session.history.front().tokens;
+        add_bytes(session, -static_cast<int64_t>(entry_bytes(*session.history.front().message)));
+        session.history.pop_front();
+        session.snapshot.reset();
+    };
+    
+    // The newest message is the one being answered, so it stays even if it alone is over budget
+    bool trimmed = false;
+    while (session.history.size() > 1 && (session.history.size() > max_messages || over_budget())) {
+        drop_oldest();
+        trimmed = true;
+    }
+    // Chat templates expect the history to open with a user message
+    while (trimmed && session.history.size() > 1 && session.history.front().message->role != "user") {
+        drop_oldest();
+    }
+    return trimmed;
+}
+
+SessionManager::DialogSnapshot SessionManager::dialog(Session& session) {
+    if (!session.snapshot) {
+        auto messages = std::make_shared<Dialog>();
+        messages->reserve(session.history.size() + 1);
+        messages->push_back(session.system);
+        for (size_t i = 0; i < session.history.size(); ++i) {
+            messages->push_back(session.history[i].message);
+        }
+        session.snapshot = std::move(messages);
+    }
+    return session.snapshot;
+}
+
+void SessionManager::with_turn(
+    const std::string& session_id,
+    const std::string& system_prompt,
+    const std::string& user_message,
+    TurnCallback then
+) {
+    Shard& shard = shard_for(session_id);
+    std::optional<Turn> turn;
+    {
+        // Checked and begun under one lock, so the session cannot be evicted in between
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (!store_ || shard.sessions.count(session_id)) {
+            std::optional<SessionStore::Record> restored;
+            turn = begin_turn(shard, session_id, system_prompt, user_message, restored);
+        }
+    }
+    if (turn) {
+        then(nullptr, std::move(*turn));
+        return;
+    }
+    
+    // A load waits for the writer and reads SQLite
+    asio::post(*loader_, [this, &shard, session_id, system_prompt, user_message, then = std::move(then)]() {
+        Turn turn;
+        try {
+            std::optional<SessionStore::Record> restored;
+            auto lock = lock_restored(shard, session_id, restored);
+            turn = begin_turn(shard, session_id, system_prompt, user_message, restored);
+        } catch (...) {
+            then(std::current_exception(), {});
+            return;
+        }
+        then(nullptr, std::move(turn));
+    });
+}
+
+SessionManager::Turn SessionManager::begin_turn(
+    Shard& shard,
+    const std::string& session_id,
+    const std::string& system_prompt,
+    const std::string& user_message,
+    std::optional<SessionStore::Record>& restored
+) {
+    Session& session = get_or_create_session(shard, session_id, system_prompt, restored);
+    session.turns_in_flight++;
+    
+    // Add user message
+    session.message_count++;
+    append_message(session_id, session, std::make_shared<const ChatMessage>(ChatMessage{.role = "user", .content = user_message}));
+    
+    // Trim history
+    if (trim_history(session) && store_) {
+        store_->trim(session_id, session.history.front().seq, session.last_access, session.message_count);
+    }
+    
+    // Serialized by the caller after the lock is released
+    return {dialog(session), session.affinity};
+}
+
+void SessionManager::end_turn(const std::string& session_id, std::optional<std::string> reply) {
+    Shard& shard = shard_for(session_id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    // The turn kept the session in memory; it is only missing if it was cleared
+    auto it = shard.sessions.find(session_id);
+    if (it == shard.sessions.end()) {
+        return;
+    }
+    Session& session = it->second;
+    if (session.turns_in_flight > 0) {
+        session.turns_in_flight--;
+    }
+    touch(shard, session);
+    if (reply) {
+        append_message(session_id, session, std::make_shared<const ChatMessage>(ChatMessage{.role = "assistant", .content = std::move(*reply)}));
     }
 }
 
@@ -343,37 +955,44 @@ std::string SessionManager::process_message(
     std::optional<double> top_p,
     std::optional<int> max_tokens
 ) {
-    Session* session_ptr;
-    std::vector<ChatMessage> messages;
-    
-    {
-        std::lock_guard<std::mutex> lock(sessions_mutex_);
-        session_ptr = &get_or_create_session(session_id, system_prompt);
-        
-        // Add user message
-        session_ptr->dialog.push_back({.role = "user", .content = user_message});
-        session_ptr->message_count++;
-        
-        // Trim history
-        trim_history(*session_ptr);
-        
-        // Copy messages for inference
-        messages = session_ptr->dialog;
-    }
+    std::promise<std::string> promise;
+    auto future = promise.get_future();
     
-    // Generate response (without holding lock)
-    std::string response = client_.generate(messages, temperature, top_p, max_tokens);
-    
-    // Add assistant response to history
-    {
-        std::lock_guard<std::mutex> lock(sessions_mutex_);
-        auto it = sessions_.find(session_id);
-        if (it != sessions_.end()) {
-            it->second.dialog.push_back({.role = "assistant", .content = response});
+    process_message_async(session_id, system_prompt, user_message, [&promise](std::exception_ptr error, std::string response) {
+        if (error) {
+            promise.set_exception(error);
+        } else {
+            promise.set_value(std::move(response));
         }
-    }
+    }, temperature, top_p, max_tokens);
     
-    return response;
+    return future.get();
+}
+
+void SessionManager::process_message_async(
+    const std::string& session_id,
+    const std::string& system_prompt,
+    const std::string& user_message,
+    LLMClient::CompletionCallback on_done,
+    std::optional<double> temperature,
+    std::optional<double> top_p,
+    std::optional<int> max_tokens,
+    RequestContext context
+) {
+    with_turn(session_id, system_prompt, user_message, [this, session_id, on_done = std::move(on_done),
+                                                        temperature, top_p, max_tokens, context = std::move(context)](
+            std::exception_ptr error, Turn turn) mutable {
+        if (error) {
+            on_done(error, "");
+            return;
+        }
+        context.affinity = turn.affinity;
+        
+        client_.generate_async(*turn.dialog, [this, session_id, on_done = std::move(on_done)](std::exception_ptr error, std::string response) {
+            end_turn(session_id, error ? std::nullopt : std::optional<std::string>(response));
+            on_done(error, std::move(response));
+        }, temperature, top_p, max_tokens, "default", std::move(context));
+    });
 }
 
 void SessionManager::process_message_stream(
@@ -385,58 +1004,199 @@ void SessionManager::process_message_stream(
     std::optional<double> top_p,
     std::optional<int> max_tokens
 ) {
-    Session* session_ptr;
-    std::vector<ChatMessage> messages;
-    
-    {
-        std::lock_guard<std::mutex> lock(sessions_mutex_);
-        session_ptr = &get_or_create_session(session_id, system_prompt);
-        
-        // Add user message
-        session_ptr->dialog.push_back({.role = "user", .content = user_message});
-        session_ptr->message_count++;
-        
-        // Trim history
-        trim_history(*session_ptr);
-        
-        // Copy messages for inference
-        messages = session_ptr->dialog;
-    }
+    std::promise<void> promise;
+    auto future = promise.get_future();
     
-    // Collect full response
-    std::string full_response;
-    auto collector = [&](const std::string& chunk) {
-        full_response += chunk;
-        on_chunk(chunk);
-    };
+    process_message_stream_async(session_id, system_prompt, user_message, on_chunk, [&promise](std::exception_ptr error) {
+        if (error) {
+            promise.set_exception(error);
+        } else {
+            promise.set_value();
+        }
+    }, temperature, top_p, max_tokens);
     
-    // Generate streaming response (without holding lock)
-    client_.generate_stream(messages, collector, temperature, top_p, max_tokens);
+    try {
+        future.get();
+    } catch (const std::exception& e) {
+        on_chunk(std::string("Error: ") + e.what());
+    }
+}
+
+void SessionManager::process_message_stream_async(
+    const std::string& session_id,
+    const std::string& system_prompt,
+    const std::string& user_message,
+    LLMClient::ChunkCallback on_chunk,
+    LLMClient::StreamDoneCallback on_done,
+    std::optional<double> temperature,
+    std::optional<double> top_p,
+    std::optional<int> max_tokens,
+    RequestContext context
+) {
+    with_turn(session_id, system_prompt, user_message, [this, session_id, on_chunk = std::move(on_chunk),
+                                                        on_done = std::move(on_done), temperature, top_p, max_tokens,
+                                                        context = std::move(context)](
+            std::exception_ptr error, Turn turn) mutable {
+        if (error) {
+            on_done(error);
+            return;
+        }
+        context.affinity = turn.affinity;
+        auto full_response = std::make_shared<std::string>();
+        
+        client_.generate_stream_async(
+            *turn.dialog,
+            [full_response, on_chunk = std::move(on_chunk)](const std::string& chunk) {
+                *full_response += chunk;
+                on_chunk(chunk);
+            },
+            [this, session_id, full_response, on_done = std::move(on_done)](std::exception_ptr error) {
+                end_turn(session_id, error ? std::nullopt : std::optional<std::string>(std::move(*full_response)));
+                on_done(error);
+            },
+            temperature, top_p, max_tokens, "default", std::move(context)
+        );
+    });
+}
+
+SessionManager::DialogSnapshot SessionManager::get_session_history(const std::string& session_id) {
+    Shard& shard = shard_for(session_id);
+    std::optional<SessionStore::Record> restored;
+    auto lock = lock_restored(shard, session_id, restored);
     
-    // Add assistant response to history
+    if (Session* session = find_session(shard, session_id, restored)) {
+        return dialog(*session);
+    }
+    return nullptr;
+}
+
+void SessionManager::clear_session(const std::string& session_id) {
+    Shard& shard = shard_for(session_id);
+    SessionMap::node_type cleared;
     {
-        std::lock_guard<std::mutex> lock(sessions_mutex_);
-        auto it = sessions_.find(session_id);
-        if (it != sessions_.end()) {
-            it->second.dialog.push_back({.role = "assistant", .content = full_response});
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (store_) {
+            store_->remove(session_id);
+        }
+        // Even when it is not in memory: a load of it may be running, and must not restore it
+        shard.generation++;
+        auto it = shard.sessions.find(session_id);
+        if (it == shard.sessions.end()) {
+            return;
         }
+        shard.lru.erase(it->second.lru_position);
+        bytes_held_.fetch_sub(static_cast<int64_t>(it->second.bytes), std::memory_order_relaxed);
+        live_sessions_--;
+        cleared = shard.sessions.extract(it);
     }
+    std::cout << "[SessionManager] Cleared session: " << session_id << std::endl;
+}
+
+nlohmann::json SessionManager::stats() const {
+    return {
+        {"live_sessions", live_sessions_.load()},
+        {"bytes", bytes_held_.load()},
+        {"memory_budget_bytes", memory_budget_},
+        {"evicted_idle", evicted_idle_.load()},
+        {"evicted_memory", evicted_memory_.load()},
+        {"store", store_ ? store_->stats() : nlohmann::json(nullptr)}
+    };
 }
 
-std::optional<std::vector<ChatMessage>> SessionManager::get_session_history(const std::string& session_id) {
-    std::lock_guard<std::mutex> lock(sessions_mutex_);
+void SessionManager::run_reaper() {
+    std::unique_lock<std::mutex> lock(reaper_mutex_);
+    while (!reaper_wake_.wait_for(lock, reap_interval_, [this] { return stopping_; })) {
+        lock.unlock();
+        try {
+            reap();
+        } catch (const std::exception& e) {
+            std::cerr << "[SessionManager] Eviction failed: " << e.what() << std::endl;
+        }
+        lock.lock();
+    }
+}
+
+void SessionManager::reap() {
+    uint64_t idle_before = evicted_idle_.load();
+    uint64_t memory_before = evicted_memory_.load();
+    
+    if (session_ttl_.count() > 0) {
+        int64_t cutoff = (std::chrono::system_clock::now() - session_ttl_).time_since_epoch().count();
+        for (auto& shard : shards_) {
+            evicted_idle_ += evict_lru(shard, [cutoff](const Session& session) {
+                return session.last_access < cutoff;
+            });
+        }
+    }
+    if (memory_budget_ > 0) {
+        evict_to_budget();
+    }
     
-    auto it = sessions_.find(session_id);
-    if (it != sessions_.end()) {
-        return it->second.dialog;
+    uint64_t idle = evicted_idle_.load() - idle_before;
+    uint64_t memory = evicted_memory_.load() - memory_before;
+    if (idle + memory > 0) {
+        std::cout << "[SessionManager] Evicted " << idle << " idle and " << memory << " over-budget sessions, "
+                  << live_sessions_.load() << " live" << std::endl;
     }
-    return std::nullopt;
 }
 
-void SessionManager::clear_session(const std::string& session_id) {
-    std::lock_guard<std::mutex> lock(sessions_mutex_);
-    sessions_.erase(session_id);
-    std::cout << "[SessionManager] Cleared session: " << session_id << std::endl;
+size_t SessionManager::evict_lru(Shard& shard, const std::function<bool(const Session&)>& should_evict) {
+    // Freed when this returns, after the shard lock is released
+    std::vector<SessionMap::node_type> evicted;
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    for (auto lru = shard.lru.begin(); lru != shard.lru.end();) {
+        auto it = shard.sessions.find(**lru);
+        if (!should_evict(it->second)) {
+            break;
+        }
+        if (it->second.turns_in_flight > 0) {
+            ++lru;  // Its reply is still to be appended
+            continue;
+        }
+        lru = shard.lru.erase(lru);
+        bytes_held_.fetch_sub(static_cast<int64_t>(it->second.bytes), std::memory_order_relaxed);
+        live_sessions_--;
+        evicted.push_back(shard.sessions.extract(it));
+    }
+    if (!evicted.empty()) {
+        shard.generation++;
+    }
+    return evicted.size();
+}
+
+void SessionManager::evict_to_budget() {
+    auto over_budget = [this] {
+        return bytes_held_.load(std::memory_order_relaxed) > static_cast<int64_t>(memory_budget_);
+    };
+    while (over_budget()) {
+        // Shards are LRU-ordered individually; drain the one whose oldest session
+        // is oldest overall, down to the next shard's oldest
+        Shard* oldest = nullptr;
+        int64_t oldest_access = std::numeric_limits<int64_t>::max();
+        int64_t next_access = std::numeric_limits<int64_t>::max();
+        for (auto& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            if (shard.lru.empty()) continue;
+            int64_t access = shard.sessions.find(*shard.lru.front())->second.last_access;
+            if (access < oldest_access) {
+                next_access = oldest_access;
+                oldest_access = access;
+                oldest = &shard;
+            } else if (access < next_access) {
+                next_access = access;
+            }
+        }
+        if (!oldest) {
+            break;
+        }
+        size_t evicted = evict_lru(*oldest, [&](const Session& session) {
+            return over_budget() && session.last_access <= next_access;
+        });
+        if (evicted == 0) {
+            break;  // Its oldest session was just used; try again next pass
+        }
+        evicted_memory_ += evicted;
+    }
 }
 
 // =====================
@@ -448,7 +1208,7 @@ static std::unique_ptr<SessionManager> g_session_manager;
 
 void init_llm_service(const LlmConfig& config) {
     g_llm_client = std::make_unique<LLMClient>(config);
-    g_session_manager = std::make_unique<SessionManager>(*g_llm_client, 20);
+    g_session_manager = std::make_unique<SessionManager>(*g_llm_client, config);
     std::cout << "[LLM] Service initialized with server: " << config.server_url << std::endl;
 }
 
@@ -462,7 +1222,7 @@ LLMClient& get_llm_client() {
 
 SessionManager& get_session_manager() {
     if (!g_session_manager) {
-        g_session_manager = std::make_unique<SessionManager>(get_llm_client(), 20);
+        g_session_manager = std::make_unique<SessionManager>(get_llm_client(), get_config().llm);
     }
     return *g_session_manager;
 }
@@ -3,6 +3,7 @@
 #include "database.hpp"
 #include "auth.hpp"
 #include "llm_client.hpp"
+#include "stream_server.hpp"
 #include "handlers/auth_handler.hpp"
 #include "handlers/template_handler.hpp"
 #include "handlers/leaderboard_handler.hpp"
@@ -33,6 +34,7 @@ int main(int argc, char* argv[]) {
     }
     
     std::cout << "[Main] Loading configuration from: " << config_path << std::endl;
+    auto& config = get_config();
     
     // Initialize database
     std::cout << "[Main] Initializing database..." << std::endl;
@@ -47,8 +49,6 @@ int main(int argc, char* argv[]) {
     
     // Create Crow application
     crow::SimpleApp app;
-    
-    auto& config = get_config();
 
     // ========================
     // CORS Preflight Handler
@@ -255,31 +255,33 @@ int main(int argc, char* argv[]) {
     // LLM Routes
     // ========================
     CROW_ROUTE(app, "/api/llm/chat").methods(crow::HTTPMethod::POST)
-    ([&](const crow::request& req) {
-        auto res = LLMHandler::chat(req);
+    ([&](const crow::request& req, crow::response& res) {
         add_cors(res, req);
-        return res;
+        LLMHandler::chat(req, res);
     });
 
     CROW_ROUTE(app, "/api/llm/chat/session").methods(crow::HTTPMethod::POST)
-    ([&](const crow::request& req) {
-        auto res = LLMHandler::session_chat(req);
+    ([&](const crow::request& req, crow::response& res) {
         add_cors(res, req);
-        return res;
+        LLMHandler::session_chat(req, res);
     });
 
     CROW_ROUTE(app, "/api/llm/chat/stream").methods(crow::HTTPMethod::POST)
-    ([&](const crow::request& req) {
-        auto res = LLMHandler::chat_stream(req);
+    ([&](const crow::request& req, crow::response& res) {
         add_cors(res, req);
-        return res;
+        LLMHandler::chat_stream(req, res);
     });
 
     CROW_ROUTE(app, "/api/llm/chat/session/stream").methods(crow::HTTPMethod::POST)
-    ([&](const crow::request& req) {
-        auto res = LLMHandler::session_chat_stream(req);
+    ([&](const crow::request& req, crow::response& res) {
         add_cors(res, req);
-        return res;
+        LLMHandler::session_chat_stream(req, res);
+    });
+
+    CROW_ROUTE(app, "/api/llm/chat/batch").methods(crow::HTTPMethod::POST)
+    ([&](const crow::request& req, crow::response& res) {
+        add_cors(res, req);
+        LLMHandler::chat_batch(req, res);
     });
 
     CROW_ROUTE(app, "/api/llm/chat/session/<string>/history").methods(crow::HTTPMethod::GET)
@@ -310,6 +312,20 @@ int main(int argc, char* argv[]) {
         return res;
     });
 
+    CROW_ROUTE(app, "/api/llm/metrics").methods(crow::HTTPMethod::GET)
+    ([&](const crow::request& req) {
+        auto res = LLMHandler::metrics(req);
+        add_cors(res, req);
+        return res;
+    });
+
+    CROW_ROUTE(app, "/api/llm/usage").methods(crow::HTTPMethod::GET)
+    ([&](const crow::request& req) {
+        auto res = LLMHandler::usage(req);
+        add_cors(res, req);
+        return res;
+    });
+
     // ========================
     // Root Route
     // ========================
@@ -326,6 +342,28 @@ int main(int argc, char* argv[]) {
         return res;
     });
 
+    // ========================
+    // Streaming Routes
+    // ========================
+    // Crow sends a dynamic body only when it ends, so the SSE and NDJSON routes above
+    // deliver their events all at once; these serve the same handlers frame by frame
+    if (config.server.stream_port > 0) {
+        auto& streams = StreamServer::instance();
+        streams.route("POST", "/api/llm/chat/stream",
+            [](const StreamRequest& req, std::shared_ptr<ResponseStream> out) {
+                LLMHandler::chat_stream(req.get_header_value("Authorization"), req.body, std::move(out));
+            });
+        streams.route("POST", "/api/llm/chat/session/stream",
+            [](const StreamRequest& req, std::shared_ptr<ResponseStream> out) {
+                LLMHandler::session_chat_stream(req.get_header_value("Authorization"), req.body, std::move(out));
+            });
+        streams.route("POST", "/api/llm/chat/batch",
+            [](const StreamRequest& req, std::shared_ptr<ResponseStream> out) {
+                LLMHandler::chat_batch(req.get_header_value("Authorization"), req.body, std::move(out));
+            });
+        streams.start(config.server.host, config.server.stream_port, config.server.threads);
+    }
+
     // ========================
     // Start Server
     // ========================
@@ -337,6 +375,7 @@ int main(int argc, char* argv[]) {
        .multithreaded()
        .run();
 
+    StreamServer::instance().stop();
     return 0;
 }
 
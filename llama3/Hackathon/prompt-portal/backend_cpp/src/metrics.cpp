@@ -0,0 +1,66 @@
+#include "metrics.hpp"
+#include <algorithm>
+#include <bit>
+
+namespace prompt_portal {
+
+void Log2Histogram::record(uint64_t value) {
+    size_t bucket = std::min<size_t>(std::bit_width(value), kBuckets - 1);
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+
+    uint64_t current = max_.load(std::memory_order_relaxed);
+    while (value > current && !max_.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+}
+
+double Log2Histogram::mean() const {
+    uint64_t total = count();
+    return total > 0 ? static_cast<double>(sum()) / total : 0.0;
+}
+
+uint64_t Log2Histogram::percentile(double q) const {
+    uint64_t total = count();
+    if (total == 0) return 0;
+
+    uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(total));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; ++i) {
+        seen += buckets_[i].load(std::memory_order_relaxed);
+        if (seen > rank) {
+            // Bucket i holds values in [2^(i-1), 2^i)
+            uint64_t upper = i == 0 ? 0 : (uint64_t{1} << i) - 1;
+            return std::min(upper, max());
+        }
+    }
+    return max();
+}
+
+nlohmann::json Log2Histogram::to_json() const {
+    return {
+        {"count", count()},
+        {"mean", mean()},
+        {"p50", percentile(0.50)},
+        {"p95", percentile(0.95)},
+        {"p99", percentile(0.99)},
+        {"max", max()}
+    };
+}
+
+void LatencyHistogram::record(std::chrono::steady_clock::duration elapsed) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    record_us(us > 0 ? static_cast<uint64_t>(us) : 0);
+}
+
+nlohmann::json LatencyHistogram::to_json() const {
+    return {
+        {"count", values_.count()},
+        {"mean_ms", values_.mean() / 1000.0},
+        {"p50_ms", values_.percentile(0.50) / 1000.0},
+        {"p95_ms", values_.percentile(0.95) / 1000.0},
+        {"p99_ms", values_.percentile(0.99) / 1000.0},
+        {"max_ms", values_.max() / 1000.0}
+    };
+}
+
+} // namespace prompt_portal
@@ -0,0 +1,317 @@
+#include "session_store.hpp"
+#include <algorithm>
+#include <iostream>
+#include <string_view>
+
+namespace prompt_portal {
+
+SessionStore::SessionStore(const std::string& path, std::chrono::milliseconds flush_interval)
+    : flush_interval_(std::max(std::chrono::milliseconds(1), flush_interval)),
+      writer_db_(path, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE),
+      reader_db_(path, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE) {
+    writer_db_.setBusyTimeout(5000);
+    reader_db_.setBusyTimeout(5000);
+    // A crash loses at most the last flush interval; NORMAL is durable up to the last checkpoint in WAL mode
+    writer_db_.exec("PRAGMA journal_mode=WAL");
+    writer_db_.exec("PRAGMA synchronous=NORMAL");
+    writer_db_.exec(R"(
+        CREATE TABLE IF NOT EXISTS chat_sessions (
+            session_id TEXT PRIMARY KEY,
+            system_prompt TEXT NOT NULL,
+            created_at INTEGER NOT NULL,
+            last_access INTEGER NOT NULL,
+            message_count INTEGER NOT NULL DEFAULT 0
+        )
+    )");
+    writer_db_.exec(R"(
+        CREATE TABLE IF NOT EXISTS chat_messages (
+            session_id TEXT NOT NULL,
+            seq INTEGER NOT NULL,
+            role TEXT NOT NULL,
+            content TEXT NOT NULL,
+            PRIMARY KEY (session_id, seq)
+        ) WITHOUT ROWID
+    )");
+
+    writer_ = std::thread([this] { run_writer(); });
+    std::cout << "[SessionStore] Persisting sessions to " << path << std::endl;
+}
+
+SessionStore::~SessionStore() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_writer_.notify_all();
+    if (writer_.joinable()) {
+        writer_.join();
+    }
+}
+
+void SessionStore::create(const std::string& session_id, const std::string& system_prompt, int64_t created_at) {
+    enqueue({.kind = OpKind::Create, .session_id = session_id, .time = created_at, .system_prompt = system_prompt});
+}
+
+bool SessionStore::append(const std::string& session_id, int64_t seq, MessagePtr message,
+                          int64_t last_access, int message_count) {
+    return enqueue({.kind = OpKind::Append, .session_id = session_id, .seq = seq, .time = last_access,
+             .message_count = message_count, .message = std::move(message)});
+}
+
+void SessionStore::trim(const std::string& session_id, int64_t first_kept_seq, int64_t last_access, int message_count) {
+    enqueue({.kind = OpKind::Trim, .session_id = session_id, .seq = first_kept_seq, .time = last_access,
+             .message_count = message_count});
+}
+
+void SessionStore::remove(const std::string& session_id) {
+    enqueue({.kind = OpKind::Remove, .session_id = session_id});
+}
+
+void SessionStore::rewrite(const std::string& session_id, const std::string& system_prompt, int64_t created_at,
+                           int64_t last_access, int message_count,
+                           std::vector<std::pair<int64_t, MessagePtr>> messages) {
+    enqueue({.kind = OpKind::Rewrite, .session_id = session_id, .time = last_access, .created_at = created_at,
+             .message_count = message_count, .system_prompt = system_prompt, .messages = std::move(messages)});
+}
+
+bool SessionStore::enqueue(Op op) {
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (op.kind == OpKind::Append && !dirty_.empty() && dirty_.count(op.session_id)) {
+            return false;  // Appending would leave the gap in place; the caller rewrites instead
+        }
+        if (op.kind == OpKind::Trim) {
+            // A later trim covers an earlier one. It runs at the earlier one's place,
+            // so write_batch() skips the appends after it that it would have deleted
+            auto queued = queued_trims_.find(op.session_id);
+            if (queued != queued_trims_.end()) {
+                Op& trim = queue_[queued->second];
+                trim.seq = std::max(trim.seq, op.seq);
+                trim.time = op.time;
+                trim.message_count = op.message_count;
+                return true;
+            }
+            queued_trims_.emplace(op.session_id, queue_.size());
+        } else if ((op.kind == OpKind::Append || op.kind == OpKind::Rewrite) && queue_.size() >= kMaxQueued) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            dirty_.insert(op.session_id);
+            return false;
+        } else if (op.kind != OpKind::Append) {
+            // Trims queued before a create, remove or rewrite must not absorb later ones
+            queued_trims_.erase(op.session_id);
+            if (op.kind == OpKind::Rewrite || op.kind == OpKind::Remove) {
+                dirty_.erase(op.session_id);
+            }
+            if (op.kind == OpKind::Rewrite) {
+                rewrites_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        ++pending_[op.session_id];
+        queue_.push_back(std::move(op));
+        wake = queue_.size() == kBatchSize;
+    }
+    if (wake) {
+        wake_writer_.notify_one();
+    }
+    return true;
+}
+
+std::optional<SessionStore::Record> SessionStore::load(const std::string& session_id) {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (pending_.count(session_id)) {
+            flush_now_ = true;
+            wake_writer_.notify_one();
+            written_.wait(lock, [&] { return !pending_.count(session_id); });
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(reader_mutex_);
+    SQLite::Statement session(reader_db_,
+        "SELECT system_prompt, created_at, last_access, message_count FROM chat_sessions WHERE session_id = ?");
+    session.bind(1, session_id);
+    if (!session.executeStep()) {
+        return std::nullopt;
+    }
+    Record record;
+    record.system_prompt = session.getColumn(0).getText();
+    record.created_at = session.getColumn(1).getInt64();
+    record.last_access = session.getColumn(2).getInt64();
+    record.message_count = session.getColumn(3).getInt();
+
+    SQLite::Statement messages(reader_db_,
+        "SELECT seq, role, content FROM chat_messages WHERE session_id = ? ORDER BY seq");
+    messages.bind(1, session_id);
+    while (messages.executeStep()) {
+        int64_t seq = messages.getColumn(0).getInt64();
+        if (!record.messages.empty() && seq != record.messages.back().seq + 1) {
+            // Lost changes left a gap; what came before it may no longer pair up
+            record.messages.clear();
+        }
+        record.messages.push_back({
+            seq,
+            {.role = messages.getColumn(1).getText(), .content = messages.getColumn(2).getText()}
+        });
+    }
+    // The history opens with a user message, as after a trim
+    auto first_user = std::find_if(record.messages.begin(), record.messages.end(),
+                                   [](const StoredMessage& stored) { return stored.message.role == "user"; });
+    record.messages.erase(record.messages.begin(), first_user);
+    loaded_.fetch_add(1, std::memory_order_relaxed);
+    return record;
+}
+
+void SessionStore::run_writer() {
+    std::vector<Op> batch;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        wake_writer_.wait_for(lock, flush_interval_, [this] {
+            return stopping_ || flush_now_ || queue_.size() >= kBatchSize;
+        });
+        if (queue_.empty()) {
+            flush_now_ = false;
+            if (stopping_) return;
+            continue;
+        }
+        batch.swap(queue_);
+        queued_trims_.clear();
+        flush_now_ = false;
+        lock.unlock();
+
+        bool written = write_batch(batch);
+
+        lock.lock();
+        for (const auto& op : batch) {
+            if (!written && op.kind != OpKind::Remove) {
+                dirty_.insert(op.session_id);
+            }
+            auto it = pending_.find(op.session_id);
+            if (--it->second == 0) pending_.erase(it);
+        }
+        batch.clear();
+        written_.notify_all();
+    }
+}
+
+bool SessionStore::write_batch(const std::vector<Op>& batch) {
+    try {
+        // Prepared once per batch; a batch is usually many ops
+        SQLite::Statement create(writer_db_,
+            "INSERT OR IGNORE INTO chat_sessions (session_id, system_prompt, created_at, last_access, message_count) "
+            "VALUES (?, ?, ?, ?, 0)");
+        SQLite::Statement replace(writer_db_,
+            "INSERT OR REPLACE INTO chat_sessions (session_id, system_prompt, created_at, last_access, message_count) "
+            "VALUES (?, ?, ?, ?, ?)");
+        SQLite::Statement append(writer_db_,
+            "INSERT OR REPLACE INTO chat_messages (session_id, seq, role, content) VALUES (?, ?, ?, ?)");
+        SQLite::Statement touch(writer_db_,
+            "UPDATE chat_sessions SET last_access = ?, message_count = ? WHERE session_id = ?");
+        SQLite::Statement trim(writer_db_, "DELETE FROM chat_messages WHERE session_id = ? AND seq < ?");
+        SQLite::Statement remove_messages(writer_db_, "DELETE FROM chat_messages WHERE session_id = ?");
+        SQLite::Statement remove_session(writer_db_, "DELETE FROM chat_sessions WHERE session_id = ?");
+        auto run = [](SQLite::Statement& statement) {
+            statement.exec();
+            statement.reset();
+        };
+
+        // Per session, the first seq kept by a trim earlier in this batch
+        std::unordered_map<std::string_view, int64_t> trimmed_below;
+        
+        SQLite::Transaction transaction(writer_db_);
+        for (const auto& op : batch) {
+            switch (op.kind) {
+                case OpKind::Create:
+                    trimmed_below.erase(op.session_id);
+                    create.bind(1, op.session_id);
+                    create.bindNoCopy(2, op.system_prompt);
+                    create.bind(3, op.time);
+                    create.bind(4, op.time);
+                    run(create);
+                    break;
+                case OpKind::Append:
+                    if (auto trimmed = trimmed_below.find(op.session_id);
+                            trimmed != trimmed_below.end() && op.seq < trimmed->second) {
+                        break;  // Trimmed by a coalesced trim queued before it
+                    }
+                    append.bind(1, op.session_id);
+                    append.bind(2, op.seq);
+                    append.bindNoCopy(3, op.message->role);
+                    append.bindNoCopy(4, op.message->content);
+                    run(append);
+                    touch.bind(1, op.time);
+                    touch.bind(2, op.message_count);
+                    touch.bind(3, op.session_id);
+                    run(touch);
+                    break;
+                case OpKind::Trim:
+                    trimmed_below[op.session_id] = op.seq;
+                    trim.bind(1, op.session_id);
+                    trim.bind(2, op.seq);
+                    run(trim);
+                    touch.bind(1, op.time);
+                    touch.bind(2, op.message_count);
+                    touch.bind(3, op.session_id);
+                    run(touch);
+                    break;
+                case OpKind::Remove:
+                    trimmed_below.erase(op.session_id);
+                    remove_messages.bind(1, op.session_id);
+                    run(remove_messages);
+                    remove_session.bind(1, op.session_id);
+                    run(remove_session);
+                    break;
+                case OpKind::Rewrite:
+                    trimmed_below.erase(op.session_id);
+                    remove_messages.bind(1, op.session_id);
+                    run(remove_messages);
+                    replace.bind(1, op.session_id);
+                    replace.bindNoCopy(2, op.system_prompt);
+                    replace.bind(3, op.created_at);
+                    replace.bind(4, op.time);
+                    replace.bind(5, op.message_count);
+                    run(replace);
+                    for (const auto& [seq, message] : op.messages) {
+                        append.bind(1, op.session_id);
+                        append.bind(2, seq);
+                        append.bindNoCopy(3, message->role);
+                        append.bindNoCopy(4, message->content);
+                        run(append);
+                    }
+                    break;
+            }
+        }
+        transaction.commit();
+        written_ops_.fetch_add(batch.size(), std::memory_order_relaxed);
+        batches_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    } catch (const std::exception& e) {
+        failed_batches_.fetch_add(1, std::memory_order_relaxed);
+        failed_ops_.fetch_add(batch.size(), std::memory_order_relaxed);
+        std::cerr << "[SessionStore] Failed to write " << batch.size() << " changes: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+nlohmann::json SessionStore::stats() const {
+    size_t queued;
+    size_t dirty;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queued = queue_.size();
+        dirty = dirty_.size();
+    }
+    return {
+        {"queued", queued},
+        {"written", written_ops_.load()},
+        {"batches", batches_.load()},
+        {"dropped", dropped_.load()},
+        {"failed_batches", failed_batches_.load()},
+        {"failed_ops", failed_ops_.load()},
+        {"dirty", dirty},
+        {"rewrites", rewrites_.load()},
+        {"loaded", loaded_.load()}
+    };
+}
+
+} // namespace prompt_portal
@@ -0,0 +1,455 @@
+#include "stream_server.hpp"
+#include "http_client.hpp"
+#include "cancellation.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <future>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+namespace prompt_portal {
+
+namespace {
+
+constexpr size_t kMaxHeaderBytes = 16 * 1024;
+constexpr size_t kMaxBodyBytes = 8 * 1024 * 1024;
+constexpr size_t kMaxQueuedBytes = 1024 * 1024;
+constexpr auto kRequestTimeout = std::chrono::seconds(30);
+
+std::string lower(std::string_view text) {
+    std::string result(text);
+    std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c) { return std::tolower(c); });
+    return result;
+}
+
+std::string_view trim(std::string_view text) {
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) text.remove_prefix(1);
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) text.remove_suffix(1);
+    return text;
+}
+
+const char* reason_phrase(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 204: return "No Content";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 411: return "Length Required";
+        case 413: return "Payload Too Large";
+        case 429: return "Too Many Requests";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        case 503: return "Service Unavailable";
+        case 504: return "Gateway Timeout";
+    }
+    return "";
+}
+
+} // anonymous namespace
+
+std::string StreamRequest::get_header_value(const std::string& name) const {
+    auto it = headers.find(lower(name));
+    return it == headers.end() ? "" : it->second;
+}
+
+/**
+ * One client connection. Everything after construction runs on the socket's
+ * strand; the ResponseStream calls only post onto it.
+ */
+class StreamServer::Connection : public ResponseStream, public std::enable_shared_from_this<Connection> {
+public:
+    Connection(StreamServer& server, asio::ip::tcp::socket socket)
+        : server_(server),
+          socket_(std::move(socket)),
+          timer_(socket_.get_executor()),
+          buffer_(kMaxHeaderBytes) {
+        server_.active_++;
+    }
+
+    ~Connection() override {
+        server_.active_--;
+    }
+
+    void start() {
+        auto self = shared_from_this();
+        // Covers reading the request; a client that never sends one is dropped
+        timer_.expires_after(kRequestTimeout);
+        timer_.async_wait([self](const asio::error_code& ec) {
+            if (!ec) self->close();
+        });
+        asio::async_read_until(socket_, buffer_, "\r\n\r\n", [self](const asio::error_code& ec, size_t head_size) {
+            if (ec == asio::error::not_found) return self->reject(431, "Request headers too large");
+            if (ec) return self->close();
+            self->on_head(head_size);
+        });
+    }
+
+    void begin(int status, const ResponseHeaders& headers) override {
+        asio::post(socket_.get_executor(), [self = shared_from_this(), status, headers]() {
+            self->do_begin(status, headers);
+        });
+    }
+
+    bool write(std::string data) override {
+        if (!open_.load(std::memory_order_acquire)) return false;
+        asio::post(socket_.get_executor(), [self = shared_from_this(), data = std::move(data)]() mutable {
+            self->do_write(std::move(data));
+        });
+        return true;
+    }
+
+    void end() override {
+        asio::post(socket_.get_executor(), [self = shared_from_this()]() {
+            self->do_end();
+        });
+    }
+
+    bool client_connected() override {
+        return open_.load(std::memory_order_acquire);
+    }
+
+    void on_disconnect(std::function<void()> callback) override {
+        disconnected_.on_cancel(std::move(callback));
+    }
+
+private:
+    StreamServer& server_;
+    asio::ip::tcp::socket socket_;
+    asio::steady_timer timer_;
+    asio::streambuf buffer_;
+    StreamRequest request_;
+
+    std::atomic<bool> open_{true};
+    CancellationToken disconnected_;
+    char probe_[512];
+    bool begun_ = false;
+    bool ended_ = false;
+    bool completed_ = false;
+    bool writing_ = false;
+    std::vector<std::string> pending_;   // Queued since the last write started
+    std::vector<std::string> in_flight_;  // Owned until async_write completes
+    size_t queued_bytes_ = 0;
+
+    void on_head(size_t head_size) {
+        std::string head(asio::buffers_begin(buffer_.data()), asio::buffers_begin(buffer_.data()) + head_size);
+        buffer_.consume(head_size);
+        if (!parse_head(head)) {
+            server_.bad_requests_++;
+            return reject(400, "Malformed request");
+        }
+        if (!request_.get_header_value("Transfer-Encoding").empty()) {
+            server_.bad_requests_++;
+            return reject(411, "Send the request body with Content-Length");
+        }
+
+        size_t length = 0;
+        std::string content_length = request_.get_header_value("Content-Length");
+        if (!content_length.empty()) {
+            try {
+                length = std::stoull(content_length);
+            } catch (...) {
+                server_.bad_requests_++;
+                return reject(400, "Invalid Content-Length");
+            }
+        }
+        if (length > kMaxBodyBytes) {
+            return reject(413, "Request body too large");
+        }
+
+        // Part of the body may have arrived with the headers
+        size_t buffered = std::min(length, buffer_.size());
+        request_.body.reserve(length);
+        request_.body.append(asio::buffers_begin(buffer_.data()), asio::buffers_begin(buffer_.data()) + buffered);
+        buffer_.consume(buffered);
+        if (request_.body.size() == length) {
+            return dispatch();
+        }
+
+        auto self = shared_from_this();
+        if (lower(request_.get_header_value("Expect")) == "100-continue") {
+            static const std::string kContinue = "HTTP/1.1 100 Continue\r\n\r\n";
+            return asio::async_write(socket_, asio::buffer(kContinue), [self, length](const asio::error_code& ec, size_t) {
+                if (ec) return self->close();
+                self->read_body(length);
+            });
+        }
+        read_body(length);
+    }
+
+    bool parse_head(const std::string& head) {
+        std::string_view rest = head;
+        auto next_line = [&rest]() {
+            size_t end = rest.find("\r\n");
+            std::string_view line = rest.substr(0, end);
+            rest.remove_prefix(end == std::string_view::npos ? rest.size() : end + 2);
+            return line;
+        };
+
+        // METHOD SP target SP HTTP/1.x
+        std::string_view line = next_line();
+        size_t first = line.find(' ');
+        size_t second = line.find(' ', first + 1);
+        if (first == std::string_view::npos || second == std::string_view::npos ||
+            line.substr(second + 1).rfind("HTTP/1.", 0) != 0) {
+            return false;
+        }
+        request_.method = std::string(line.substr(0, first));
+        std::string_view target = line.substr(first + 1, second - first - 1);
+        request_.path = std::string(target.substr(0, target.find('?')));
+
+        while (!(line = next_line()).empty()) {
+            size_t colon = line.find(':');
+            if (colon == std::string_view::npos || colon == 0) return false;
+            std::string name = lower(line.substr(0, colon));
+            std::string_view value = trim(line.substr(colon + 1));
+            auto [it, inserted] = request_.headers.emplace(name, value);
+            if (!inserted) {
+                it->second += ", ";
+                it->second += value;
+            }
+        }
+        return true;
+    }
+
+    // Keeps a read pending while the response is produced: the client sends
+    // nothing more, so its completion means the connection was closed
+    void watch() {
+        auto self = shared_from_this();
+        socket_.async_read_some(asio::buffer(probe_), [self](const asio::error_code& ec, size_t) {
+            if (!self->open_) return;
+            if (ec) return self->close();
+            self->watch();
+        });
+    }
+
+    void read_body(size_t length) {
+        size_t have = request_.body.size();
+        request_.body.resize(length);
+        auto self = shared_from_this();
+        asio::async_read(socket_, asio::buffer(request_.body.data() + have, length - have),
+            [self](const asio::error_code& ec, size_t) {
+                if (ec) return self->close();
+                self->dispatch();
+            });
+    }
+
+    void dispatch() {
+        timer_.cancel();
+        watch();
+        if (request_.method == "OPTIONS") {
+            return preflight();
+        }
+        const Handler* handler = server_.find(request_.method, request_.path);
+        if (!handler) {
+            return reject(404, "Not Found");
+        }
+        // request_ is no longer written, so the handler reads it from the pool thread
+        asio::post(*server_.handlers_, [self = shared_from_this(), handler]() {
+            try {
+                (*handler)(self->request_, self);
+            } catch (const std::exception& e) {
+                std::cerr << "[Stream] " << self->request_.method << " " << self->request_.path
+                          << " failed: " << e.what() << std::endl;
+                asio::post(self->socket_.get_executor(), [self]() {
+                    self->reject(500, "Internal server error");
+                });
+            }
+        });
+    }
+
+    void preflight() {
+        std::string requested = request_.get_header_value("Access-Control-Request-Headers");
+        respond(204, {
+            {"Access-Control-Allow-Methods", "GET,POST,PUT,DELETE,OPTIONS,PATCH"},
+            {"Access-Control-Allow-Headers", requested.empty() ? "*" : requested}
+        }, "");
+    }
+
+    // A whole response with Content-Length; only before begin()
+    void respond(int status, const ResponseHeaders& headers, std::string body) {
+        if (begun_ || !open_) return;
+        begun_ = true;
+        ended_ = true;
+        std::string head = status_line(status, headers);
+        head += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+        enqueue(std::move(head));
+        if (!body.empty()) enqueue(std::move(body));
+    }
+
+    void reject(int status, const std::string& detail) {
+        respond(status, {{"Content-Type", "application/json"}}, nlohmann::json{{"detail", detail}}.dump());
+    }
+
+    std::string status_line(int status, const ResponseHeaders& headers) const {
+        std::string head = "HTTP/1.1 " + std::to_string(status) + " " + reason_phrase(status) + "\r\n";
+        for (const auto& [name, value] : headers) {
+            head += name + ": " + value + "\r\n";
+        }
+        std::string origin = request_.get_header_value("Origin");
+        if (origin.empty()) origin = "*";
+        head += "Access-Control-Allow-Origin: " + origin + "\r\n";
+        head += "Access-Control-Allow-Credentials: true\r\n";
+        if (origin != "*") head += "Vary: Origin\r\n";
+        head += "Connection: close\r\n";
+        return head;
+    }
+
+    void do_begin(int status, const ResponseHeaders& headers) {
+        if (begun_ || !open_) return;
+        begun_ = true;
+        std::string head = status_line(status, headers);
+        head += "Transfer-Encoding: chunked\r\n\r\n";
+        enqueue(std::move(head));
+    }
+
+    void do_write(std::string data) {
+        // An empty chunk would end the response
+        if (!begun_ || ended_ || data.empty()) return;
+        char size_line[24];
+        int n = std::snprintf(size_line, sizeof(size_line), "%zx\r\n", data.size());
+        enqueue(std::string(size_line, n));
+        enqueue(std::move(data));
+        enqueue("\r\n");
+    }
+
+    void do_end() {
+        if (ended_) return;
+        if (!begun_) do_begin(200, {});
+        ended_ = true;
+        enqueue("0\r\n\r\n");
+    }
+
+    void enqueue(std::string piece) {
+        if (!open_) return;
+        queued_bytes_ += piece.size();
+        pending_.push_back(std::move(piece));
+        if (queued_bytes_ > kMaxQueuedBytes) {
+            // The client reads slower than we produce; don't buffer for it
+            server_.slow_clients_dropped_++;
+            return close();
+        }
+        flush();
+    }
+
+    void flush() {
+        if (writing_ || pending_.empty() || !open_) return;
+        writing_ = true;
+        in_flight_.swap(pending_);
+        std::vector<asio::const_buffer> buffers;
+        buffers.reserve(in_flight_.size());
+        for (const auto& piece : in_flight_) {
+            buffers.push_back(asio::buffer(piece));
+        }
+        auto self = shared_from_this();
+        asio::async_write(socket_, buffers, [self](const asio::error_code& ec, size_t n) {
+            self->on_written(ec, n);
+        });
+    }
+
+    void on_written(const asio::error_code& ec, size_t n) {
+        writing_ = false;
+        queued_bytes_ -= n;
+        server_.bytes_sent_ += n;
+        in_flight_.clear();
+        if (ec) {
+            return close();
+        }
+        if (!pending_.empty()) {
+            return flush();
+        }
+        if (ended_) {
+            completed_ = true;
+            asio::error_code ignored;
+            socket_.shutdown(asio::ip::tcp::socket::shutdown_send, ignored);
+            close();
+        }
+    }
+
+    void close() {
+        if (!open_.exchange(false, std::memory_order_acq_rel)) return;
+        timer_.cancel();
+        pending_.clear();
+        asio::error_code ignored;
+        socket_.close(ignored);
+        if (!completed_) {
+            server_.disconnects_++;
+            disconnected_.cancel();
+        }
+    }
+};
+
+StreamServer& StreamServer::instance() {
+    static StreamServer instance;
+    return instance;
+}
+
+void StreamServer::route(const std::string& method, const std::string& path, Handler handler) {
+    routes_[method + " " + path] = std::move(handler);
+}
+
+const StreamServer::Handler* StreamServer::find(const std::string& method, const std::string& path) const {
+    auto it = routes_.find(method + " " + path);
+    return it == routes_.end() ? nullptr : &it->second;
+}
+
+void StreamServer::start(const std::string& host, int port, int handler_threads) {
+    io_ = &HttpClient::instance().io_context();
+    handlers_ = std::make_unique<asio::thread_pool>(std::max(1, handler_threads));
+    asio::ip::tcp::endpoint endpoint(asio::ip::make_address(host), static_cast<unsigned short>(port));
+    acceptor_ = std::make_unique<asio::ip::tcp::acceptor>(asio::make_strand(*io_));
+    acceptor_->open(endpoint.protocol());
+    acceptor_->set_option(asio::ip::tcp::acceptor::reuse_address(true));
+    acceptor_->bind(endpoint);
+    acceptor_->listen();
+    asio::post(acceptor_->get_executor(), [this]() { accept(); });
+    std::cout << "[Stream] Streaming endpoints on " << host << ":" << this->port() << std::endl;
+}
+
+unsigned short StreamServer::port() const {
+    return acceptor_ ? acceptor_->local_endpoint().port() : 0;
+}
+
+void StreamServer::stop() {
+    if (!acceptor_) return;
+    // Not from an io thread: waits for the acceptor's strand
+    std::promise<void> closed;
+    asio::post(acceptor_->get_executor(), [this, &closed]() {
+        asio::error_code ignored;
+        acceptor_->close(ignored);
+        closed.set_value();
+    });
+    closed.get_future().wait();
+    handlers_->join();
+}
+
+void StreamServer::accept() {
+    // Each connection gets a strand of its own
+    acceptor_->async_accept(asio::make_strand(*io_),
+        [this](const asio::error_code& ec, asio::ip::tcp::socket socket) {
+            if (!acceptor_->is_open()) return;
+            if (!ec) {
+                accepted_++;
+                asio::error_code ignored;
+                socket.set_option(asio::ip::tcp::no_delay(true), ignored);
+                std::make_shared<Connection>(*this, std::move(socket))->start();
+            }
+            accept();
+        });
+}
+
+nlohmann::json StreamServer::stats() const {
+    return {
+        {"accepted", accepted_.load()},
+        {"active", active_.load()},
+        {"bytes_sent", bytes_sent_.load()},
+        {"disconnects", disconnects_.load()},
+        {"slow_clients_dropped", slow_clients_dropped_.load()},
+        {"bad_requests", bad_requests_.load()}
+    };
+}
+
+} // namespace prompt_portal
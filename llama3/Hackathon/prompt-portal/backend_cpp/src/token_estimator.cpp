@@ -0,0 +1,71 @@
+#include "token_estimator.hpp"
+
+namespace prompt_portal {
+
+namespace {
+
+// <|start_header_id|>role<|end_header_id|>\n\n ... <|eot_id|>
+constexpr int kMessageOverhead = 5;
+
+inline bool is_letter(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '\'';
+}
+
+inline bool is_digit(unsigned char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Skips a UTF-8 sequence of length bytes, stopping at end if it is truncated
+inline const unsigned char* skip(const unsigned char* p, const unsigned char* end, long length) {
+    return end - p < length ? end : p + length;
+}
+
+} // anonymous namespace
+
+int estimate_tokens(std::string_view text) {
+    const auto* p = reinterpret_cast<const unsigned char*>(text.data());
+    const auto* end = p + text.size();
+    // Counted in half tokens so two-byte scripts can weigh half a token per character
+    long halves = 0;
+
+    while (p < end) {
+        unsigned char c = *p;
+        if (is_letter(c)) {
+            const auto* start = p;
+            while (p < end && is_letter(*p)) ++p;
+            halves += 2 * (1 + (p - start - 1) / 6);
+        } else if (is_digit(c)) {
+            const auto* start = p;
+            while (p < end && is_digit(*p)) ++p;
+            halves += 2 * ((p - start + 2) / 3);
+        } else if (c == ' ' || c == '\t') {
+            // Folded into the following word
+            ++p;
+        } else if (c == '\n' || c == '\r') {
+            while (p < end && (*p == '\n' || *p == '\r')) ++p;
+            halves += 2;
+        } else if (c < 0x80) {
+            ++p;
+            halves += 2;
+        } else if (c < 0xE0) {
+            // Latin accents, Greek, Cyrillic, Hebrew, Arabic
+            p = skip(p, end, 2);
+            halves += 1;
+        } else if (c < 0xF0) {
+            // CJK and most other BMP scripts
+            p = skip(p, end, 3);
+            halves += 2;
+        } else {
+            // Emoji and other astral code points
+            p = skip(p, end, 4);
+            halves += 4;
+        }
+    }
+    return static_cast<int>((halves + 1) / 2);
+}
+
+int estimate_message_tokens(const ChatMessage& message) {
+    return estimate_tokens(message.content) + kMessageOverhead;
+}
+
+} // namespace prompt_portal
@@ -0,0 +1,285 @@
+#include "upstream_set.hpp"
+#include "http_client.hpp"
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <limits>
+#include <algorithm>
+
+namespace prompt_portal {
+
+namespace {
+
+int64_t now_ticks() {
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+std::mt19937& rng() {
+    thread_local std::mt19937 generator(std::random_device{}());
+    return generator;
+}
+
+// Outstanding requests per unit of weight; compared by cross-multiplying to stay in integers
+bool less_loaded(const UpstreamSet::Upstream& a, const UpstreamSet::Upstream& b) {
+    int64_t load_a = static_cast<int64_t>(a.in_flight.load(std::memory_order_relaxed)) * b.weight;
+    int64_t load_b = static_cast<int64_t>(b.in_flight.load(std::memory_order_relaxed)) * a.weight;
+    return load_a < load_b;
+}
+
+const char* health_name(UpstreamSet::Health health) {
+    switch (health) {
+        case UpstreamSet::Health::Up: return "up";
+        case UpstreamSet::Health::Down: return "down";
+        default: return "unknown";
+    }
+}
+
+} // anonymous namespace
+
+UpstreamSet::UpstreamSet(const LlmConfig& config)
+    : eject_after_failures_(std::max(1, config.eject_after_failures)),
+      max_in_flight_(std::max(1, config.max_concurrent_per_upstream)),
+      eject_duration_ticks_(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::seconds(config.eject_duration)).count()) {
+    if (config.upstreams.empty()) {
+        upstreams_.push_back(std::make_unique<Upstream>());
+        upstreams_.back()->url = config.server_url;
+    }
+    for (const auto& u : config.upstreams) {
+        upstreams_.push_back(std::make_unique<Upstream>());
+        upstreams_.back()->url = u.url;
+        upstreams_.back()->weight = std::max(1, u.weight);
+    }
+    for (size_t i = 0; i < upstreams_.size(); ++i) {
+        upstreams_[i]->index = i;
+    }
+
+    if (config.balance_policy == "power_of_two") {
+        policy_ = Policy::PowerOfTwo;
+    } else if (config.balance_policy != "least_outstanding") {
+        std::cerr << "[LLM] Unknown balance_policy '" << config.balance_policy
+                  << "', using least_outstanding" << std::endl;
+    }
+}
+
+bool UpstreamSet::available(const Upstream& upstream, int64_t now) const {
+    return upstream.health.load(std::memory_order_relaxed) != Health::Down
+        && upstream.ejected_until.load(std::memory_order_relaxed) <= now;
+}
+
+bool UpstreamSet::has_room(const Upstream& upstream) const {
+    return upstream.in_flight.load(std::memory_order_relaxed) < max_in_flight_;
+}
+
+bool UpstreamSet::reserve(Upstream& upstream) {
+    int current = upstream.in_flight.load(std::memory_order_relaxed);
+    while (current < max_in_flight_) {
+        if (upstream.in_flight.compare_exchange_weak(current, current + 1, std::memory_order_relaxed)) {
+            upstream.requests.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool UpstreamSet::any_available() const {
+    int64_t now = now_ticks();
+    return std::any_of(upstreams_.begin(), upstreams_.end(), [&](const auto& u) { return available(*u, now); });
+}
+
+UpstreamSet::Upstream* UpstreamSet::pick_least_outstanding(int64_t now, const Upstream* exclude) {
+    Upstream* best = nullptr;
+    // Random starting point so ties don't all land on the first upstream
+    size_t offset = rng()() % upstreams_.size();
+    for (size_t i = 0; i < upstreams_.size(); ++i) {
+        Upstream* candidate = upstreams_[(offset + i) % upstreams_.size()].get();
+        if (candidate == exclude || !available(*candidate, now) || !has_room(*candidate)) continue;
+        if (!best || less_loaded(*candidate, *best)) best = candidate;
+    }
+    return best;
+}
+
+UpstreamSet::Upstream* UpstreamSet::pick_weighted_random(int64_t now, const Upstream* exclude) {
+    auto eligible = [&](const Upstream& u) { return &u != exclude && available(u, now) && has_room(u); };
+    int weight = 0;
+    for (const auto& u : upstreams_) {
+        if (eligible(*u)) weight += u->weight;
+    }
+    if (weight == 0) return nullptr;
+
+    int target = std::uniform_int_distribution<int>(0, weight - 1)(rng());
+    for (const auto& u : upstreams_) {
+        if (!eligible(*u)) continue;
+        target -= u->weight;
+        if (target < 0) return u.get();
+    }
+    return nullptr;
+}
+
+UpstreamSet::Upstream* UpstreamSet::pick_power_of_two(int64_t now) {
+    Upstream* first = pick_weighted_random(now, nullptr);
+    if (!first) return nullptr;
+    Upstream* second = pick_weighted_random(now, first);
+    if (!second) return first;
+    return less_loaded(*second, *first) ? second : first;
+}
+
+UpstreamSet::Upstream* UpstreamSet::pick(int preferred, int64_t now, const Upstream* exclude) {
+    if (preferred >= 0 && static_cast<size_t>(preferred) < upstreams_.size()) {
+        Upstream* candidate = upstreams_[preferred].get();
+        if (candidate != exclude && available(*candidate, now) && has_room(*candidate)) {
+            return candidate;
+        }
+    }
+    if (upstreams_.size() == 1) {
+        Upstream* only = upstreams_.front().get();
+        return only != exclude && available(*only, now) && has_room(*only) ? only : nullptr;
+    }
+    // Hedges always go to the least loaded of the others
+    return policy_ == Policy::PowerOfTwo && !exclude ? pick_power_of_two(now) : pick_least_outstanding(now, exclude);
+}
+
+UpstreamSet::Upstream* UpstreamSet::select(int preferred) {
+    int64_t now = now_ticks();
+    // Another request may take the last room between pick and reserve; then pick again
+    for (size_t attempt = 0; attempt <= upstreams_.size(); ++attempt) {
+        Upstream* chosen = pick(preferred, now, nullptr);
+        if (!chosen) break;
+        if (reserve(*chosen)) return chosen;
+    }
+    if (!any_available()) {
+        throw NoHealthyUpstream();
+    }
+    return nullptr;
+}
+
+void UpstreamSet::acquire(int preferred, AcquireCallback on_acquired) {
+    Upstream* chosen = nullptr;
+    std::exception_ptr error;
+    try {
+        chosen = select(preferred);
+        if (!chosen) {
+            std::lock_guard<std::mutex> lock(waiters_mutex_);
+            // Tried again under the lock, so room freed by a release() in between is not missed
+            chosen = select(preferred);
+            if (!chosen) {
+                waiters_.push_back(Waiter{preferred, std::move(on_acquired)});
+                return;
+            }
+        }
+    } catch (const NoHealthyUpstream&) {
+        error = std::current_exception();
+    }
+    on_acquired(error, chosen);
+}
+
+UpstreamSet::Upstream* UpstreamSet::select_other(const Upstream& exclude) {
+    int64_t now = now_ticks();
+    for (size_t attempt = 0; attempt <= upstreams_.size(); ++attempt) {
+        Upstream* chosen = pick(-1, now, &exclude);
+        if (!chosen) break;
+        if (reserve(*chosen)) return chosen;
+    }
+    return nullptr;
+}
+
+void UpstreamSet::wake_waiters(size_t count) {
+    std::vector<std::pair<AcquireCallback, Upstream*>> woken;
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(waiters_mutex_);
+        while (!waiters_.empty() && (count > 0 || error)) {
+            Upstream* chosen = nullptr;
+            if (!error) {
+                try {
+                    chosen = select(waiters_.front().preferred);
+                } catch (const NoHealthyUpstream&) {
+                    // No circuit is closed: every waiter fails fast, as select() would
+                    error = std::current_exception();
+                }
+                if (!chosen && !error) break;  // Still full
+            }
+            woken.emplace_back(std::move(waiters_.front().on_acquired), chosen);
+            waiters_.pop_front();
+            if (count > 0) --count;
+        }
+    }
+    for (auto& [on_acquired, upstream] : woken) {
+        asio::post(HttpClient::instance().io_context(), [on_acquired = std::move(on_acquired), upstream, error]() {
+            on_acquired(upstream ? nullptr : error, upstream);
+        });
+    }
+}
+
+void UpstreamSet::release(Upstream& upstream, bool success) {
+    upstream.in_flight.fetch_sub(1, std::memory_order_relaxed);
+
+    if (success) {
+        upstream.consecutive_failures.store(0, std::memory_order_relaxed);
+        wake_waiters(1);
+        return;
+    }
+
+    upstream.failures.fetch_add(1, std::memory_order_relaxed);
+    // The count is not reset on ejection, so once the window is over a single
+    // further failure reopens the circuit (half-open)
+    int failures = upstream.consecutive_failures.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (failures >= eject_after_failures_) {
+        int64_t now = now_ticks();
+        int64_t until = upstream.ejected_until.load(std::memory_order_relaxed);
+        // Only the failure that crosses into ejection logs and re-arms the window
+        if (until <= now && upstream.ejected_until.compare_exchange_strong(until, now + eject_duration_ticks_)) {
+            upstream.ejections.fetch_add(1, std::memory_order_relaxed);
+            std::cerr << "[LLM] Ejecting upstream " << upstream.url << " after "
+                      << failures << " consecutive failures" << std::endl;
+        }
+    }
+    // After the ejection check, so the freed room isn't handed to a failing upstream
+    wake_waiters(1);
+}
+
+void UpstreamSet::report_probe(Upstream& upstream, bool success) {
+    upstream.probes.fetch_add(1, std::memory_order_relaxed);
+
+    if (success) {
+        upstream.consecutive_probe_failures.store(0, std::memory_order_relaxed);
+        if (upstream.health.exchange(Health::Up) == Health::Down) {
+            // The server answers again: close the circuit without waiting out an ejection
+            upstream.consecutive_failures.store(0, std::memory_order_relaxed);
+            upstream.ejected_until.store(0, std::memory_order_relaxed);
+            std::cout << "[LLM] Upstream " << upstream.url << " is healthy again" << std::endl;
+            wake_waiters(static_cast<size_t>(max_in_flight_));
+        }
+        return;
+    }
+
+    upstream.probe_failures.fetch_add(1, std::memory_order_relaxed);
+    int failures = upstream.consecutive_probe_failures.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (failures >= eject_after_failures_ && upstream.health.exchange(Health::Down) != Health::Down) {
+        upstream.ejections.fetch_add(1, std::memory_order_relaxed);
+        std::cerr << "[LLM] Upstream " << upstream.url << " failed " << failures
+                  << " health checks, opening its circuit" << std::endl;
+    }
+}
+
+nlohmann::json UpstreamSet::stats() const {
+    int64_t now = now_ticks();
+    nlohmann::json result = nlohmann::json::array();
+    for (const auto& u : upstreams_) {
+        result.push_back({
+            {"url", u->url},
+            {"weight", u->weight},
+            {"in_flight", u->in_flight.load()},
+            {"requests", u->requests.load()},
+            {"failures", u->failures.load()},
+            {"ejections", u->ejections.load()},
+            {"ejected", !available(*u, now)},
+            {"health", health_name(u->health.load())},
+            {"probes", u->probes.load()},
+            {"probe_failures", u->probe_failures.load()}
+        });
+    }
+    return result;
+}
+
+} // namespace prompt_portal
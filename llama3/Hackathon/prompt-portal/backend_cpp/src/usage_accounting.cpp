@@ -0,0 +1,155 @@
+#include "usage_accounting.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <functional>
+
+namespace prompt_portal {
+
+namespace {
+
+uint64_t to_us(double ms) {
+    return ms > 0.0 ? static_cast<uint64_t>(ms * 1000.0) : 0;
+}
+
+} // anonymous namespace
+
+void UsageSample::merge(const CompletionFields& fields) {
+    if (fields.timings.present) {
+        prompt_tokens = fields.timings.prompt_n + fields.timings.cache_n;
+        cached_tokens = fields.timings.cache_n;
+        completion_tokens = fields.timings.predicted_n;
+        prompt_ms = fields.timings.prompt_ms;
+        predicted_ms = fields.timings.predicted_ms;
+        prompt_per_second = fields.timings.prompt_per_second;
+        predicted_per_second = fields.timings.predicted_per_second;
+    }
+    // Prefer the OpenAI counts where both are present
+    if (fields.usage.prompt_tokens >= 0) prompt_tokens = fields.usage.prompt_tokens;
+    if (fields.usage.completion_tokens >= 0) completion_tokens = fields.usage.completion_tokens;
+}
+
+// =====================
+// UsageCounters
+// =====================
+
+void UsageCounters::add(const UsageSample& sample) {
+    requests_.fetch_add(1, std::memory_order_relaxed);
+    prompt_tokens_.fetch_add(std::max(0, sample.prompt_tokens), std::memory_order_relaxed);
+    cached_tokens_.fetch_add(std::max(0, sample.cached_tokens), std::memory_order_relaxed);
+    completion_tokens_.fetch_add(std::max(0, sample.completion_tokens), std::memory_order_relaxed);
+    prompt_us_.fetch_add(to_us(sample.prompt_ms), std::memory_order_relaxed);
+    predicted_us_.fetch_add(to_us(sample.predicted_ms), std::memory_order_relaxed);
+
+    if (sample.prompt_per_second > 0.0) {
+        prompt_per_second_.record(static_cast<uint64_t>(std::lround(sample.prompt_per_second)));
+    }
+    if (sample.predicted_per_second > 0.0) {
+        predicted_per_second_.record(static_cast<uint64_t>(std::lround(sample.predicted_per_second)));
+    }
+    completion_tokens_per_request_.record(static_cast<uint64_t>(std::max(0, sample.completion_tokens)));
+    latency_.record(sample.latency);
+}
+
+nlohmann::json UsageCounters::to_json() const {
+    return {
+        {"requests", requests_.load(std::memory_order_relaxed)},
+        {"prompt_tokens", prompt_tokens_.load(std::memory_order_relaxed)},
+        {"cached_prompt_tokens", cached_tokens_.load(std::memory_order_relaxed)},
+        {"completion_tokens", completion_tokens_.load(std::memory_order_relaxed)},
+        {"prompt_eval_ms", prompt_us_.load(std::memory_order_relaxed) / 1000.0},
+        {"generation_ms", predicted_us_.load(std::memory_order_relaxed) / 1000.0},
+        {"prompt_tokens_per_second", prompt_per_second_.to_json()},
+        {"generation_tokens_per_second", predicted_per_second_.to_json()},
+        {"completion_tokens_per_request", completion_tokens_per_request_.to_json()},
+        {"latency", latency_.to_json()}
+    };
+}
+
+// =====================
+// UsageTable
+// =====================
+
+UsageTable::UsageTable(size_t capacity)
+    : mask_(std::bit_ceil(std::max<size_t>(capacity, 2)) - 1),
+      max_entries_((mask_ + 1) * 3 / 4),
+      slots_(new std::atomic<Entry*>[mask_ + 1]) {
+    for (size_t i = 0; i <= mask_; ++i) {
+        slots_[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+UsageTable::~UsageTable() {
+    for (size_t i = 0; i <= mask_; ++i) {
+        delete slots_[i].load(std::memory_order_relaxed);
+    }
+}
+
+UsageCounters& UsageTable::find_or_insert(std::string_view key) {
+    key = key.substr(0, kMaxKeyLength);
+    size_t slot = std::hash<std::string_view>{}(key) & mask_;
+    std::unique_ptr<Entry> created;
+
+    for (size_t probe = 0; probe <= mask_; ++probe, slot = (slot + 1) & mask_) {
+        Entry* entry = slots_[slot].load(std::memory_order_acquire);
+        if (!entry) {
+            if (size_.load(std::memory_order_relaxed) >= max_entries_) {
+                break;
+            }
+            if (!created) {
+                created.reset(new Entry{std::string(key), {}});
+            }
+            if (slots_[slot].compare_exchange_strong(entry, created.get(),
+                                                     std::memory_order_acq_rel, std::memory_order_acquire)) {
+                size_.fetch_add(1, std::memory_order_relaxed);
+                return created.release()->counters;
+            }
+            // Lost the race; entry is the winner's, which may be our key
+        }
+        if (entry->key == key) {
+            return entry->counters;
+        }
+    }
+    return other_.counters;
+}
+
+nlohmann::json UsageTable::to_json() const {
+    nlohmann::json result = nlohmann::json::object();
+    for (size_t i = 0; i <= mask_; ++i) {
+        if (const Entry* entry = slots_[i].load(std::memory_order_acquire)) {
+            result[entry->key] = entry->counters.to_json();
+        }
+    }
+    if (size_.load(std::memory_order_relaxed) >= max_entries_) {
+        result[other_.key] = other_.counters.to_json();
+    }
+    return result;
+}
+
+// =====================
+// UsageAccounting
+// =====================
+
+UsageAccounting& UsageAccounting::instance() {
+    static UsageAccounting accounting;
+    return accounting;
+}
+
+void UsageAccounting::record(std::string_view user, std::string_view model, std::string_view upstream,
+                             const UsageSample& sample) {
+    total_.add(sample);
+    users_.find_or_insert(user.empty() ? std::string_view("anonymous") : user).add(sample);
+    models_.find_or_insert(model).add(sample);
+    upstreams_.find_or_insert(upstream).add(sample);
+}
+
+nlohmann::json UsageAccounting::stats() const {
+    return {
+        {"total", total_.to_json()},
+        {"users", users_.to_json()},
+        {"models", models_.to_json()},
+        {"upstreams", upstreams_.to_json()}
+    };
+}
+
+} // namespace prompt_portal
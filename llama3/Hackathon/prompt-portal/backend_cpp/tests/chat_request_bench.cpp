@@ -0,0 +1,80 @@
+// Time to build one chat completion body: the nlohmann::json DOM plus dump()
+// the client used to do, against write_chat_request(). Not run by ctest;
+// build in Release and run ./chat_request_bench [messages] [iterations].
+
+#include "chat_request.hpp"
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace prompt_portal;
+
+namespace {
+
+// Same shape as the DOM the client built before write_chat_request()
+std::string dump_body(const std::vector<ChatMessage>& messages) {
+    nlohmann::json msgs = nlohmann::json::array();
+    for (const auto& msg : messages) {
+        msgs.push_back({{"role", msg.role}, {"content", msg.content}});
+    }
+    nlohmann::json body = {
+        {"model", "default"},
+        {"messages", msgs},
+        {"temperature", 0.6},
+        {"top_p", 0.9},
+        {"max_tokens", 4096},
+        {"cache_prompt", true}
+    };
+    body["extra_body"] = {{"enable_thinking", false}};
+    return body.dump();
+}
+
+template <typename Fn>
+double best_us_per_call(int iterations, Fn fn) {
+    double best = 1e300;
+    for (int round = 0; round < 5; ++round) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            fn();
+        }
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count() / iterations);
+    }
+    return best;
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    int message_count = argc > 1 ? std::atoi(argv[1]) : 40;
+    int iterations = argc > 2 ? std::atoi(argv[2]) : 2000;
+
+    // A long conversation: prose with some quotes, newlines and non-ASCII text
+    std::vector<ChatMessage> messages;
+    messages.push_back({"system", "You are a helpful assistant. Answer \"briefly\".\n"});
+    std::string turn;
+    for (int i = 0; i < 12; ++i) {
+        turn += "Line of a fairly ordinary chat turn, caf\xc3\xa9 \xe2\x82\xac " + std::to_string(i) + ".\n";
+    }
+    for (int i = 0; i < message_count; ++i) {
+        messages.push_back({i % 2 ? "assistant" : "user", turn});
+    }
+
+    ChatRequest request;
+    request.messages = messages;
+
+    size_t bytes = write_chat_request(request).size();
+    size_t sink = 0;
+    double dom_us = best_us_per_call(iterations, [&] { sink += dump_body(messages).size(); });
+    double writer_us = best_us_per_call(iterations, [&] { sink += write_chat_request(request).size(); });
+
+    std::cout << messages.size() << " messages, " << bytes << " bytes per body (best of 5 x " << iterations << ")\n"
+              << "  json DOM + dump():     " << dom_us << " us\n"
+              << "  write_chat_request():  " << writer_us << " us\n"
+              << "  speedup:               " << dom_us / writer_us << "x\n";
+    return sink == 0;
+}
@@ -0,0 +1,146 @@
+// write_chat_request() must produce the body the nlohmann::json DOM produced
+// before it: strings escaped byte for byte like dump() (with invalid UTF-8
+// replaced as error_handler_t::replace does), and the whole body parsing back
+// equal to the document build_request_body() used to build.
+
+#include "test_support.hpp"
+#include "chat_request.hpp"
+#include <nlohmann/json.hpp>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace prompt_portal;
+using nlohmann::json;
+
+namespace {
+
+std::string reference_string(const std::string& value) {
+    return json(value).dump(-1, ' ', false, json::error_handler_t::replace);
+}
+
+std::string written_string(const std::string& value) {
+    std::string out;
+    append_json_string(out, value);
+    return out;
+}
+
+// The DOM the client built for every request before the writer existed
+json reference_body(const ChatRequest& request, const std::vector<ChatMessage>& messages) {
+    json msgs = json::array();
+    for (const auto& msg : messages) {
+        msgs.push_back({{"role", msg.role}, {"content", msg.content}});
+    }
+    json body = {
+        {"model", std::string(request.model)},
+        {"messages", msgs},
+        {"temperature", request.temperature},
+        {"top_p", request.top_p},
+        {"max_tokens", request.max_tokens}
+    };
+    if (request.cache_prompt) body["cache_prompt"] = true;
+    if (request.seed >= 0) body["seed"] = request.seed;
+    if (request.id_slot >= 0) body["id_slot"] = request.id_slot;
+    if (request.stream) {
+        body["stream"] = true;
+        body["stream_options"] = {{"include_usage", true}};
+    }
+    if (request.skip_thinking) body["extra_body"] = {{"enable_thinking", false}};
+    return body;
+}
+
+// Mostly ASCII text with quotes, backslashes, control characters and 2-4 byte
+// characters mixed in, so they land at every offset of the 8-byte scan
+std::string random_text(std::mt19937& rng, bool allow_invalid) {
+    static const std::vector<std::string> pieces = {
+        "\"", "\\", "\n", "\r", "\t", "\b", "\f", std::string(1, '\0'), "\x01", "\x1f", "\x7f", "/",
+        "\xc3\xa9", "\xe2\x82\xac", "\xe4\xb8\xad\xe6\x96\x87", "\xf0\x9f\x98\x80", "\xf4\x8f\xbf\xbf"
+    };
+    static const std::vector<std::string> invalid = {
+        "\xff", "\x80", "\xc3", "\xe2\x82", "\xf0\x9f\x98", "\xc0\xaf", "\xed\xa0\x80", "\xf5\x80\x80\x80", "\xe0\x80\x80"
+    };
+    std::string text;
+    int parts = std::uniform_int_distribution<int>(0, 12)(rng);
+    for (int i = 0; i < parts; ++i) {
+        int kind = std::uniform_int_distribution<int>(0, 9)(rng);
+        if (kind < 6) {
+            int run = std::uniform_int_distribution<int>(0, 20)(rng);
+            for (int j = 0; j < run; ++j) {
+                text += static_cast<char>(std::uniform_int_distribution<int>(0x20, 0x7e)(rng));
+            }
+        } else if (kind < 9 || !allow_invalid) {
+            text += pieces[std::uniform_int_distribution<size_t>(0, pieces.size() - 1)(rng)];
+        } else {
+            text += invalid[std::uniform_int_distribution<size_t>(0, invalid.size() - 1)(rng)];
+        }
+    }
+    return text;
+}
+
+void escapes_like_dump() {
+    std::vector<std::string> cases = {
+        "", "plain ascii", "exactly8", "quote \" and backslash \\ inside",
+        "\"\"\"\"\"\"\"\"\\\\\\\\\\\\\\\\", "tab\there\nnewline\rreturn\bback\fform",
+        std::string("nul\0byte", 8), "\x7f is not escaped", "caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80",
+        "1234567\xf0\x9f\x98\x80", "\xe4\xb8\xad\xe6\x96\x87\xe4\xb8\xad\xe6\x96\x87\xe4\xb8\xad\xe6\x96\x87",
+        // Invalid: stray and truncated sequences, overlongs, surrogates, above U+10FFFF
+        "a\xff" "b", "\x80\x80", "\xc3", "\xc3(", "\xe2\x82", "\xe2\x82(", "\xf0\x9f\x98", "12345678\xf0\x9f\x98",
+        "\xc0\xaf", "\xe0\x80\xaf", "\xed\xa0\x80", "\xf4\x90\x80\x80", "\xf5\x80\x80\x80"
+    };
+    for (int c = 0; c < 0x20; ++c) {
+        cases.push_back(std::string("ctl ") + static_cast<char>(c) + " end");
+    }
+    for (const auto& value : cases) {
+        CHECK(written_string(value) == reference_string(value));
+    }
+
+    std::mt19937 rng(15);
+    for (int i = 0; i < 20000; ++i) {
+        std::string value = random_text(rng, true);
+        if (written_string(value) != reference_string(value)) {
+            std::cerr << "mismatch for " << json(value).dump(-1, ' ', true, json::error_handler_t::replace) << std::endl;
+            CHECK(false);
+        }
+    }
+}
+
+void bodies_parse_equal() {
+    std::mt19937 rng(42);
+    const double samples[] = {0.0, 0.1, 0.2, 0.6, 0.7, 0.9, 1.0, 1.5, 1e-7, 0.30000000000000004};
+    for (int i = 0; i < 2000; ++i) {
+        std::vector<ChatMessage> messages;
+        int count = std::uniform_int_distribution<int>(0, 6)(rng);
+        messages.push_back({"system", random_text(rng, false)});
+        for (int m = 0; m < count; ++m) {
+            messages.push_back({m % 2 ? "assistant" : "user", random_text(rng, false)});
+        }
+        std::string model = i % 3 ? "default" : random_text(rng, false);
+
+        ChatRequest request;
+        request.messages = messages;
+        request.model = model;
+        request.temperature = samples[std::uniform_int_distribution<int>(0, 9)(rng)];
+        request.top_p = samples[std::uniform_int_distribution<int>(0, 9)(rng)];
+        request.max_tokens = std::uniform_int_distribution<int>(1, 8192)(rng);
+        request.seed = i % 4 ? -1 : i;
+        request.id_slot = i % 5 ? -1 : i % 7;
+        request.stream = i % 2;
+        request.cache_prompt = i % 6 != 0;
+        request.skip_thinking = i % 3 != 0;
+
+        json written = json::parse(write_chat_request(request));
+        CHECK(written == reference_body(request, messages));
+        // Doubles keep their exact value and stay floating point
+        CHECK(written["temperature"].is_number_float());
+        CHECK(written["temperature"].get<double>() == request.temperature);
+    }
+}
+
+} // anonymous namespace
+
+int main() {
+    escapes_like_dump();
+    bodies_parse_equal();
+    std::cout << "chat_request_test: ok" << std::endl;
+    return 0;
+}
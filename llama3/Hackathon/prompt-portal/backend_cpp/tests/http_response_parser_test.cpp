@@ -0,0 +1,136 @@
+// HttpResponseParser on upstream responses as they really arrive: split at
+// every byte, several on one keep-alive connection, and malformed ones
+// (bad status lines, Content-Length and chunk sizes) rejected by throwing
+// instead of overflowing or guessing.
+
+#include "test_support.hpp"
+#include "http_response_parser.hpp"
+#include <stdexcept>
+#include <string>
+
+using namespace prompt_portal;
+
+namespace {
+
+struct Parsed {
+    HttpResponseParser parser;
+    std::string body;
+    size_t consumed = 0;
+};
+
+// Feeds text in pieces of at most step bytes, stopping once the response is complete
+void push(Parsed& parsed, const std::string& text, size_t step) {
+    for (size_t pos = 0; pos < text.size() && !parsed.parser.complete(); pos += step) {
+        size_t n = std::min(step, text.size() - pos);
+        parsed.consumed += parsed.parser.feed(text.data() + pos, n, [&](const char* data, size_t len) {
+            parsed.body.append(data, len);
+        });
+    }
+}
+
+bool rejects(const std::string& text) {
+    try {
+        Parsed parsed;
+        push(parsed, text, text.size());
+        return false;
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+}
+
+void content_length() {
+    const std::string response = "HTTP/1.1 200 OK\r\nContent-Length: 11\r\n\r\nhello world";
+    for (size_t step = 1; step <= response.size(); ++step) {
+        Parsed parsed;
+        push(parsed, response, step);
+        CHECK(parsed.parser.complete());
+        CHECK(parsed.parser.status() == 200);
+        CHECK(parsed.parser.keep_alive());
+        CHECK(parsed.body == "hello world");
+    }
+
+    // Oversized: the cap, values that would overflow 64 bits, and a wrapped one
+    CHECK(rejects("HTTP/1.1 200 OK\r\nContent-Length: 1099511627777\r\n\r\n"));
+    CHECK(rejects("HTTP/1.1 200 OK\r\nContent-Length: 99999999999999999999999999\r\n\r\n"));
+    CHECK(rejects("HTTP/1.1 200 OK\r\nContent-Length: 18446744073709551617\r\n\r\n"));
+    // Not a number
+    CHECK(rejects("HTTP/1.1 200 OK\r\nContent-Length: 12a\r\n\r\n"));
+    CHECK(rejects("HTTP/1.1 200 OK\r\nContent-Length: -1\r\n\r\n"));
+    CHECK(rejects("HTTP/1.1 200 OK\r\nContent-Length: 0x10\r\n\r\n"));
+    CHECK(rejects("HTTP/1.1 200 OK\r\nContent-Length: \r\n\r\n"));
+}
+
+void chunked() {
+    const std::string response =
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "5\r\nhello\r\n"
+        "1;name=value\r\n \r\n"
+        "A\r\n0123456789\r\n"
+        "0\r\nX-Trailer: ignored\r\n\r\n";
+    const std::string next = "HTTP/1.1 204 No Content\r\n\r\n";
+    for (size_t step = 1; step <= response.size(); ++step) {
+        Parsed parsed;
+        push(parsed, response + next, step);
+        CHECK(parsed.parser.complete());
+        CHECK(parsed.parser.framing() == HttpResponseParser::Framing::Chunked);
+        CHECK(parsed.body == "hello 0123456789");
+        // The next response on the connection is left for the next parse
+        CHECK(parsed.consumed == response.size());
+    }
+
+    const std::string head = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n";
+    CHECK(rejects(head + "zz\r\n"));
+    CHECK(rejects(head + "\r\n"));
+    CHECK(rejects(head + ";ext\r\n"));
+    CHECK(rejects(head + "10000000001\r\n"));
+    CHECK(rejects(head + "ffffffffffffffffffffffff\r\n"));
+    // Data longer than its chunk size
+    CHECK(rejects(head + "3\r\nabcd\r\n0\r\n\r\n"));
+}
+
+void status_line() {
+    Parsed interim;
+    push(interim, "HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n", 3);
+    CHECK(interim.parser.complete());
+    CHECK(interim.parser.status() == 503);
+
+    Parsed no_reason;
+    push(no_reason, "HTTP/1.1 200\r\nContent-Length: 0\r\n\r\n", 1);
+    CHECK(no_reason.parser.status() == 200);
+
+    CHECK(rejects("HTTP/1.1 2000 OK\r\n\r\n"));
+    CHECK(rejects("HTTP/1.1 20x OK\r\n\r\n"));
+    CHECK(rejects("HTTP/1.1 20\r\n\r\n"));
+    CHECK(rejects("SSH-2.0-OpenSSH\r\n\r\n"));
+}
+
+void until_close() {
+    Parsed parsed;
+    push(parsed, "HTTP/1.0 200 OK\r\n\r\nall of it", 4);
+    CHECK(!parsed.parser.complete());
+    CHECK(!parsed.parser.keep_alive());
+    parsed.parser.finish_eof();
+    CHECK(parsed.parser.complete());
+    CHECK(parsed.body == "all of it");
+
+    Parsed truncated;
+    push(truncated, "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nshort", 64);
+    bool threw = false;
+    try {
+        truncated.parser.finish_eof();
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+}
+
+} // anonymous namespace
+
+int main() {
+    content_length();
+    chunked();
+    status_line();
+    until_close();
+    std::cout << "http_response_parser_test: ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,88 @@
+// SessionManager throughput with many threads working on many live sessions,
+// through its public API: 7 of 8 operations are a chat turn (process_message
+// against an in-process upstream that answers at once, so every turn includes
+// a loopback HTTP round trip) and 1 of 8 reads the history.
+// Not run by ctest; build in Release and run
+// ./session_contention_bench [sessions] [ops_per_thread] [threads...]
+// Parallel scaling only shows on a machine with that many cores.
+
+#include "test_support.hpp"
+#include "llm_client.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace prompt_portal;
+
+int main(int argc, char** argv) {
+    int session_count = argc > 1 ? std::atoi(argv[1]) : 10000;
+    int ops_per_thread = argc > 2 ? std::atoi(argv[2]) : 2000;
+    std::vector<int> thread_counts;
+    for (int i = 3; i < argc; ++i) {
+        thread_counts.push_back(std::atoi(argv[i]));
+    }
+    if (thread_counts.empty()) {
+        thread_counts = {1, 4, 16, 64};
+    }
+    int max_threads = *std::max_element(thread_counts.begin(), thread_counts.end());
+
+    // Never destroyed: its threads run until the process exits
+    auto* upstream = new testing::ReplyingUpstream();
+
+    std::ostream out(std::cout.rdbuf());
+    std::cout.setstate(std::ios::failbit);  // The sessions and the client log every turn
+
+    LlmConfig config;
+    config.server_url = "http://127.0.0.1:" + std::to_string(upstream->port());
+    config.health_check_interval_ms = 0;
+    config.completion_cache_mb = 0;
+    config.max_concurrent_per_upstream = max_threads;  // Every thread's turn in flight at once
+    config.pool_max_connections = max_threads;
+    config.max_history_messages = 8;
+    config.session_ttl = 0;
+    config.session_memory_mb = 0;
+    config.session_store_path = "";
+    LLMClient client(config);
+    SessionManager sessions(client, config);
+
+    const std::string system = "You are a helpful assistant.";
+    std::vector<std::string> ids;
+    std::string message(200, 'x');
+    for (int i = 0; i < session_count; ++i) {
+        ids.push_back("bench-session-" + std::to_string(i));
+        sessions.process_message(ids.back(), system, message);
+    }
+
+    out << session_count << " sessions, " << ops_per_thread << " ops per thread, "
+        << std::thread::hardware_concurrency() << " hardware threads\n";
+    for (int thread_count : thread_counts) {
+        std::vector<std::thread> threads;
+        auto start = std::chrono::steady_clock::now();
+        for (int t = 0; t < thread_count; ++t) {
+            threads.emplace_back([&, t] {
+                std::mt19937 rng(static_cast<unsigned>(t));
+                std::uniform_int_distribution<int> pick(0, session_count - 1);
+                for (int op = 0; op < ops_per_thread; ++op) {
+                    const std::string& id = ids[pick(rng)];
+                    if (op % 8 == 7) {
+                        sessions.get_session_history(id);
+                    } else {
+                        sessions.process_message(id, system, message);
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        double kops = static_cast<double>(thread_count) * ops_per_thread / elapsed.count() / 1e3;
+        out << "  " << thread_count << " threads: " << kops << " k ops/s\n";
+    }
+    return 0;
+}
@@ -0,0 +1,185 @@
+// Sessions survive leaving memory. A session evicted by the reaper is loaded
+// back on its next turn, and that turn is sent upstream with the earlier
+// history. A trimmed session (ring buffer window) comes back from the file
+// after a restart with the same messages, counters and sequence numbers, and
+// carries on from there. A cleared session stays gone, and creating a stored
+// session again never deletes it. Changes the store loses never leave a
+// dialog with a hole in it: the session is rewritten on its next message, and
+// a load starts after the last gap.
+
+#include "test_support.hpp"
+#include "llm_client.hpp"
+#include "session_store.hpp"
+#include <filesystem>
+#include <string>
+
+using namespace prompt_portal;
+using namespace std::chrono_literals;
+
+namespace {
+
+MessagePtr message(const std::string& role, const std::string& content) {
+    return std::make_shared<const ChatMessage>(ChatMessage{.role = role, .content = content});
+}
+
+std::vector<int64_t> seqs(const SessionStore::Record& record) {
+    std::vector<int64_t> result;
+    for (const auto& stored : record.messages) {
+        result.push_back(stored.seq);
+    }
+    return result;
+}
+
+void lost_changes(const std::filesystem::path& path) {
+    SessionStore store(path.string(), 10ms);
+
+    // A hole in the sequence numbers: only what follows it is loaded, from a user message on
+    store.create("gap", "", 0);
+    store.append("gap", 0, message("user", "a"), 0, 1);
+    store.append("gap", 1, message("assistant", "b"), 0, 1);
+    store.append("gap", 3, message("assistant", "d"), 0, 2);
+    store.append("gap", 4, message("user", "e"), 0, 3);
+    store.append("gap", 5, message("assistant", "f"), 0, 3);
+    CHECK((seqs(*store.load("gap")) == std::vector<int64_t>{4, 5}));
+
+    // A batch that fails to commit makes its sessions dirty
+    store.create("dirty", "", 0);
+    CHECK(store.load("dirty").has_value());
+    {
+        SQLite::Database other(path.string(), SQLite::OPEN_READWRITE);
+        other.setBusyTimeout(5000);
+        other.exec("ALTER TABLE chat_messages RENAME TO chat_messages_away");
+        CHECK(store.append("dirty", 0, message("user", "lost"), 0, 1));
+        CHECK(testing::wait_until([&] { return store.stats()["failed_ops"] == 1; }, 5000ms));
+        other.exec("ALTER TABLE chat_messages_away RENAME TO chat_messages");
+    }
+    CHECK(store.stats()["dirty"] == 1);
+    CHECK(!store.append("dirty", 1, message("assistant", "refused"), 0, 1));
+
+    // Until the caller writes the whole window again
+    store.rewrite("dirty", "prompt", 0, 0, 2, {{0, message("user", "lost")}, {1, message("assistant", "reply")},
+                                              {2, message("user", "next")}});
+    CHECK(store.stats()["dirty"] == 0);
+    CHECK(store.append("dirty", 3, message("assistant", "answer"), 0, 2));
+    auto record = store.load("dirty");
+    CHECK(record->system_prompt == "prompt");
+    CHECK(record->message_count == 2);
+    CHECK((seqs(*record) == std::vector<int64_t>{0, 1, 2, 3}));
+    CHECK(record->messages.back().message.content == "answer");
+}
+
+std::vector<std::string> contents(const SessionManager::DialogSnapshot& dialog) {
+    std::vector<std::string> result;
+    for (const auto& message : *dialog) {
+        result.push_back(message->role + ": " + message->content);
+    }
+    return result;
+}
+
+} // anonymous namespace
+
+int main() {
+    // Never destroyed: its threads run until the process exits
+    auto* upstream = new testing::ReplyingUpstream();
+
+    auto store_path = std::filesystem::temp_directory_path() / "prompt_portal_session_persistence_test.db";
+    std::filesystem::remove(store_path);
+    LlmConfig config;
+    config.server_url = "http://127.0.0.1:" + std::to_string(upstream->port());
+    config.health_check_interval_ms = 0;
+    config.completion_cache_mb = 0;
+    config.max_history_messages = 2;  // The last 2 user + assistant pairs
+    config.history_token_budget = 0;
+    config.session_ttl = 1;
+    config.session_reap_interval = 1;
+    config.session_memory_mb = 0;
+    config.session_store_path = store_path.string();
+    config.session_store_flush_ms = 10;
+    LLMClient client(config);
+    const std::string system = "You are terse.";
+
+    std::vector<std::string> before_restart;
+    {
+        SessionManager sessions(client, config);
+        CHECK(sessions.process_message("chat", system, "hello 1") == "reply 1");
+
+        // Evicted once idle for session_ttl, then loaded back by the next turn
+        CHECK(testing::wait_until([&] { return sessions.stats()["live_sessions"] == 0; }, 5000ms));
+        CHECK(sessions.process_message("chat", system, "hello 2") == "reply 2");
+        std::string sent = upstream->last_request();
+        CHECK(sent.find("You are terse.") != std::string::npos);
+        CHECK(sent.find("hello 1") != std::string::npos);
+        CHECK(sent.find("reply 1") != std::string::npos);
+        CHECK(sessions.stats()["store"]["loaded"].get<uint64_t>() >= 1);
+
+        // Past the window the oldest pair is trimmed, in memory and in the file
+        CHECK(sessions.process_message("chat", system, "hello 3") == "reply 3");
+        CHECK(sessions.process_message("chat", system, "hello 4") == "reply 4");
+        sent = upstream->last_request();
+        CHECK(sent.find("hello 1") == std::string::npos);
+        CHECK(sent.find("hello 2") == std::string::npos);
+        CHECK(sent.find("hello 3") != std::string::npos);
+
+        before_restart = contents(sessions.get_session_history("chat"));
+        CHECK((before_restart == std::vector<std::string>{
+            "system: You are terse.", "user: hello 3", "assistant: reply 3", "user: hello 4", "assistant: reply 4"}));
+
+        CHECK(sessions.process_message("gone", system, "forget me") == "reply 5");
+        sessions.clear_session("gone");
+    }  // Restart: the store writes everything still queued
+
+    {
+        // What the file holds: the trimmed window, its sequence numbers and the turn count
+        SessionStore store(store_path.string(), 10ms);
+        auto record = store.load("chat");
+        CHECK(record.has_value());
+        CHECK(record->system_prompt == system);
+        CHECK(record->message_count == 4);
+        CHECK(record->messages.size() == 4);
+        CHECK(record->messages.front().seq == 4);
+        CHECK(record->messages.back().seq == 7);
+        CHECK(!store.load("gone").has_value());
+    }
+
+    {
+        SessionManager sessions(client, config);
+        auto restored = sessions.get_session_history("chat");
+        CHECK(restored != nullptr);
+        CHECK(contents(restored) == before_restart);
+        CHECK(sessions.get_session_history("gone") == nullptr);
+
+        // Carries on with the restored history, and trims it again
+        CHECK(sessions.process_message("chat", system, "hello 5") == "reply 6");
+        std::string sent = upstream->last_request();
+        CHECK(sent.find("hello 3") == std::string::npos);
+        CHECK(sent.find("hello 4") != std::string::npos);
+        CHECK(sent.find("reply 4") != std::string::npos);
+        CHECK((contents(sessions.get_session_history("chat")) == std::vector<std::string>{
+            "system: You are terse.", "user: hello 4", "assistant: reply 4", "user: hello 5", "assistant: reply 6"}));
+    }
+
+    {
+        SessionStore store(store_path.string(), 10ms);
+        auto record = store.load("chat");
+        CHECK(record->message_count == 5);
+        CHECK(record->messages.front().seq == 6);
+        CHECK(record->messages.back().seq == 9);
+
+        // A create for a stored session (a turn that raced an eviction) keeps its dialog
+        store.create("chat", "Another prompt.", 0);
+        record = store.load("chat");
+        CHECK(record->system_prompt == system);
+        CHECK(record->messages.size() == 4);
+    }
+
+    std::filesystem::remove(store_path);
+    std::filesystem::remove(store_path.string() + "-wal");
+    std::filesystem::remove(store_path.string() + "-shm");
+
+    lost_changes(store_path);
+    std::filesystem::remove(store_path);
+    std::filesystem::remove(store_path.string() + "-wal");
+    std::filesystem::remove(store_path.string() + "-shm");
+    std::cout << "session_persistence_test: ok" << std::endl;
+    return 0;
+}
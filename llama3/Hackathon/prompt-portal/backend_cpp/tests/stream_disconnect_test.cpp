@@ -0,0 +1,134 @@
+// A client that closes its SSE connection mid-stream must make the server
+// close the upstream connection, so llama-server stops generating. The
+// upstream goes quiet after its first token, so nothing is written to the
+// client after it hangs up: only noticing the closed socket can cancel.
+
+#include "test_support.hpp"
+#include "auth.hpp"
+#include "config.hpp"
+#include "database.hpp"
+#include "llm_client.hpp"
+#include "stream_server.hpp"
+#include "handlers/llm_handler.hpp"
+#include <asio.hpp>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <thread>
+
+using namespace prompt_portal;
+using namespace std::chrono_literals;
+
+namespace {
+
+// Stands in for llama-server: sends one token, then keeps the stream open
+// (as if stuck in a long generation) until its client hangs up
+class StalledUpstream {
+public:
+    std::atomic<bool> streaming{false};
+    std::atomic<bool> closed_by_client{false};
+
+    StalledUpstream() : acceptor_(io_, {asio::ip::make_address("127.0.0.1"), 0}) {
+        thread_ = std::thread([this] { serve(); });
+    }
+
+    ~StalledUpstream() {
+        thread_.join();
+    }
+
+    int port() const {
+        return acceptor_.local_endpoint().port();
+    }
+
+private:
+    asio::io_context io_;
+    asio::ip::tcp::acceptor acceptor_;
+    std::thread thread_;
+
+    void serve() {
+        asio::ip::tcp::socket socket(io_);
+        acceptor_.accept(socket);
+        asio::streambuf request;
+        asio::read_until(socket, request, "\r\n\r\n");
+
+        std::string head = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nTransfer-Encoding: chunked\r\n\r\n";
+        asio::write(socket, asio::buffer(head));
+        std::string event = "data: {\"choices\":[{\"index\":0,\"delta\":{\"content\":\"token \"},\"finish_reason\":null}]}\n\n";
+        char size_line[16];
+        std::snprintf(size_line, sizeof(size_line), "%zx\r\n", event.size());
+        std::string chunk = size_line + event + "\r\n";
+
+        asio::write(socket, asio::buffer(chunk));
+        streaming = true;
+
+        // The request body and anything else sent is discarded; EOF means the client closed
+        socket.non_blocking(true);
+        auto give_up = std::chrono::steady_clock::now() + 10s;
+        while (std::chrono::steady_clock::now() < give_up) {
+            char discard[4096];
+            asio::error_code ec;
+            socket.read_some(asio::buffer(discard), ec);
+            if (ec && ec != asio::error::would_block) break;
+            std::this_thread::sleep_for(5ms);
+        }
+        closed_by_client = std::chrono::steady_clock::now() < give_up;
+    }
+};
+
+} // anonymous namespace
+
+int main() {
+    StalledUpstream upstream;
+
+    auto db_path = std::filesystem::temp_directory_path() / "prompt_portal_stream_disconnect_test.db";
+    std::filesystem::remove(db_path);
+    auto& config = get_config();
+    config.database.path = db_path.string();
+    config.llm.server_url = "http://127.0.0.1:" + std::to_string(upstream.port());
+    config.llm.upstreams.clear();
+    config.llm.health_check_interval_ms = 0;
+    config.llm.session_store_path = "";
+    Database::instance().initialize();
+    init_llm_service(config.llm);
+
+    auto user = Database::instance().create_user("stream@test", Auth::instance().hash_password("secret"));
+    std::string token = Auth::instance().create_access_token(user.id);
+
+    auto& streams = StreamServer::instance();
+    streams.route("POST", "/api/llm/chat/stream", [](const StreamRequest& req, std::shared_ptr<ResponseStream> out) {
+        handlers::LLMHandler::chat_stream(req.get_header_value("Authorization"), req.body, std::move(out));
+    });
+    streams.start("127.0.0.1", 0);
+
+    asio::io_context io;
+    asio::ip::tcp::socket client(io);
+    client.connect({asio::ip::make_address("127.0.0.1"), streams.port()});
+    std::string body = R"({"messages":[{"role":"user","content":"Count forever"}]})";
+    std::string request =
+        "POST /api/llm/chat/stream HTTP/1.1\r\n"
+        "Host: 127.0.0.1\r\n"
+        "Authorization: Bearer " + token + "\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+    asio::write(client, asio::buffer(request));
+
+    // The token reaches the client while the upstream is still generating
+    asio::streambuf response;
+    asio::read_until(client, response, "token");
+    CHECK(upstream.streaming);
+    CHECK(!upstream.closed_by_client);
+
+    // Hang up; the server has nothing more to write to this socket
+    client.close();
+    CHECK(testing::wait_until([&] { return upstream.closed_by_client.load(); }, 2000ms));
+    CHECK(testing::wait_until([] {
+        return get_llm_client().cancellation_stats()["cancelled_streams"].get<uint64_t>() == 1;
+    }, 2000ms));
+    CHECK(streams.stats()["disconnects"].get<uint64_t>() == 1);
+
+    streams.stop();
+    std::filesystem::remove(db_path);
+    std::cout << "stream_disconnect_test: ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <asio.hpp>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#define CHECK(condition)                                                                  \
+    do {                                                                                  \
+        if (!(condition)) {                                                               \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK failed: " #condition     \
+                      << std::endl;                                                       \
+            std::exit(1);                                                                 \
+        }                                                                                 \
+    } while (0)
+
+namespace prompt_portal {
+namespace testing {
+
+// Polls predicate until it holds or timeout passes; returns its last value
+template <typename Predicate>
+bool wait_until(Predicate predicate, std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!predicate()) {
+        if (std::chrono::steady_clock::now() > deadline) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return true;
+}
+
+// Stands in for llama-server on a loopback port: answers every completion with
+// "reply N" over keep-alive connections and keeps the last request body.
+// Its threads run until the process exits, so create it with new and leak it
+class ReplyingUpstream {
+public:
+    ReplyingUpstream() : acceptor_(io_, {asio::ip::make_address("127.0.0.1"), 0}) {
+        std::thread([this] {
+            while (true) {
+                auto socket = std::make_shared<asio::ip::tcp::socket>(io_);
+                acceptor_.accept(*socket);
+                std::thread([this, socket] { serve(*socket); }).detach();
+            }
+        }).detach();
+    }
+
+    int port() const {
+        return acceptor_.local_endpoint().port();
+    }
+
+    std::string last_request() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return last_request_;
+    }
+
+private:
+    asio::io_context io_;
+    asio::ip::tcp::acceptor acceptor_;
+    std::atomic<int> replies_{0};
+    std::mutex mutex_;
+    std::string last_request_;
+
+    void serve(asio::ip::tcp::socket& socket) {
+        asio::error_code ec;
+        asio::streambuf buffer;
+        while (true) {
+            size_t header_end = asio::read_until(socket, buffer, "\r\n\r\n", ec);
+            if (ec) return;
+            std::string head(asio::buffers_begin(buffer.data()), asio::buffers_begin(buffer.data()) + header_end);
+            buffer.consume(header_end);
+            for (auto& c : head) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            size_t length_at = head.find("content-length:");
+            size_t length = length_at == std::string::npos ? 0 : std::stoul(head.substr(length_at + 15));
+            if (buffer.size() < length) {
+                asio::read(socket, buffer, asio::transfer_exactly(length - buffer.size()), ec);
+                if (ec) return;
+            }
+            std::string body(asio::buffers_begin(buffer.data()), asio::buffers_begin(buffer.data()) + length);
+            buffer.consume(length);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                last_request_ = std::move(body);
+            }
+
+            std::string completion = R"({"choices":[{"index":0,"message":{"role":"assistant","content":"reply )"
+                + std::to_string(++replies_) + R"("},"finish_reason":"stop"}]})";
+            std::string response = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: "
+                + std::to_string(completion.size()) + "\r\n\r\n" + completion;
+            asio::write(socket, asio::buffer(response), ec);
+            if (ec) return;
+        }
+    }
+};
+
+} // namespace testing
+} // namespace prompt_portal
@@ -0,0 +1,99 @@
+// The token estimate and the history_token_budget trimming built on it. Each
+// message costs its content's estimate plus the chat template's framing. A
+// turn over budget drops the oldest history, a user message together with the
+// reply to it. The system prompt and the message being answered always stay.
+
+#include "test_support.hpp"
+#include "llm_client.hpp"
+#include "token_estimator.hpp"
+#include <string>
+#include <vector>
+
+using namespace prompt_portal;
+
+namespace {
+
+std::string words(const std::string& word, int count) {
+    std::string text;
+    for (int i = 0; i < count; ++i) {
+        text += (i ? " " : "") + word;
+    }
+    return text;
+}
+
+int tokens(const std::string& role, const std::string& content) {
+    return estimate_message_tokens(ChatMessage{.role = role, .content = content});
+}
+
+std::vector<std::string> contents(const SessionManager::DialogSnapshot& dialog) {
+    std::vector<std::string> result;
+    for (const auto& message : *dialog) {
+        result.push_back(message->role + ": " + message->content);
+    }
+    return result;
+}
+
+void estimates() {
+    CHECK(estimate_tokens("") == 0);
+    CHECK(estimate_tokens("hello world") == 2);
+    CHECK(estimate_tokens("internationalization") == 4);  // One token per six letters
+    CHECK(estimate_tokens("1234567") == 3);                // Digits in threes
+    CHECK(estimate_tokens("a, b.\n\nc") == 6);             // Punctuation and a run of line breaks count one each
+    CHECK(estimate_tokens("\xe4\xb8\xad\xe6\x96\x87") == 2);  // CJK: one per character
+    CHECK(estimate_tokens("\xf0\x9f\x98\x80") == 2);          // Emoji: two
+
+    // Every message pays the same template framing on top of its content
+    int overhead = tokens("user", "");
+    CHECK(overhead > 0);
+    for (const std::string content : {"hello world", "internationalization", "\xf0\x9f\x98\x80", "1234567"}) {
+        CHECK(tokens("user", content) == estimate_tokens(content) + overhead);
+        CHECK(tokens("assistant", content) == tokens("user", content));
+    }
+}
+
+void budget_trimming(int port) {
+    const std::string system = "You are terse.";
+    const std::string first = words("one", 20);
+    const std::string second = words("two", 25);
+    const std::string too_long = words("three", 200);
+
+    LlmConfig config;
+    config.server_url = "http://127.0.0.1:" + std::to_string(port);
+    config.health_check_interval_ms = 0;
+    config.completion_cache_mb = 0;
+    config.max_history_messages = 100;  // Only the token budget trims
+    // Room for the system prompt, the first pair and a little more, but not the second user message too
+    config.history_token_budget = tokens("system", system) + tokens("user", first) + tokens("assistant", "reply 1")
+        + tokens("user", second) - 1;
+    config.session_ttl = 0;
+    config.session_memory_mb = 0;
+    config.session_store_path = "";
+    LLMClient client(config);
+    SessionManager sessions(client, config);
+
+    CHECK(sessions.process_message("budget", system, first) == "reply 1");
+    CHECK((contents(sessions.get_session_history("budget")) == std::vector<std::string>{
+        "system: " + system, "user: " + first, "assistant: reply 1"}));
+
+    // Dropping the first user message alone would fit, but its reply goes with it
+    CHECK(sessions.process_message("budget", system, second) == "reply 2");
+    CHECK((contents(sessions.get_session_history("budget")) == std::vector<std::string>{
+        "system: " + system, "user: " + second, "assistant: reply 2"}));
+
+    // Over budget on its own: still sent, with the system prompt and nothing older
+    CHECK(sessions.process_message("budget", system, too_long) == "reply 3");
+    CHECK((contents(sessions.get_session_history("budget")) == std::vector<std::string>{
+        "system: " + system, "user: " + too_long, "assistant: reply 3"}));
+}
+
+} // anonymous namespace
+
+int main() {
+    estimates();
+
+    // Never destroyed: its threads run until the process exits
+    auto* upstream = new testing::ReplyingUpstream();
+    budget_trimming(upstream->port());
+    std::cout << "token_budget_test: ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,98 @@
+// No upstream may run more than max_concurrent_per_upstream requests, whoever
+// picks it: a preferred (affinity) pick, either balancing policy, or a hedge.
+// When every healthy upstream is full, acquire() waits for a release.
+
+#include "test_support.hpp"
+#include "upstream_set.hpp"
+#include <atomic>
+#include <vector>
+
+using namespace prompt_portal;
+using namespace std::chrono_literals;
+
+namespace {
+
+LlmConfig two_upstreams(const std::string& policy) {
+    LlmConfig config;
+    config.upstreams = {{"http://127.0.0.1:1", 1}, {"http://127.0.0.1:2", 3}};
+    config.max_concurrent_per_upstream = 2;
+    config.balance_policy = policy;
+    return config;
+}
+
+void fills_up_then_waits(const std::string& policy) {
+    UpstreamSet upstreams(two_upstreams(policy));
+    auto& first = *upstreams.upstreams()[0];
+    auto& second = *upstreams.upstreams()[1];
+
+    // Affinity to the first upstream stops being honoured once it is full
+    std::vector<UpstreamSet::Upstream*> taken;
+    for (int i = 0; i < 4; ++i) {
+        auto* upstream = upstreams.select(0);
+        CHECK(upstream != nullptr);
+        taken.push_back(upstream);
+    }
+    CHECK(first.in_flight == 2);
+    CHECK(second.in_flight == 2);
+    CHECK(upstreams.select(0) == nullptr);
+    CHECK(upstreams.select() == nullptr);
+    CHECK(upstreams.select_other(first) == nullptr);
+
+    std::atomic<UpstreamSet::Upstream*> acquired{nullptr};
+    upstreams.acquire(-1, [&](std::exception_ptr error, UpstreamSet::Upstream* upstream) {
+        CHECK(!error);
+        acquired = upstream;
+    });
+    CHECK(acquired == nullptr);
+
+    // The freed spot goes to the waiting request, not past the limit
+    upstreams.release(*taken[3], true);
+    CHECK(testing::wait_until([&] { return acquired.load() != nullptr; }, 2000ms));
+    CHECK(acquired.load() == taken[3]);
+    CHECK(first.in_flight == 2);
+    CHECK(second.in_flight == 2);
+
+    upstreams.release(*acquired.load(), true);
+    for (int i = 0; i < 3; ++i) {
+        upstreams.release(*taken[i], true);
+    }
+    CHECK(first.in_flight == 0);
+    CHECK(second.in_flight == 0);
+}
+
+void fails_waiters_when_no_circuit_is_closed() {
+    auto config = two_upstreams("least_outstanding");
+    config.eject_after_failures = 1;
+    UpstreamSet upstreams(config);
+
+    std::vector<UpstreamSet::Upstream*> taken;
+    for (int i = 0; i < 4; ++i) {
+        taken.push_back(upstreams.select());
+    }
+    std::atomic<bool> failed{false};
+    upstreams.acquire(-1, [&](std::exception_ptr error, UpstreamSet::Upstream* upstream) {
+        failed = error != nullptr && upstream == nullptr;
+    });
+
+    // One failure ejects each upstream; the waiter must not wait for a dead server
+    upstreams.release(*upstreams.upstreams()[0], false);
+    upstreams.release(*upstreams.upstreams()[1], false);
+    CHECK(testing::wait_until([&] { return failed.load(); }, 2000ms));
+    bool threw = false;
+    try {
+        upstreams.select();
+    } catch (const NoHealthyUpstream&) {
+        threw = true;
+    }
+    CHECK(threw);
+}
+
+} // anonymous namespace
+
+int main() {
+    fills_up_then_waits("least_outstanding");
+    fills_up_then_waits("power_of_two");
+    fails_waiters_when_no_circuit_is_closed();
+    std::cout << "upstream_capacity_test: ok" << std::endl;
+    return 0;
+}